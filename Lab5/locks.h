@@ -0,0 +1,249 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Lock implementations for ptcount_bench, all static inline so the
+ * benchmark stays one file:
+ *
+ *   tas     test-and-set: every waiter keeps exchanging the lock word,
+ *           so the line holding it bounces between all of them
+ *   ttas    test-and-test-and-set: waiters spin reading their cached
+ *           copy, and back off exponentially after losing a race
+ *   ticket  FIFO: take a ticket, wait until it is being served
+ *   mcs     FIFO queue lock: each waiter spins on a flag in its own
+ *           node, and the holder hands the lock to its successor
+ *   clh     FIFO queue lock: each waiter spins on its predecessor's
+ *           node, and takes that node over when it gets the lock
+ *   futex   three-state mutex (free, locked, contended) that sleeps in
+ *           the kernel instead of spinning, as glibc's mutex does
+ *
+ * Spinning only helps while the holder is running on another CPU. A
+ * waiter that has spun spin_limit times yields the CPU, so a holder or
+ * a queue successor that was preempted gets to run, and the spinlocks
+ * still finish with more threads than CPUs. locks_init() sets
+ * spin_limit to SPIN_LIMIT, or to 1 on a uniprocessor, where the
+ * holder can never run while anyone spins.
+ */
+#define LOCK_CACHE_LINE   64
+#define SPIN_LIMIT        1024
+#define BACKOFF_MIN       4
+#define BACKOFF_MAX       1024
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__ ("yield" ::: "memory");
+#else
+  __asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+static unsigned spin_limit = SPIN_LIMIT;
+
+static inline void locks_init(void)
+{
+  spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 1;
+}
+
+static inline void spin_pause(unsigned *spins)
+{
+  if (++*spins < spin_limit) {
+    cpu_relax();
+  } else {
+    *spins = 0;
+    sched_yield();
+  }
+}
+
+/*
+ * tas
+ */
+typedef struct tas_lock {
+  int locked;
+} tas_lock;
+
+static inline void tas_acquire(tas_lock *l)
+{
+  unsigned spins = 0;
+
+  while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE))
+    spin_pause(&spins);
+}
+
+static inline void tas_release(tas_lock *l)
+{
+  __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * ttas
+ */
+typedef tas_lock ttas_lock;
+
+static inline void ttas_acquire(ttas_lock *l)
+{
+  unsigned spins = 0, backoff = BACKOFF_MIN, i;
+
+  for (;;) {
+    while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED))
+      spin_pause(&spins);
+    if (!__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE))
+      return;
+    for (i = 0; i < backoff; i++)
+      cpu_relax();
+    if (backoff < BACKOFF_MAX)
+      backoff *= 2;
+  }
+}
+
+static inline void ttas_release(ttas_lock *l)
+{
+  tas_release(l);
+}
+
+/*
+ * ticket: next is written by every arriving thread and serving only by
+ * the holder, so they get lines of their own
+ */
+typedef struct ticket_lock {
+  unsigned next;
+  char pad[LOCK_CACHE_LINE - sizeof (unsigned)];
+  unsigned serving;
+} ticket_lock;
+
+static inline void ticket_acquire(ticket_lock *l)
+{
+  unsigned spins = 0;
+  unsigned mine = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+
+  while (__atomic_load_n(&l->serving, __ATOMIC_ACQUIRE) != mine)
+    spin_pause(&spins);
+}
+
+static inline void ticket_release(ticket_lock *l)
+{
+  __atomic_store_n(&l->serving, l->serving + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * mcs: a thread passes its own node, which must stay put until it has
+ * released the lock
+ */
+typedef struct mcs_node {
+  struct mcs_node *next;
+  int locked;
+} __attribute__ ((aligned (LOCK_CACHE_LINE))) mcs_node;
+
+typedef struct mcs_lock {
+  mcs_node *tail;
+} mcs_lock;
+
+static inline void mcs_acquire(mcs_lock *l, mcs_node *me)
+{
+  unsigned spins = 0;
+  mcs_node *prev;
+
+  me->next = NULL;
+  me->locked = 1;
+  prev = __atomic_exchange_n(&l->tail, me, __ATOMIC_ACQ_REL);
+  if (prev == NULL)
+    return;
+  __atomic_store_n(&prev->next, me, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE))
+    spin_pause(&spins);
+}
+
+static inline void mcs_release(mcs_lock *l, mcs_node *me)
+{
+  unsigned spins = 0;
+  mcs_node *next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+  mcs_node *expected = me;
+
+  if (next == NULL) {
+    /* No successor yet: done if nobody is queued behind us */
+    if (__atomic_compare_exchange_n(&l->tail, &expected, NULL, 0,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return;
+    /* Someone swapped in behind us and is about to link in */
+    while ((next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == NULL)
+      spin_pause(&spins);
+  }
+  __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * clh: the lock starts out with an unlocked dummy node. Each thread
+ * brings one node and leaves with its predecessor's, so a thread's
+ * clh_thread must start out with a node of its own and keep whatever
+ * node it ends up with.
+ */
+typedef struct clh_node {
+  int locked;
+} __attribute__ ((aligned (LOCK_CACHE_LINE))) clh_node;
+
+typedef struct clh_lock {
+  clh_node *tail;
+} clh_lock;
+
+typedef struct clh_thread {
+  clh_node *node;
+  clh_node *pred;
+} clh_thread;
+
+static inline void clh_acquire(clh_lock *l, clh_thread *me)
+{
+  unsigned spins = 0;
+
+  __atomic_store_n(&me->node->locked, 1, __ATOMIC_RELAXED);
+  me->pred = __atomic_exchange_n(&l->tail, me->node, __ATOMIC_ACQ_REL);
+  while (__atomic_load_n(&me->pred->locked, __ATOMIC_ACQUIRE))
+    spin_pause(&spins);
+}
+
+static inline void clh_release(clh_lock *l, clh_thread *me)
+{
+  (void) l;
+  __atomic_store_n(&me->node->locked, 0, __ATOMIC_RELEASE);
+  me->node = me->pred;
+}
+
+/*
+ * futex: 0 free, 1 locked, 2 locked with possible sleepers. Release
+ * only makes a system call when the word says somebody may be asleep.
+ */
+typedef struct futex_lock {
+  int state;
+} futex_lock;
+
+static inline void futex_acquire(futex_lock *l)
+{
+  int c = 0;
+
+  if (__atomic_compare_exchange_n(&l->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+  if (c != 2)
+    c = __atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE);
+  while (c != 0) {
+    syscall(SYS_futex, &l->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+    c = __atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+static inline void futex_release(futex_lock *l)
+{
+  if (__atomic_fetch_sub(&l->state, 1, __ATOMIC_RELEASE) != 1) {
+    __atomic_store_n(&l->state, 0, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &l->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+#endif /* LOCKS_H */
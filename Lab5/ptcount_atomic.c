@@ -1,17 +1,134 @@
+#define _GNU_SOURCE
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #define NUM_THREADS  3
 
+/*
+ * How each decrement is done: the memory order of the atomic, and
+ * whether it is a single fetch-and-add or a compare-and-swap loop that
+ * retries when another thread changed count in between. The default,
+ * seq_cst fetch-and-add, is what this program has always done.
+ */
+typedef enum { ORDER_RELAXED, ORDER_ACQ_REL, ORDER_SEQ_CST } order_kind;
+typedef enum { OP_FETCH_ADD, OP_CAS } op_kind;
+
+static const char *order_names[] = { "relaxed", "acq_rel", "seq_cst" };
+static const char *op_names[]    = { "fetch_add", "cas" };
+
 typedef struct thread_args {
   int tid;
   int inc;
   int loop;
+  uint64_t cycles;     /* timestamp counter ticks spent in the loop */
+  uint64_t retries;    /* failed compare-and-swaps */
 } thread_args ;
 
 int count = 0;
 pthread_mutex_t count_mutex;
+pthread_barrier_t start_line;
+order_kind order = ORDER_SEQ_CST;
+op_kind op = OP_FETCH_ADD;
+int pin = 0;
+
+/*
+ * Cycles as the processor's timestamp counter counts them: TSC ticks
+ * on x86, the generic timer on ARM64, nanoseconds elsewhere. The TSC
+ * runs at a fixed rate, so under frequency scaling these are not core
+ * clock cycles, but they are comparable between runs on one machine.
+ */
+static inline uint64_t read_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t v;
+  __asm__ __volatile__ ("isb; mrs %0, cntvct_el0" : "=r" (v));
+  return v;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * The builtins need the memory order as a constant to emit anything
+ * but seq_cst, so there is one decrement loop per order and operation.
+ * A failed compare-and-swap only reloads count, so it takes the
+ * strongest order allowed for a failure that is no stronger than the
+ * success order.
+ */
+#define DECREMENT_LOOPS(name, success, failure)                          \
+static uint64_t fetch_add_##name(int loop, int inc)                      \
+{                                                                        \
+  int i;                                                                 \
+  for (i = 0; i < loop; i++)                                             \
+    __atomic_add_fetch(&count, -inc, success);                           \
+  return 0;                                                              \
+}                                                                        \
+                                                                         \
+static uint64_t cas_##name(int loop, int inc)                            \
+{                                                                        \
+  uint64_t retries = 0;                                                  \
+  int i, old;                                                            \
+  old = __atomic_load_n(&count, __ATOMIC_RELAXED);                       \
+  for (i = 0; i < loop; i++) {                                           \
+    while (!__atomic_compare_exchange_n(&count, &old, old - inc, 1,      \
+                                        success, failure))               \
+      retries++;                                                         \
+    old -= inc;                                                          \
+  }                                                                      \
+  return retries;                                                        \
+}
+
+DECREMENT_LOOPS(relaxed, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+DECREMENT_LOOPS(acq_rel, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+DECREMENT_LOOPS(seq_cst, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+static uint64_t (*decrement_loops[2][3])(int, int) = {
+  { fetch_add_relaxed, fetch_add_acq_rel, fetch_add_seq_cst },
+  { cas_relaxed,       cas_acq_rel,       cas_seq_cst },
+};
+
+/*
+ * Pin the calling thread to the tid-th CPU this process may run on, so
+ * threads stay put and the cost of moving count between caches is what
+ * gets measured
+ */
+static void pin_thread(int tid)
+{
+#ifdef __linux__
+  cpu_set_t allowed, mine;
+  int cpu, n = 0, want;
+
+  if (sched_getaffinity(0, sizeof (allowed), &allowed) != 0)
+    return;
+  want = tid % CPU_COUNT(&allowed);
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+    if (n++ == want)
+      break;
+  }
+  CPU_ZERO(&mine);
+  CPU_SET(cpu, &mine);
+  if (pthread_setaffinity_np(pthread_self(), sizeof (mine), &mine) != 0)
+    fprintf(stderr, "Thread: %d could not be pinned to CPU %d\n", tid, cpu);
+#else
+  (void) tid;
+#endif
+}
 
 /*
  * This routine will be executed by each thread we choose to create.
@@ -20,72 +137,146 @@ pthread_mutex_t count_mutex;
  */
 void *inc_count(void *arg)
 {
-  int i,loc;
+  int loc;
+  uint64_t start;
   thread_args *my_args = (thread_args*) arg;
   loc = my_args->loop;
 
-  for (i = 0; i < my_args->loop; i++) {
-    __atomic_add_fetch(&count, -(my_args->inc), __ATOMIC_SEQ_CST);
-    loc -= my_args->inc;
-  }
+  if (pin)
+    pin_thread(my_args->tid);
+  pthread_barrier_wait(&start_line);
+
+  start = read_cycles();
+  my_args->retries = decrement_loops[op][order](my_args->loop, my_args->inc);
+  my_args->cycles = read_cycles() - start;
+  loc -= my_args->loop * my_args->inc;
+
   printf("Thread: %d finished. Counted: %d\n", my_args->tid, loc);
-  free(my_args);
   pthread_exit(NULL);
 }
 
+void usage(void)
+{
+  printf("Usage: ./ptcount_atomic [-t THREADS] [-m relaxed|acq_rel|seq_cst] [-c] [-p] LOOP_BOUND INCREMENT\n");
+  printf("  -t  number of threads (default %d)\n", NUM_THREADS);
+  printf("  -m  memory order of each decrement (default seq_cst)\n");
+  printf("  -c  decrement with a compare-and-swap loop instead of fetch-and-add\n");
+  printf("  -p  pin each thread to its own CPU\n");
+  exit(0);
+}
+
 int main(int argc, char *argv[])
 {
-  int i, loop, inc;
+  int c, i, loop, inc, num_threads = NUM_THREADS;
   struct thread_args *targs;
-  pthread_t threads[NUM_THREADS];
+  pthread_t *threads;
   pthread_attr_t attr;
+  uint64_t start, end, cycles = 0, retries = 0;
+  double ops;
 
-  if (argc != 3) {
-    printf("Usage: ./ptcount_atomic LOOP_BOUND INCREMENT\n");
-    exit(0);
+  while ((c = getopt(argc, argv, "t:m:cp")) != -1) {
+    switch (c) {
+    case 't':
+      num_threads = atoi(optarg);
+      break;
+    case 'm':
+      for (i = 0; i < 3; i++)
+        if (strcmp(optarg, order_names[i]) == 0)
+          break;
+      if (i == 3)
+        usage();
+      order = (order_kind) i;
+      break;
+    case 'c':
+      op = OP_CAS;
+      break;
+    case 'p':
+      pin = 1;
+      break;
+    default:
+      usage();
+    }
   }
 
+  if (argc - optind != 2 || num_threads < 1)
+    usage();
+
   /*
    * First argument is how many times to loop. The second is how much
    * to decrement each time.
    */
-  loop = atoi(argv[1]);
-  inc = atoi(argv[2]);
+  loop = atoi(argv[optind]);
+  inc = atoi(argv[optind + 1]);
+  if ((long long) loop * num_threads > INT_MAX) {
+    fprintf(stderr, "LOOP_BOUND * THREADS must fit in an int.\n");
+    exit(1);
+  }
 
-  count = loop * NUM_THREADS;
+  count = loop * num_threads;
+  threads = malloc(sizeof (pthread_t) * num_threads);
+  targs = malloc(sizeof (thread_args) * num_threads);
+  if (threads == NULL || targs == NULL) {
+    fprintf(stderr, "main: allocation failed\n");
+    exit(1);
+  }
 
   /* For portability, explicitly create threads in a joinable state */
   pthread_attr_init(&attr);
   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
+  /*
+   * The threads and main all start timing together at the barrier
+   */
+  pthread_barrier_init(&start_line, NULL, num_threads + 1);
+
   /* Create each thread using pthread_create.  The start routine for
    * each thread should be inc_count. The attribute object should be
    * attr. You should pass as the thread's sole argument the populated
    * targs struct. Note we create a different copy of it for each
    * thread.
    */
-  for (i = 0; i < NUM_THREADS; i++) {
-    targs = malloc(sizeof(thread_args));
-    targs->tid = i;
-    targs->loop = loop;
-    targs->inc = inc;
+  for (i = 0; i < num_threads; i++) {
+    targs[i].tid = i;
+    targs[i].loop = loop;
+    targs[i].inc = inc;
     /* Make call to pthread_create here */
-    pthread_create(&threads[i], &attr, inc_count, targs);
+    pthread_create(&threads[i], &attr, inc_count, &targs[i]);
   }
 
+  pthread_barrier_wait(&start_line);
+  start = read_cycles();
+
   /* Wait for all threads to complete using pthread_join.  The threads
    * do not return anything on exit, so the second argument is NULL
    */
-  for (i = 0; i < NUM_THREADS; i++) {
+  for (i = 0; i < num_threads; i++) {
     /* Make call to pthread_join here */
     pthread_join(threads[i], NULL);
+    cycles += targs[i].cycles;
+    retries += targs[i].retries;
   }
+  end = read_cycles();
 
   printf ("Main(): Waited on %d threads. Final value of count = %d. Done.\n",
-          NUM_THREADS, count);
+          num_threads, count);
+
+  /*
+   * Per thread, cycles per decrement is what one decrement costs the
+   * thread doing it; overall, it is the wall clock between decrements
+   * done by anyone
+   */
+  ops = (double) loop * num_threads;
+  printf("Main(): %s %s%s: %.1f cycles/op per thread, %.1f cycles/op overall",
+         order_names[order], op_names[op], pin ? ", pinned" : "",
+         cycles / ops, (end - start) / ops);
+  if (op == OP_CAS)
+    printf(", %.3f CAS retries/op", retries / ops);
+  printf("\n");
 
   /* Clean up and exit */
+  pthread_barrier_destroy(&start_line);
   pthread_attr_destroy(&attr);
+  free(threads);
+  free(targs);
   pthread_exit (NULL);
 }
-
@@ -0,0 +1,465 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "locks.h"
+
+/*
+ * Benchmark driver for the ways ptcount can share count. Each variant
+ * runs the ptcount workload, every thread decrementing count LOOP
+ * times by INCREMENT, for 1, 2, 4, ... threads up to the maximum, and
+ * reports nanoseconds per decrement: wall time from the moment all
+ * threads are released until the last one is done, divided by the
+ * decrements of all threads together. Every run checks that count
+ * ends at 0, as it does in ptcount_mutex.
+ *
+ * Fairness is Jain's index over how far each thread had got when the
+ * first one finished: 1.0 when all had done the same, 1/THREADS when
+ * one thread did everything while the rest waited.
+ *
+ *   mutex    count_mutex around every decrement, as ptcount_mutex
+ *   atomic   one seq_cst atomic add per decrement, as ptcount_atomic
+ *   sharded  per-thread padded counters folded into count every
+ *            FLUSH decrements, as ptcount_sharded
+ *   tas, ttas, ticket, mcs, clh, futex
+ *            the locks in locks.h around every decrement
+ *
+ * The locked variants can do -w units of work inside the critical
+ * section along with the decrement, and every variant -u units outside
+ * it, to model longer critical sections and time between them.
+ */
+#define CACHE_LINE   64
+#define FLUSH        1024
+#define LOOP         10000000
+#define MAX_THREADS  8
+
+typedef struct variant {
+  const char *name;
+  void (*setup) (int threads);     /* before the threads start */
+  void (*run) (int tid);           /* one thread's share of the workload */
+} variant;
+
+typedef struct local_count {
+  int  count;
+  char pad[CACHE_LINE - sizeof (int)];
+} local_count;
+
+int count = 0;
+int loop = LOOP;
+int inc = 1;
+int flush = FLUSH;
+pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+local_count *local;
+pthread_barrier_t start_line;
+int cs_work = 0;
+int outside_work = 0;
+local_count *progress;      /* decrements done by each thread so far */
+int *snapshot;              /* progress when the first thread finished */
+int first_done;
+
+/*
+ * One unit of work is one trip around a loop the compiler has to keep
+ */
+static inline void work(int units)
+{
+  int i;
+
+  for (i = 0; i < units; i++)
+    __asm__ __volatile__ ("" ::: "memory");
+}
+
+/*
+ * A locked decrement of count, with the critical section's extra work
+ */
+static inline void critical(void)
+{
+  count -= inc;
+  work(cs_work);
+}
+
+/*
+ * Everything each variant does between decrements
+ */
+static inline void between(int tid, int done)
+{
+  work(outside_work);
+  __atomic_store_n(&progress[tid].count, done, __ATOMIC_RELAXED);
+}
+
+/*
+ * mutex: count_mutex around every decrement
+ */
+void mutex_setup(int threads)
+{
+  (void) threads;
+}
+
+void mutex_run(int tid)
+{
+  int i;
+
+  for (i = 0; i < loop; i++) {
+    pthread_mutex_lock(&count_mutex);
+    critical();
+    pthread_mutex_unlock(&count_mutex);
+    between(tid, i + 1);
+  }
+}
+
+/*
+ * atomic: one read-modify-write of the shared count per decrement
+ */
+void atomic_setup(int threads)
+{
+  (void) threads;
+}
+
+void atomic_run(int tid)
+{
+  int i;
+
+  for (i = 0; i < loop; i++) {
+    __atomic_add_fetch(&count, -inc, __ATOMIC_SEQ_CST);
+    between(tid, i + 1);
+  }
+}
+
+/*
+ * sharded: each thread decrements its own cache line and folds it into
+ * count every flush decrements, and once more at the end
+ */
+void sharded_setup(int threads)
+{
+  free(local);
+  local = aligned_alloc(CACHE_LINE, sizeof (local_count) * threads);
+  if (local == NULL) {
+    fprintf(stderr, "sharded_setup: allocation failed\n");
+    exit(1);
+  }
+  memset(local, 0, sizeof (local_count) * threads);
+}
+
+void sharded_run(int tid)
+{
+  local_count *mine = &local[tid];
+  int i, pending = 0;
+
+  for (i = 0; i < loop; i++) {
+    mine->count -= inc;
+    if (++pending == flush) {
+      __atomic_add_fetch(&count, mine->count, __ATOMIC_RELAXED);
+      mine->count = 0;
+      pending = 0;
+    }
+    between(tid, i + 1);
+  }
+  __atomic_add_fetch(&count, mine->count, __ATOMIC_RELAXED);
+  mine->count = 0;
+}
+
+/*
+ * The locks of locks.h that need nothing but the lock itself
+ */
+#define SIMPLE_LOCK_VARIANT(name)               \
+name##_lock name;                               \
+                                                \
+void name##_setup(int threads)                  \
+{                                               \
+  (void) threads;                               \
+  memset(&name, 0, sizeof (name));              \
+}                                               \
+                                                \
+void name##_run(int tid)                        \
+{                                               \
+  int i;                                        \
+                                                \
+  for (i = 0; i < loop; i++) {                  \
+    name##_acquire(&name);                      \
+    critical();                                 \
+    name##_release(&name);                      \
+    between(tid, i + 1);                        \
+  }                                             \
+}
+
+SIMPLE_LOCK_VARIANT(tas)
+SIMPLE_LOCK_VARIANT(ttas)
+SIMPLE_LOCK_VARIANT(ticket)
+SIMPLE_LOCK_VARIANT(futex)
+
+/*
+ * mcs: each thread queues its own node, kept on its stack
+ */
+mcs_lock mcs;
+
+void mcs_setup(int threads)
+{
+  (void) threads;
+  mcs.tail = NULL;
+}
+
+void mcs_run(int tid)
+{
+  mcs_node me;
+  int i;
+
+  for (i = 0; i < loop; i++) {
+    mcs_acquire(&mcs, &me);
+    critical();
+    mcs_release(&mcs, &me);
+    between(tid, i + 1);
+  }
+}
+
+/*
+ * clh: nodes change hands, so they come from one pool, one per thread
+ * plus the lock's starting dummy, freed after the run
+ */
+clh_lock clh;
+clh_node *clh_nodes;
+
+void clh_setup(int threads)
+{
+  free(clh_nodes);
+  clh_nodes = aligned_alloc(LOCK_CACHE_LINE, sizeof (clh_node) * (threads + 1));
+  if (clh_nodes == NULL) {
+    fprintf(stderr, "clh_setup: allocation failed\n");
+    exit(1);
+  }
+  memset(clh_nodes, 0, sizeof (clh_node) * (threads + 1));
+  clh.tail = &clh_nodes[threads];
+}
+
+void clh_run(int tid)
+{
+  clh_thread me = { &clh_nodes[tid], NULL };
+  int i;
+
+  for (i = 0; i < loop; i++) {
+    clh_acquire(&clh, &me);
+    critical();
+    clh_release(&clh, &me);
+    between(tid, i + 1);
+  }
+}
+
+variant variants[] = {
+  { "mutex",   mutex_setup,   mutex_run },
+  { "atomic",  atomic_setup,  atomic_run },
+  { "sharded", sharded_setup, sharded_run },
+  { "tas",     tas_setup,     tas_run },
+  { "ttas",    ttas_setup,    ttas_run },
+  { "ticket",  ticket_setup,  ticket_run },
+  { "mcs",     mcs_setup,     mcs_run },
+  { "clh",     clh_setup,     clh_run },
+  { "futex",   futex_setup,   futex_run },
+};
+
+#define NUM_VARIANTS  (int) (sizeof (variants) / sizeof (variants[0]))
+
+typedef struct thread_args {
+  int tid;
+  int threads;
+  variant *v;
+  uint64_t start;      /* when this thread left the start line */
+} thread_args;
+
+uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void *bench_thread(void *arg)
+{
+  thread_args *my_args = (thread_args *) arg;
+
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  my_args->start = now_ns();
+  my_args->v->run(my_args->tid);
+
+  if (!__atomic_exchange_n(&first_done, 1, __ATOMIC_ACQ_REL))
+    for (i = 0; i < my_args->threads; i++)
+      snapshot[i] = __atomic_load_n(&progress[i].count, __ATOMIC_RELAXED);
+  pthread_exit(NULL);
+}
+
+/*
+ * Run variant v with the given number of threads and return the
+ * nanoseconds per decrement, or -1 if count did not come out right.
+ * Jain's fairness index goes into *fairness.
+ */
+double bench(variant *v, int threads, double *fairness)
+{
+  pthread_t *tids = malloc(sizeof (pthread_t) * threads);
+  thread_args *targs = malloc(sizeof (thread_args) * threads);
+  uint64_t start, end;
+  double sum = 0, sum_sq = 0;
+  int i;
+
+  progress = aligned_alloc(CACHE_LINE, sizeof (local_count) * threads);
+  snapshot = malloc(sizeof (int) * threads);
+  if (tids == NULL || targs == NULL || progress == NULL || snapshot == NULL) {
+    fprintf(stderr, "bench: allocation failed\n");
+    exit(1);
+  }
+
+  memset(progress, 0, sizeof (local_count) * threads);
+  first_done = 0;
+  count = loop * threads * inc;
+  v->setup(threads);
+  pthread_barrier_init(&start_line, NULL, threads + 1);
+  for (i = 0; i < threads; i++) {
+    targs[i].tid = i;
+    targs[i].threads = threads;
+    targs[i].v = v;
+    pthread_create(&tids[i], NULL, bench_thread, &targs[i]);
+  }
+
+  /*
+   * Timing starts with the first thread off the start line, which may
+   * be well before main gets to run again
+   */
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+  end = now_ns();
+  start = end;
+  for (i = 0; i < threads; i++)
+    if (targs[i].start < start)
+      start = targs[i].start;
+
+  pthread_barrier_destroy(&start_line);
+  for (i = 0; i < threads; i++) {
+    sum += snapshot[i];
+    sum_sq += (double) snapshot[i] * snapshot[i];
+  }
+  *fairness = sum * sum / (threads * sum_sq);
+  free(tids);
+  free(targs);
+  free(progress);
+  free(snapshot);
+
+  if (count != 0)
+    return -1;
+  return (double) (end - start) / ((double) loop * threads);
+}
+
+void usage(void)
+{
+  int i;
+
+  printf("Usage: ./ptcount_bench [-t MAX_THREADS] [-n LOOP_BOUND] [-i INCREMENT] [-f FLUSH]\n"
+         "                       [-w CS_WORK] [-u OUTSIDE_WORK] [-v VARIANT] [-o FILE.csv]\n");
+  printf("  -t  sweep 1, 2, 4, ... threads up to this (default %d)\n", MAX_THREADS);
+  printf("  -n  decrements per thread (default %d)\n", LOOP);
+  printf("  -i  amount of each decrement (default 1)\n");
+  printf("  -f  decrements a sharded thread keeps before folding them in (default %d)\n", FLUSH);
+  printf("  -w  units of work inside each critical section (default 0)\n");
+  printf("  -u  units of work between decrements (default 0)\n");
+  printf("  -v  run only this variant:");
+  for (i = 0; i < NUM_VARIANTS; i++)
+    printf(" %s", variants[i].name);
+  printf("\n  -o  append the results as CSV rows to this file\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int max_threads = MAX_THREADS;
+  const char *only = NULL;
+  const char *csv = NULL;
+  FILE *out = NULL;
+  double ns, fairness;
+  int c, i, threads, found = 0;
+
+  while ((c = getopt(argc, argv, "t:n:i:f:w:u:v:o:")) != -1) {
+    switch (c) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'n':
+      loop = atoi(optarg);
+      break;
+    case 'i':
+      inc = atoi(optarg);
+      break;
+    case 'f':
+      flush = atoi(optarg);
+      break;
+    case 'w':
+      cs_work = atoi(optarg);
+      break;
+    case 'u':
+      outside_work = atoi(optarg);
+      break;
+    case 'v':
+      only = optarg;
+      break;
+    case 'o':
+      csv = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc)
+    usage();
+  if (max_threads < 1 || loop < 1 || inc < 1) {
+    fprintf(stderr, "Need at least 1 thread, 1 decrement and an increment of 1.\n");
+    exit(1);
+  }
+  if ((long long) loop * max_threads * inc > INT_MAX) {
+    fprintf(stderr, "LOOP_BOUND * MAX_THREADS * INCREMENT must fit in an int.\n");
+    exit(1);
+  }
+
+  locks_init();
+  if (csv != NULL) {
+    out = fopen(csv, "a");
+    if (out == NULL) {
+      fprintf(stderr, "Unable to open \"%s\".\n", csv);
+      exit(1);
+    }
+    if (ftell(out) == 0)
+      fprintf(out, "variant,threads,loop,increment,cs_work,outside_work,ns_per_op,fairness\n");
+  }
+
+  printf("%-10s %8s %12s %14s %10s\n", "variant", "threads", "ns/op", "Mops/s", "fairness");
+  for (i = 0; i < NUM_VARIANTS; i++) {
+    if (only != NULL && strcmp(only, variants[i].name) != 0)
+      continue;
+    found = 1;
+    for (threads = 1; ; threads *= 2) {
+      if (threads > max_threads)
+        threads = max_threads;
+
+      ns = bench(&variants[i], threads, &fairness);
+      if (ns < 0)
+        printf("%-10s %8d %12s\n", variants[i].name, threads, "WRONG COUNT");
+      else
+        printf("%-10s %8d %12.2f %14.1f %10.4f\n", variants[i].name, threads, ns, 1e3 / ns, fairness);
+      if (out != NULL)
+        fprintf(out, "%s,%d,%d,%d,%d,%d,%.3f,%.4f\n", variants[i].name, threads, loop, inc,
+                cs_work, outside_work, ns, fairness);
+
+      if (threads == max_threads)
+        break;
+    }
+  }
+
+  if (out != NULL)
+    fclose(out);
+  if (!found) {
+    fprintf(stderr, "No variant named \"%s\".\n", only);
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,450 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+/*
+ * Read-mostly ptcount. Instead of only decrementing count, each thread
+ * mostly reads it, the way a monitoring thread would, and now and then
+ * decrements it. The shared state is count together with the number of
+ * decrements done so far, so a reader can tell when it saw a torn
+ * update: count + decrements * INCREMENT must always be START.
+ *
+ *   mutex    count_mutex for readers and writers alike
+ *   rwlock   pthread_rwlock_t: readers share the lock, but still all
+ *            write its reader count
+ *   seqlock  readers take no lock. They read the sequence number, the
+ *            state, and the sequence number again, and retry if a
+ *            writer was in between. Writers bump it around an update.
+ *   rcu      readers follow a pointer to an immutable snapshot.
+ *            Writers copy it, update the copy and swing the pointer,
+ *            then free the old snapshot after a grace period: once
+ *            every thread has passed a quiescent state, between two of
+ *            its operations, nobody can still be reading it.
+ *
+ * For 1, 2, 4, ... threads up to the maximum, every variant runs for a
+ * fixed time and reports reads and writes per second, and how reads
+ * scale against one thread.
+ */
+#define CACHE_LINE    64
+#define MAX_THREADS   8
+#define READ_PERCENT  99
+#define DURATION      1.0
+#define START         (1L << 40)
+#define INCREMENT     1
+#define OFFLINE       UINT64_MAX
+
+typedef struct state {
+  long count;
+  long decrements;
+} state;
+
+/*
+ * Each thread's tallies, and its RCU quiescent state counter, in a
+ * line of its own
+ */
+typedef struct thread_stats {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t retries;    /* seqlock reads that had to start over */
+  uint64_t torn;       /* reads that saw an inconsistent state */
+  uint64_t qs;         /* grace period last seen, or OFFLINE */
+  uint32_t rng;
+  int tid;
+} __attribute__ ((aligned (CACHE_LINE))) thread_stats;
+
+typedef struct variant {
+  const char *name;
+  void (*setup) (void);
+  state (*read) (thread_stats *me);
+  void (*write) (thread_stats *me);
+  void (*quiescent) (thread_stats *me);   /* between operations, or NULL */
+} variant;
+
+int num_threads;
+int read_percent = READ_PERCENT;
+int stop;
+thread_stats *stats;
+pthread_barrier_t start_line;
+
+state shared;
+pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_rwlock_t count_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * mutex
+ */
+void mutex_setup(void)
+{
+  shared.count = START;
+  shared.decrements = 0;
+}
+
+state mutex_read(thread_stats *me)
+{
+  state s;
+
+  (void) me;
+  pthread_mutex_lock(&count_mutex);
+  s = shared;
+  pthread_mutex_unlock(&count_mutex);
+  return s;
+}
+
+void mutex_write(thread_stats *me)
+{
+  (void) me;
+  pthread_mutex_lock(&count_mutex);
+  shared.count -= INCREMENT;
+  shared.decrements++;
+  pthread_mutex_unlock(&count_mutex);
+}
+
+/*
+ * rwlock
+ */
+state rwlock_read(thread_stats *me)
+{
+  state s;
+
+  (void) me;
+  pthread_rwlock_rdlock(&count_rwlock);
+  s = shared;
+  pthread_rwlock_unlock(&count_rwlock);
+  return s;
+}
+
+void rwlock_write(thread_stats *me)
+{
+  (void) me;
+  pthread_rwlock_wrlock(&count_rwlock);
+  shared.count -= INCREMENT;
+  shared.decrements++;
+  pthread_rwlock_unlock(&count_rwlock);
+}
+
+/*
+ * seqlock: the sequence number is odd while a writer is updating. The
+ * state is read and written with relaxed atomics, since readers do
+ * race with writers and only throw away what they read then.
+ */
+struct {
+  unsigned seq;
+} __attribute__ ((aligned (CACHE_LINE))) seqlock;
+
+state seqlock_read(thread_stats *me)
+{
+  state s;
+  unsigned seq;
+
+  for (;;) {
+    seq = __atomic_load_n(&seqlock.seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      me->retries++;
+      sched_yield();
+      continue;
+    }
+    s.count = __atomic_load_n(&shared.count, __ATOMIC_RELAXED);
+    s.decrements = __atomic_load_n(&shared.decrements, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&seqlock.seq, __ATOMIC_RELAXED) == seq)
+      return s;
+    me->retries++;
+  }
+}
+
+void seqlock_write(thread_stats *me)
+{
+  (void) me;
+  pthread_mutex_lock(&count_mutex);
+  __atomic_store_n(&seqlock.seq, seqlock.seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&shared.count, shared.count - INCREMENT, __ATOMIC_RELAXED);
+  __atomic_store_n(&shared.decrements, shared.decrements + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&seqlock.seq, seqlock.seq + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&count_mutex);
+}
+
+/*
+ * rcu: quiescent state based reclamation. After every operation a
+ * thread copies the current grace period number into its qs. A writer
+ * that retired a snapshot starts a new grace period and waits until
+ * every other thread's qs has reached it. A thread waiting for a grace
+ * period is not reading, so it goes OFFLINE meanwhile, which keeps two
+ * writers from waiting on each other. A full fence follows each qs
+ * store: release alone lets the next load of current move ahead of it,
+ * so a writer could see the thread OFFLINE and free the snapshot it is
+ * about to read.
+ */
+state *current;
+uint64_t grace_period;
+
+void rcu_setup(void)
+{
+  free(current);
+  current = malloc(sizeof (state));
+  if (current == NULL) {
+    fprintf(stderr, "rcu_setup: allocation failed\n");
+    exit(1);
+  }
+  current->count = START;
+  current->decrements = 0;
+  grace_period = 0;
+}
+
+state rcu_read(thread_stats *me)
+{
+  (void) me;
+  return *__atomic_load_n(&current, __ATOMIC_ACQUIRE);
+}
+
+void rcu_quiescent(thread_stats *me)
+{
+  __atomic_store_n(&me->qs, __atomic_load_n(&grace_period, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcu_synchronize(thread_stats *me)
+{
+  uint64_t gp = __atomic_add_fetch(&grace_period, 1, __ATOMIC_SEQ_CST);
+  uint64_t qs;
+  int i;
+
+  __atomic_store_n(&me->qs, OFFLINE, __ATOMIC_RELEASE);
+  for (i = 0; i < num_threads; i++) {
+    if (i == me->tid)
+      continue;
+    for (;;) {
+      qs = __atomic_load_n(&stats[i].qs, __ATOMIC_ACQUIRE);
+      if (qs == OFFLINE || qs >= gp)
+        break;
+      sched_yield();
+    }
+  }
+}
+
+void rcu_write(thread_stats *me)
+{
+  state *old, *copy = malloc(sizeof (state));
+
+  if (copy == NULL) {
+    fprintf(stderr, "rcu_write: allocation failed\n");
+    exit(1);
+  }
+  pthread_mutex_lock(&count_mutex);
+  old = current;
+  copy->count = old->count - INCREMENT;
+  copy->decrements = old->decrements + 1;
+  __atomic_store_n(&current, copy, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&count_mutex);
+
+  rcu_synchronize(me);
+  free(old);
+}
+
+variant variants[] = {
+  { "mutex",   mutex_setup, mutex_read,   mutex_write,   NULL },
+  { "rwlock",  mutex_setup, rwlock_read,  rwlock_write,  NULL },
+  { "seqlock", mutex_setup, seqlock_read, seqlock_write, NULL },
+  { "rcu",     rcu_setup,   rcu_read,     rcu_write,     rcu_quiescent },
+};
+
+#define NUM_VARIANTS  (int) (sizeof (variants) / sizeof (variants[0]))
+
+variant *running;
+
+/*
+ * xorshift, so that choosing between a read and a write costs next to
+ * nothing and takes no lock
+ */
+static inline uint32_t next_random(uint32_t *x)
+{
+  *x ^= *x << 13;
+  *x ^= *x >> 17;
+  *x ^= *x << 5;
+  return *x;
+}
+
+void *rw_thread(void *arg)
+{
+  thread_stats *me = (thread_stats *) arg;
+  variant *v = running;
+  state s;
+
+  if (v->quiescent != NULL)
+    v->quiescent(me);
+  pthread_barrier_wait(&start_line);
+
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    if (next_random(&me->rng) % 100 < (uint32_t) read_percent) {
+      s = v->read(me);
+      if (s.count + s.decrements * INCREMENT != START)
+        me->torn++;
+      me->reads++;
+    } else {
+      v->write(me);
+      me->writes++;
+    }
+    if (v->quiescent != NULL)
+      v->quiescent(me);
+  }
+
+  /* Gone for good: nobody has to wait for this thread any more */
+  __atomic_store_n(&me->qs, OFFLINE, __ATOMIC_RELEASE);
+  pthread_exit(NULL);
+}
+
+/*
+ * Run variant v with threads threads for duration seconds, and sum up
+ * every thread's tallies into total
+ */
+void bench(variant *v, int threads, double duration, thread_stats *total)
+{
+  pthread_t *tids = malloc(sizeof (pthread_t) * threads);
+  struct timespec ts;
+  int i;
+
+  stats = aligned_alloc(CACHE_LINE, sizeof (thread_stats) * threads);
+  if (tids == NULL || stats == NULL) {
+    fprintf(stderr, "bench: allocation failed\n");
+    exit(1);
+  }
+  memset(stats, 0, sizeof (thread_stats) * threads);
+
+  num_threads = threads;
+  running = v;
+  stop = 0;
+  v->setup();
+  pthread_barrier_init(&start_line, NULL, threads + 1);
+  for (i = 0; i < threads; i++) {
+    stats[i].tid = i;
+    stats[i].rng = 2463534242u + i * 7919;
+    pthread_create(&tids[i], NULL, rw_thread, &stats[i]);
+  }
+
+  pthread_barrier_wait(&start_line);
+  ts.tv_sec = (time_t) duration;
+  ts.tv_nsec = (long) ((duration - ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+  memset(total, 0, sizeof (*total));
+  for (i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+    total->reads += stats[i].reads;
+    total->writes += stats[i].writes;
+    total->retries += stats[i].retries;
+    total->torn += stats[i].torn;
+  }
+
+  pthread_barrier_destroy(&start_line);
+  free(tids);
+  free(stats);
+}
+
+void usage(void)
+{
+  int i;
+
+  printf("Usage: ./ptcount_rw [-t MAX_THREADS] [-r READ_PERCENT] [-d SECONDS] [-v VARIANT] [-o FILE.csv]\n");
+  printf("  -t  sweep 1, 2, 4, ... threads up to this (default %d)\n", MAX_THREADS);
+  printf("  -r  percentage of operations that read count (default %d)\n", READ_PERCENT);
+  printf("  -d  seconds per run (default %.1f)\n", DURATION);
+  printf("  -v  run only this variant:");
+  for (i = 0; i < NUM_VARIANTS; i++)
+    printf(" %s", variants[i].name);
+  printf("\n  -o  append the results as CSV rows to this file\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int max_threads = MAX_THREADS;
+  double duration = DURATION;
+  const char *only = NULL;
+  const char *csv = NULL;
+  FILE *out = NULL;
+  thread_stats total;
+  double reads, writes, base = 0;
+  int c, i, threads, found = 0;
+
+  while ((c = getopt(argc, argv, "t:r:d:v:o:")) != -1) {
+    switch (c) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'r':
+      read_percent = atoi(optarg);
+      break;
+    case 'd':
+      duration = atof(optarg);
+      break;
+    case 'v':
+      only = optarg;
+      break;
+    case 'o':
+      csv = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc)
+    usage();
+  if (max_threads < 1 || read_percent < 0 || read_percent > 100 || duration <= 0) {
+    fprintf(stderr, "Need at least 1 thread, a read percentage from 0 to 100 and a positive duration.\n");
+    exit(1);
+  }
+
+  if (csv != NULL) {
+    out = fopen(csv, "a");
+    if (out == NULL) {
+      fprintf(stderr, "Unable to open \"%s\".\n", csv);
+      exit(1);
+    }
+    if (ftell(out) == 0)
+      fprintf(out, "variant,threads,read_percent,seconds,reads_per_sec,writes_per_sec,"
+              "read_scaling,seqlock_retries,torn_reads\n");
+  }
+
+  printf("%d%% reads\n", read_percent);
+  printf("%-8s %7s %14s %14s %14s %8s %9s %5s\n", "variant", "threads", "Mreads/s",
+         "Mreads/s/thr", "Mwrites/s", "scaling", "retries", "torn");
+  for (i = 0; i < NUM_VARIANTS; i++) {
+    if (only != NULL && strcmp(only, variants[i].name) != 0)
+      continue;
+    found = 1;
+    for (threads = 1; ; threads *= 2) {
+      if (threads > max_threads)
+        threads = max_threads;
+
+      bench(&variants[i], threads, duration, &total);
+      reads = total.reads / duration;
+      writes = total.writes / duration;
+      if (threads == 1)
+        base = reads;
+      printf("%-8s %7d %14.2f %14.2f %14.3f %7.2fx %9llu %5llu\n", variants[i].name, threads,
+             reads / 1e6, reads / 1e6 / threads, writes / 1e6, base > 0 ? reads / base : 0.0,
+             (unsigned long long) total.retries, (unsigned long long) total.torn);
+      if (out != NULL)
+        fprintf(out, "%s,%d,%d,%.3f,%.0f,%.0f,%.3f,%llu,%llu\n", variants[i].name, threads,
+                read_percent, duration, reads, writes, base > 0 ? reads / base : 0.0,
+                (unsigned long long) total.retries, (unsigned long long) total.torn);
+
+      if (threads == max_threads)
+        break;
+    }
+  }
+
+  if (out != NULL)
+    fclose(out);
+  if (!found) {
+    fprintf(stderr, "No variant named \"%s\".\n", only);
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_THREADS  3
+
+/*
+ * Each thread counts into its own slot, and the slots are padded out
+ * to a cache line so that no two threads ever write the same line.
+ * This is a sloppy counter: a thread folds its slot into the shared
+ * count every FLUSH decrements, so count is never further off than
+ * NUM_THREADS * FLUSH * INCREMENT, and once every thread has folded
+ * in what is left, count is exact, the same as with the mutex or the
+ * atomic. A FLUSH of 0 folds in only at the end.
+ */
+#define CACHE_LINE   64
+#define FLUSH        1024
+
+typedef struct thread_args {
+  int tid;
+  int inc;
+  int loop;
+  int flush;
+} thread_args;
+
+typedef struct local_count {
+  int  count;
+  char pad[CACHE_LINE - sizeof (int)];
+} local_count;
+
+int count = 0;
+local_count local[NUM_THREADS] __attribute__ ((aligned (CACHE_LINE)));
+
+/*
+ * This routine will be executed by each thread we choose to create.
+ * The routine a new thread will execute is given as an arguent to the
+ * pthread_create() call.
+ */
+void *inc_count(void *arg)
+{
+  int i,loc,pending;
+  thread_args *my_args = (thread_args*) arg;
+  local_count *mine = &local[my_args->tid];
+
+  loc = my_args->loop;
+  pending = 0;
+  for (i = 0; i < my_args->loop; i++) {
+    mine->count -= my_args->inc;
+    loc -= my_args->inc;
+    if (++pending == my_args->flush) {
+      __atomic_add_fetch(&count, mine->count, __ATOMIC_RELAXED);
+      mine->count = 0;
+      pending = 0;
+    }
+  }
+
+  /* Fold in whatever is left */
+  __atomic_add_fetch(&count, mine->count, __ATOMIC_RELAXED);
+  mine->count = 0;
+
+  printf("Thread: %d finished. Counted: %d\n", my_args->tid, loc);
+  free(my_args);
+  pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+  int i, loop, inc, flush;
+  struct thread_args *targs;
+  pthread_t threads[NUM_THREADS];
+  pthread_attr_t attr;
+
+  if (argc != 3 && argc != 4) {
+    printf("Usage: ./ptcount_sharded LOOP_BOUND INCREMENT [FLUSH]\n");
+    exit(0);
+  }
+
+  /*
+   * First argument is how many times to loop. The second is how much
+   * to decrement each time. The optional third is how many decrements
+   * a thread keeps to itself before folding them into count.
+   */
+  loop = atoi(argv[1]);
+  inc = atoi(argv[2]);
+  flush = argc == 4 ? atoi(argv[3]) : FLUSH;
+
+  count = loop * NUM_THREADS;
+
+  /* For portability, explicitly create threads in a joinable state */
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+  /* Create each thread using pthread_create.  The start routine for
+   * each thread should be inc_count. The attribute object should be
+   * attr. You should pass as the thread's sole argument the populated
+   * targs struct. Note we create a different copy of it for each
+   * thread.
+   */
+  for (i = 0; i < NUM_THREADS; i++) {
+    targs = malloc(sizeof(thread_args));
+    targs->tid = i;
+    targs->loop = loop;
+    targs->inc = inc;
+    targs->flush = flush;
+    pthread_create(&threads[i], &attr, inc_count, targs);
+  }
+
+  /* Wait for all threads to complete using pthread_join.  The threads
+   * do not return anything on exit, so the second argument is NULL
+   */
+  for (i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  printf ("Main(): Waited on %d threads. Final value of count = %d. Done.\n",
+          NUM_THREADS, count);
+
+  /* Clean up and exit */
+  pthread_attr_destroy(&attr);
+  pthread_exit (NULL);
+}
@@ -3,12 +3,15 @@
 #include <unistd.h>
 #include <math.h>
 #include <stdlib.h>
+#include "dp_bench.h"
+#include "dp_deadlock.h"
 
 /*
  * Some handy constants. Number of philosophers and chopsticks lets us
  * parameterize the number of concurrent threads and shared
- * resources. The maximum thinking and eating periods let us tune
- * relative periods of holding or not holding a resource. The MAX_BUF
+ * resources (these are the defaults for the command line options).
+ * The maximum thinking and eating periods let us tune relative
+ * periods of holding or not holding a resource. The MAX_BUF
  * and column_width constants help with creating output that makes
  * sense..
  */
@@ -37,18 +40,25 @@ typedef struct {
                                   sessions  */
   pthread_t      thread;       /* Thread structure for this
                                   philosopher */
+  unsigned int   seed;         /* rand_r() state for think and eat
+                                  periods */
+  wait_histogram *waits;       /* Benchmark mode: time from hungry
+                                  to holding both chopsticks */
 } philosopher;
 
 /* GLOBALS */
-philosopher Diners[NUM_PHILS];
-int         Stop = 0;
+philosopher *Diners;
+int          Stop = 0;
+int          Finished = 0;     /* philosophers that saw Stop and left */
+dp_options   Options = { NUM_PHILS, MAX_PHIL_THINK_PERIOD, MAX_PHIL_EAT_PERIOD,
+                         0, ACCOUNTING_PERIOD, NULL };
 
 /* Each chopstick is shared between two philosophers */
-static pthread_mutex_t chopstick[NUM_CHOPS];
+static pthread_mutex_t *chopstick;
 
 /* WAITER SOLUTION uses these data structures */
 static pthread_mutex_t waiter;
-static int available_chopsticks[NUM_CHOPS];
+static int *available_chopsticks;
 
 /*
  * Helper functions for grabbing chopsticks, referencing neighbors.
@@ -62,12 +72,12 @@ static int available_chopsticks[NUM_CHOPS];
  */
 philosopher *left_phil (philosopher *p)
 {
-  return &Diners[(p->id == (NUM_PHILS-1) ? 0 : (p->id)+1)];
+  return &Diners[(p->id == (Options.phils-1) ? 0 : (p->id)+1)];
 }
 
 philosopher *right_phil (philosopher *p)
 {
-  return &Diners[(p->id == 0 ? (NUM_PHILS-1) : (p->id)-1)];
+  return &Diners[(p->id == 0 ? (Options.phils-1) : (p->id)-1)];
 }
 
 pthread_mutex_t *left_chop (philosopher *p)
@@ -77,7 +87,7 @@ pthread_mutex_t *left_chop (philosopher *p)
 
 pthread_mutex_t *right_chop (philosopher *p)
 {
-  return &chopstick[(p->id == 0 ? NUM_CHOPS-1 : (p->id)-1)];
+  return &chopstick[(p->id == 0 ? Options.phils-1 : (p->id)-1)];
 }
 
 int *left_chop_available (philosopher *p)
@@ -87,7 +97,7 @@ int *left_chop_available (philosopher *p)
 
 int *right_chop_available (philosopher *p)
 {
-  return &available_chopsticks[(p->id == 0 ? NUM_CHOPS-1 : (p->id)-1)];
+  return &available_chopsticks[(p->id == 0 ? Options.phils-1 : (p->id)-1)];
 }
 
 /*
@@ -123,6 +133,7 @@ static void *dp_thread(void *arg)
   int          id;
   philosopher *me;
   int          think_rnd;
+  uint64_t     hungry = 0;
 
   me = (philosopher *) arg;
   id = me->id;
@@ -136,8 +147,8 @@ static void *dp_thread(void *arg)
      * Determine how long to think and eat in this cycle. Limit the
      * values to defined maximum values.
      */
-    think_rnd = (rand() % MAX_PHIL_THINK_PERIOD);
-    eat_rnd   = (rand() % MAX_PHIL_EAT_PERIOD);
+    think_rnd = (rand_r(&me->seed) % Options.think_max);
+    eat_rnd   = (rand_r(&me->seed) % Options.eat_max);
 
     /*
      * Think a random number of thoughts before getting hungry. this
@@ -152,8 +163,13 @@ static void *dp_thread(void *arg)
     /*
      * Grab both chopsticks: ASYMMETRIC and WAITER SOLUTION
      */
-    pthread_mutex_lock(left_chop(me));
-    pthread_mutex_lock(right_chop(me));
+    if (Options.bench)
+      hungry = dp_now_ns();
+
+    dp_lock_chop(me->id, chopstick, left_chop(me));
+    dp_lock_chop(me->id, chopstick, right_chop(me));
+    if (Options.bench)
+      wait_record(me->waits, dp_now_ns() - hungry);
 
     /*
      * Eat some random amount of food. Again, this involves a
@@ -167,8 +183,8 @@ static void *dp_thread(void *arg)
     /*
      * Release both chopsticks: WAITER SOLUTION
      */
-    pthread_mutex_unlock(right_chop(me));
-    pthread_mutex_unlock(left_chop(me));
+    dp_unlock_chop(me->id, chopstick, right_chop(me));
+    dp_unlock_chop(me->id, chopstick, left_chop(me));
 
     /* 
      * Update my progress in current session and for all time.
@@ -180,6 +196,7 @@ static void *dp_thread(void *arg)
   /*
    * Philosopher thread finished, so rejoin parent
    */
+  __atomic_add_fetch(&Finished, 1, __ATOMIC_RELEASE);
   return NULL;
 }
 
@@ -191,6 +208,18 @@ void set_table()
 {
   int i;
 
+  /*
+   * Allocate the philosophers and chopsticks for the table size given
+   * on the command line
+   */
+  Diners               = (philosopher *) calloc(Options.phils, sizeof (philosopher));
+  chopstick            = (pthread_mutex_t *) malloc(sizeof (pthread_mutex_t) * Options.phils);
+  available_chopsticks = (int *) malloc(sizeof (int) * Options.phils);
+  if (Diners == NULL || chopstick == NULL || available_chopsticks == NULL) {
+    fprintf(stderr, "set_table: allocation failed\n");
+    exit(1);
+  }
+
   /*
    * Initialize mutex used in the WAITER SOLUTION to represent the
    * waiter
@@ -201,19 +230,29 @@ void set_table()
    * Initialize all the Mutexes that represent the chopsticks. The
    * available flags are used in the WAITER SOLUTION.
    */
-  for (i = 0; i < NUM_CHOPS; i++) {
+  for (i = 0; i < Options.phils; i++) {
     pthread_mutex_init(&chopstick[i], NULL);
     available_chopsticks[i] = 1;
   }
+  dp_wait_graph_init(Options.phils, Options.phils);
 
   /*
    * Initialize the ID number, toal and session progress of each
-   * philosopher.
+   * philosopher. Each gets its own random number seed, drawn from the
+   * seeded rand(), so that they do not serialize on rand()'s lock.
    */
-  for (i = 0; i < NUM_PHILS; i++) {
+  for (i = 0; i < Options.phils; i++) {
     Diners[i].prog = 0;
     Diners[i].prog_total = 0;
     Diners[i].id = i;
+    Diners[i].seed = rand();
+    if (Options.bench) {
+      Diners[i].waits = (wait_histogram *) calloc(1, sizeof (wait_histogram));
+      if (Diners[i].waits == NULL) {
+        fprintf(stderr, "set_table: allocation failed\n");
+        exit(1);
+      }
+    }
   }
 
   /*
@@ -222,7 +261,7 @@ void set_table()
    * and the pthread_t thread element of the structure is filled in by
    * the pthread_create() call.
    */
-  for (i = 0; i < NUM_PHILS; i++) {
+  for (i = 0; i < Options.phils; i++) {
     pthread_create(&(Diners[i].thread), NULL, dp_thread, &Diners[i]);
   }
 }
@@ -241,13 +280,13 @@ void print_progress()
    * Print out the progress for the current accounting period and the
    * total for each philosopher thread.
    */
-  for (i = 0; i < NUM_PHILS;) {
+  for (i = 0; i < Options.phils;) {
     /*
      * Print them in groups of 5 across a line, so use the inner loop
      * of j on 5
      */
     for (j = 0; j < 4; j++) {
-      if (i == NUM_PHILS) {
+      if (i == Options.phils) {
         printf("\n");
         goto out;
       }
@@ -264,7 +303,7 @@ void print_progress()
       i++;
     }
 
-    if (i == NUM_PHILS) {
+    if (i == Options.phils) {
       printf("\n");
       break;
     }
@@ -286,6 +325,26 @@ out:
   printf("\n");
 }
 
+/*
+ * Benchmark mode: what dp_benchmark() sees of the philosophers
+ */
+static int phil_meals (int i)
+{
+  return Diners[i].prog_total;
+}
+
+static wait_histogram *phil_waits (int i)
+{
+  return Diners[i].waits;
+}
+
+static pthread_t phil_thread (int i)
+{
+  return Diners[i].thread;
+}
+
+static const dp_solution Solution = { phil_meals, phil_waits, phil_thread, dp_deadlocked };
+
 int main(int argc, char **argv)
 {
   int i;
@@ -294,19 +353,27 @@ int main(int argc, char **argv)
 
   iter = 0;
 
+  dp_parse_options(argc, argv, &Options);
+
   /*
-   * Randomly seed the random number generator used to control how
-   * long philosophers eat and think.
+   * Seed the random number generator used to control how long
+   * philosophers eat and think, from -S or else the clock.
    */
-  srand(time(NULL));
+  dp_seed(&Options);
 
   /*
    * Set the table means create the chopsticks and the philosophers.
    * Print out a header for the periodic updates on Philosopher state.
    */
   set_table();
+
+  if (Options.bench) {
+    dp_benchmark("dining_philosophers", &Options, &Solution, &Stop, &Finished);
+    return 0;
+  }
+
   printf("\n");
-  printf("Dining Philosophers Update every %d seconds\n", ACCOUNTING_PERIOD);
+  printf("Dining Philosophers Update every %d seconds (seed %u)\n", ACCOUNTING_PERIOD, Options.seed);
   printf("-------------------------------------------\n");
 
   do {
@@ -315,7 +382,7 @@ int main(int argc, char **argv)
      * philosopher is making progress, the philosopher will
      * increment it.
      */
-    for (i = 0; i < NUM_PHILS; i++)
+    for (i = 0; i < Options.phils; i++)
       Diners[i].prog = 0;
 
     /*
@@ -323,16 +390,18 @@ int main(int argc, char **argv)
      * of ACCOUNTING_PERIOD seconds, which is a *long* time compared
      * to the time-scale of a philosopher thread, so *some* progress
      * should be made by each in this waiting time, unless deadlock
-     * has occurred.
+     * has occurred. A deadlock the wait-for graph finds cuts the
+     * period short.
      */
-    sleep(ACCOUNTING_PERIOD);
+    for (i = 0; i < ACCOUNTING_PERIOD * (1000000 / BENCH_POLL_US) && !dp_deadlocked(); i++)
+      usleep(BENCH_POLL_US);
 
     /*
-     * Check for deadlock (i.e. none of the philosophers have
-     * made progress in 5 seconds)
+     * Check for deadlock (i.e. the wait-for graph found a cycle,
+     * or none of the philosophers have made progress in 5 seconds)
      */
     deadlock = 1;
-    for (i = 0; i < NUM_PHILS; i++)
+    for (i = 0; i < Options.phils && !dp_deadlocked(); i++)
       if (Diners[i].prog)
         deadlock = 0;
 
@@ -357,13 +426,13 @@ int main(int argc, char **argv)
    * Release all locks so philosophers can exit even if they are
    * deadlocked.
    */
-  for (i = 0; i < NUM_CHOPS; i++)
+  for (i = 0; i < Options.phils; i++)
     pthread_mutex_unlock(&chopstick[i]);
 
   /*
    * Wait for philosophers to finish
    */
-  for (i = 0; i < NUM_PHILS; i++)
+  for (i = 0; i < Options.phils; i++)
     pthread_join(Diners[i].thread, NULL);
 
   return 0;
@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "dp_bench.h"
+
+/*
+ * Some handy constants. Number of philosophers and chopsticks lets us
+ * parameterize the number of concurrent threads and shared
+ * resources (these are the defaults for the command line options).
+ * The maximum thinking and eating periods let us tune relative
+ * periods of holding or not holding a resource. The MAX_BUF
+ * and column_width constants help with creating output that makes
+ * sense..
+ */
+#define NUM_PHILS                     5
+#define NUM_CHOPS             NUM_PHILS
+#define MAX_PHIL_THINK_PERIOD      1000
+#define MAX_PHIL_EAT_PERIOD         100
+#define MAX_BUF                     256
+#define STATS_WIDTH                  16
+#define COLUMN_WIDTH                 18
+#define ACCOUNTING_PERIOD             5
+#define ITERATION_LIMIT              10
+
+/*
+ * Forks are bits in 32-bit words, the size a futex can wait on. A
+ * philosopher that cannot get its forks spins, doubling the pause each
+ * time up to MAX_SPIN, before sleeping on the word.
+ */
+#define FORKS_PER_WORD               32
+#define MAX_SPIN                   1024
+
+/*
+ * Structure defining a philosopher and any state we need to know
+ * about to print out interesting data, or implement different
+ * solutions.
+ */
+typedef struct {
+  int            id;           /* Int ID number assigned by
+                                  set_table() */
+  int            prog;         /* Progress during current main()
+                                  accounting period */
+  int            prog_total;   /* Total progress across all
+                                  sessions  */
+  pthread_t      thread;       /* Thread structure for this
+                                  philosopher */
+  unsigned int   seed;         /* rand_r() state for think and eat
+                                  periods */
+  wait_histogram *waits;       /* Benchmark mode: time from hungry
+                                  to holding both chopsticks */
+} philosopher;
+
+/* GLOBALS */
+philosopher *Diners;
+int          Stop = 0;
+int          Finished = 0;     /* philosophers that saw Stop and left */
+dp_options   Options = { NUM_PHILS, MAX_PHIL_THINK_PERIOD, MAX_PHIL_EAT_PERIOD,
+                         0, ACCOUNTING_PERIOD, NULL };
+
+/*
+ * ATOMIC SOLUTION: bit i of fork_words[i / FORKS_PER_WORD] is set while
+ * chopstick i is in use. word_waiters counts philosophers asleep on
+ * each word, so releasing forks costs no system call when nobody is.
+ */
+static atomic_uint *fork_words;
+static atomic_int  *word_waiters;
+static int          max_spin = MAX_SPIN;
+
+static inline void cpu_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Take the forks in mask from one word: a single compare-and-swap once
+ * they are all free, so a philosopher never holds one chopstick while
+ * waiting for the other within a word.
+ */
+static void take_forks (int word, unsigned int mask)
+{
+  atomic_uint *w = &fork_words[word];
+  unsigned int seen;
+  int          spin = 1;
+  int          i;
+
+  for (;;) {
+    seen = atomic_load_explicit(w, memory_order_relaxed);
+    if ((seen & mask) == 0 &&
+        atomic_compare_exchange_weak_explicit(w, &seen, seen | mask,
+                                              memory_order_acquire, memory_order_relaxed))
+      return;
+
+    if (spin <= max_spin) {
+      for (i = 0; i < spin; i++)
+        cpu_relax();
+      spin <<= 1;
+      continue;
+    }
+
+    /*
+     * Spun long enough: sleep until the word changes. Announcing the
+     * wait before the last look pairs with the fence in put_forks.
+     */
+    atomic_fetch_add(&word_waiters[word], 1);
+    seen = atomic_load(w);
+    if (seen & mask)
+      syscall(SYS_futex, w, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    atomic_fetch_sub(&word_waiters[word], 1);
+  }
+}
+
+static void put_forks (int word, unsigned int mask)
+{
+  atomic_fetch_and_explicit(&fork_words[word], ~mask, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&word_waiters[word], memory_order_relaxed) > 0)
+    syscall(SYS_futex, &fork_words[word], FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Both chopsticks of philosopher p: the left one has the same number as
+ * the philosopher, the right one is (number - 1) modulo the table
+ * size. They share a word except where the ring crosses a word
+ * boundary; there the word holding the lower numbered chopstick is
+ * taken first, which, as in the asymmetric solution, leaves no cycle
+ * to deadlock on.
+ */
+static void grab_chopsticks (philosopher *p)
+{
+  int left = p->id;
+  int right = (p->id == 0 ? Options.phils-1 : (p->id)-1);
+  int low = left < right ? left : right;
+  int high = left < right ? right : left;
+
+  if (low / FORKS_PER_WORD == high / FORKS_PER_WORD)
+    take_forks(low / FORKS_PER_WORD,
+               (1u << (low % FORKS_PER_WORD)) | (1u << (high % FORKS_PER_WORD)));
+  else {
+    take_forks(low / FORKS_PER_WORD, 1u << (low % FORKS_PER_WORD));
+    take_forks(high / FORKS_PER_WORD, 1u << (high % FORKS_PER_WORD));
+  }
+}
+
+static void release_chopsticks (philosopher *p)
+{
+  int left = p->id;
+  int right = (p->id == 0 ? Options.phils-1 : (p->id)-1);
+
+  if (left / FORKS_PER_WORD == right / FORKS_PER_WORD)
+    put_forks(left / FORKS_PER_WORD,
+              (1u << (left % FORKS_PER_WORD)) | (1u << (right % FORKS_PER_WORD)));
+  else {
+    put_forks(left / FORKS_PER_WORD, 1u << (left % FORKS_PER_WORD));
+    put_forks(right / FORKS_PER_WORD, 1u << (right % FORKS_PER_WORD));
+  }
+}
+
+/*
+ * Do a small amount of work that we can use to represent a
+ * philosopher thinking one thought
+ */
+void think_one_thought()
+{
+  int i;
+  i = 0;
+  i++;
+}
+
+/*
+ * Do a small amount of work that we can use to represent a
+ * philosopher eating one mouthful of food
+ */
+void eat_one_mouthful()
+{
+  int i;
+  i = 0;
+  i++;
+}
+
+/*
+ * Philosopher code which makes each philosopher eat and think for a
+ * random period of time.
+ */
+static void *dp_thread(void *arg)
+{
+  int          eat_rnd;
+  int          i;
+  philosopher *me;
+  int          think_rnd;
+  uint64_t     hungry = 0;
+
+  me = (philosopher *) arg;
+
+  /*
+   * While the gobal Stop flag is not set, keep thinking and eating
+   * like a good Philosopher.
+   */
+  while (!Stop) {
+    /*
+     * Determine how long to think and eat in this cycle. Limit the
+     * values to defined maximum values.
+     */
+    think_rnd = (rand_r(&me->seed) % Options.think_max);
+    eat_rnd   = (rand_r(&me->seed) % Options.eat_max);
+
+    /*
+     * Think a random number of thoughts before getting hungry. this
+     * is a loop with a lot of overhead, since we call a subroutine
+     * for each thought. That is a feature, not a bug, in this case as
+     * we want each thought to be several machine instructions.
+     */
+    for (i = 0; i < think_rnd; i++){
+      think_one_thought();
+    }
+
+    if (Options.bench)
+      hungry = dp_now_ns();
+
+    grab_chopsticks(me);
+    if (Options.bench)
+      wait_record(me->waits, dp_now_ns() - hungry);
+
+    /*
+     * Eat some random amount of food. Again, this involves a
+     * subroutine call for each mouthful, which is a feature, not a
+     * bug.
+     */
+    for (i = 0; i < eat_rnd; i++){
+      eat_one_mouthful();
+    }
+
+    /*
+     * Release both chopsticks
+     */
+    release_chopsticks(me);
+
+    /* 
+     * Update my progress in current session and for all time.
+     */
+    me->prog++;
+    me->prog_total++;
+  }
+
+  /*
+   * Philosopher thread finished, so rejoin parent
+   */
+  __atomic_add_fetch(&Finished, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/*
+ * Set up the table with the correct number of chopsticks and
+ * philosophers and initialize everything.
+ */
+void set_table()
+{
+  int i;
+
+  /*
+   * Allocate the philosophers for the table size given on the command
+   * line
+   */
+  Diners = (philosopher *) calloc(Options.phils, sizeof (philosopher));
+  if (Diners == NULL) {
+    fprintf(stderr, "set_table: allocation failed\n");
+    exit(1);
+  }
+
+  /*
+   * The ATOMIC SOLUTION's fork bits, all free. Spinning only helps if
+   * the holder can run meanwhile, so do not spin on a uniprocessor.
+   */
+  fork_words   = (atomic_uint *) calloc((Options.phils + FORKS_PER_WORD - 1) / FORKS_PER_WORD,
+                                        sizeof (atomic_uint));
+  word_waiters = (atomic_int *) calloc((Options.phils + FORKS_PER_WORD - 1) / FORKS_PER_WORD,
+                                       sizeof (atomic_int));
+  if (fork_words == NULL || word_waiters == NULL) {
+    fprintf(stderr, "set_table: allocation failed\n");
+    exit(1);
+  }
+  if (sysconf(_SC_NPROCESSORS_ONLN) == 1)
+    max_spin = 0;
+
+  /*
+   * Initialize the ID number, toal and session progress of each
+   * philosopher. Each gets its own random number seed, drawn from the
+   * seeded rand(), so that they do not serialize on rand()'s lock.
+   */
+  for (i = 0; i < Options.phils; i++) {
+    Diners[i].prog = 0;
+    Diners[i].prog_total = 0;
+    Diners[i].id = i;
+    Diners[i].seed = rand();
+    if (Options.bench) {
+      Diners[i].waits = (wait_histogram *) calloc(1, sizeof (wait_histogram));
+      if (Diners[i].waits == NULL) {
+        fprintf(stderr, "set_table: allocation failed\n");
+        exit(1);
+      }
+    }
+  }
+
+  /*
+   * Create each phiilosopher thread. Note that the address of its
+   * structure is given as the argument to the dp_thread() routine,
+   * and the pthread_t thread element of the structure is filled in by
+   * the pthread_create() call.
+   */
+  for (i = 0; i < Options.phils; i++) {
+    pthread_create(&(Diners[i].thread), NULL, dp_thread, &Diners[i]);
+  }
+}
+
+/*
+ * Print the progress of all the philosphers.
+ */
+void print_progress()
+{
+  int i;
+  int j;
+
+  char buf[MAX_BUF];
+
+  /*
+   * Print out the progress for the current accounting period and the
+   * total for each philosopher thread.
+   */
+  for (i = 0; i < Options.phils;) {
+    /*
+     * Print them in groups of 5 across a line, so use the inner loop
+     * of j on 5
+     */
+    for (j = 0; j < 4; j++) {
+      if (i == Options.phils) {
+        printf("\n");
+        goto out;
+      }
+
+      /*
+       * Print the accounting period and the total for the current
+       * philosopher into a buffer as a string, then print the string
+       * with a constant width to make things line up in columns for
+       * better readability.
+       */
+      sprintf(buf, "%d/%d", 
+              Diners[i].prog, Diners[i].prog_total);
+      printf("p%d=%*s   ", i, STATS_WIDTH, buf);
+      i++;
+    }
+
+    if (i == Options.phils) {
+      printf("\n");
+      break;
+    }
+
+    /*
+     * Print the 5th on the line, with a newline to end the line
+     */
+    sprintf(buf, "%d/%d", 
+            Diners[i].prog, Diners[i].prog_total);
+    printf("p%d=%*s\n", i, STATS_WIDTH, buf);
+    i++;
+  }
+
+out:
+  /*
+   * Add an extra new line for a blank between data for each
+   * accounting period.
+   */
+  printf("\n");
+}
+
+/*
+ * Benchmark mode: what dp_benchmark() sees of the philosophers
+ */
+static int phil_meals (int i)
+{
+  return Diners[i].prog_total;
+}
+
+static wait_histogram *phil_waits (int i)
+{
+  return Diners[i].waits;
+}
+
+static pthread_t phil_thread (int i)
+{
+  return Diners[i].thread;
+}
+
+static const dp_solution Solution = { phil_meals, phil_waits, phil_thread, NULL };
+
+int main(int argc, char **argv)
+{
+  int i;
+  int deadlock;
+  int iter;
+
+  iter = 0;
+
+  dp_parse_options(argc, argv, &Options);
+
+  /*
+   * Seed the random number generator used to control how long
+   * philosophers eat and think, from -S or else the clock.
+   */
+  dp_seed(&Options);
+
+  /*
+   * Set the table means create the chopsticks and the philosophers.
+   * Print out a header for the periodic updates on Philosopher state.
+   */
+  set_table();
+
+  if (Options.bench) {
+    dp_benchmark("dp_atomic", &Options, &Solution, &Stop, &Finished);
+    return 0;
+  }
+
+  printf("\n");
+  printf("Dining Philosophers Update every %d seconds (seed %u)\n", ACCOUNTING_PERIOD, Options.seed);
+  printf("-------------------------------------------\n");
+
+  do {
+    /*
+     * Reset the philosophers eating progress to 0. If the
+     * philosopher is making progress, the philosopher will
+     * increment it.
+     */
+    for (i = 0; i < Options.phils; i++)
+      Diners[i].prog = 0;
+
+    /*
+     * Let the philosophers do some thinking and eating over a period
+     * of ACCOUNTING_PERIOD seconds, which is a *long* time compared
+     * to the time-scale of a philosopher thread, so *some* progress
+     * should be made by each in this waiting time, unless deadlock
+     * has occurred.
+     */
+    sleep(ACCOUNTING_PERIOD);
+
+    /*
+     * Check for deadlock (i.e. none of the philosophers have
+     * made progress in 5 seconds)
+     */
+    deadlock = 1;
+    for (i = 0; i < Options.phils; i++)
+      if (Diners[i].prog)
+        deadlock = 0;
+
+    /*
+     * Print out the philosophers progress
+     */
+    print_progress();
+    iter++;
+  } while (!deadlock && iter < ITERATION_LIMIT);
+
+  /*
+   * Set the "Stop flag to tell all diners to stop
+   */
+  Stop = 1;
+  if (deadlock) {
+    printf ("Deadlock Detected\n");
+  } else {
+    printf ("Finished without Deadlock\n");
+  }
+
+  /*
+   * There is no deadlock to break: the philosophers see Stop after
+   * their current meal.
+   */
+
+  /*
+   * Wait for philosophers to finish
+   */
+  for (i = 0; i < Options.phils; i++)
+    pthread_join(Diners[i].thread, NULL);
+
+  return 0;
+}
+
@@ -0,0 +1,372 @@
+#ifndef DP_BENCH_H
+#define DP_BENCH_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Command line handling and benchmark accounting shared by the dining
+ * philosophers solutions. Everything is static so each solution stays
+ * a single translation unit.
+ *
+ * In benchmark mode (-B) a solution runs for a fixed duration and then
+ * reports meals per second, Jain's fairness index over the meals of
+ * each philosopher (1.0 when all ate equally, 1/n when one philosopher
+ * ate everything), and percentiles of the time from getting hungry to
+ * holding both chopsticks.
+ */
+
+/*
+ * A benchmark run checks for progress every BENCH_POLL_US, and takes
+ * BENCH_STALL_NS without a single meal to mean deadlock.
+ */
+#define BENCH_POLL_US   10000
+#define BENCH_STALL_NS  1000000000ULL
+
+/*
+ * Wait times go into a log-linear histogram: 8 buckets per power of
+ * two, so a percentile is within 12.5% of the real value. One
+ * histogram per philosopher keeps recording free of sharing.
+ */
+#define WAIT_SUB_BITS  3
+#define WAIT_BUCKETS   (64 << WAIT_SUB_BITS)
+
+typedef struct {
+  uint32_t count[WAIT_BUCKETS];
+} wait_histogram;
+
+/*
+ * Run configuration, set from the command line
+ */
+typedef struct {
+  int         phils;       /* number of philosophers and chopsticks */
+  int         think_max;   /* thoughts per think period are random below this */
+  int         eat_max;     /* mouthfuls per meal are random below this */
+  int         bench;       /* benchmark instead of the periodic progress report */
+  double      duration;    /* benchmark length in seconds */
+  const char *csv;         /* append benchmark results here */
+  unsigned    seed;        /* srand() seed for the philosophers' rand_r() states */
+  int         seeded;      /* seed came from -S rather than the clock */
+} dp_options;
+
+static inline uint64_t dp_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int wait_bucket (uint64_t ns)
+{
+  int shift;
+
+  if (ns < (1 << WAIT_SUB_BITS))
+    return (int) ns;
+  shift = 63 - __builtin_clzll(ns) - WAIT_SUB_BITS;
+  return ((shift + 1) << WAIT_SUB_BITS) + (int) ((ns >> shift) & ((1 << WAIT_SUB_BITS) - 1));
+}
+
+/*
+ * Middle of the range of values that land in bucket
+ */
+static inline double wait_bucket_value (int bucket)
+{
+  int shift;
+
+  if (bucket < (1 << WAIT_SUB_BITS))
+    return bucket;
+  shift = (bucket >> WAIT_SUB_BITS) - 1;
+  return (double) (((uint64_t) (bucket & ((1 << WAIT_SUB_BITS) - 1)) + (1 << WAIT_SUB_BITS)) << shift)
+         + ((1ULL << shift) - 1) / 2.0;
+}
+
+static inline void wait_record (wait_histogram *h, uint64_t ns)
+{
+  h->count[wait_bucket(ns)]++;
+}
+
+/*
+ * Wait time in nanoseconds at percentile pct of all recorded waits
+ */
+static double wait_percentile (const wait_histogram *h, double pct)
+{
+  uint64_t total = 0, seen = 0, target;
+  int      i;
+
+  for (i = 0; i < WAIT_BUCKETS; i++)
+    total += h->count[i];
+  if (total == 0)
+    return 0;
+
+  target = (uint64_t) (pct / 100.0 * total);
+  if (target >= total)
+    target = total - 1;
+  for (i = 0; i < WAIT_BUCKETS; i++) {
+    seen += h->count[i];
+    if (seen > target)
+      break;
+  }
+  return wait_bucket_value(i);
+}
+
+/*
+ * A solution with options of its own passes them to
+ * dp_parse_options_extra(): their getopt letters, a handler that
+ * returns 0 for a bad argument, and the usage lines to print for them
+ */
+typedef int (*dp_option_handler) (int c, const char *arg);
+
+static void dp_usage (const char *program, const dp_options *defaults, const char *extra_usage)
+{
+  printf("Usage: %s [-n philosophers] [-t think] [-e eat] [-B] [-d seconds] [-o file.csv] [-S seed]%s\n",
+         program, extra_usage != NULL ? " [options]" : "");
+  printf("  -n  philosophers and chopsticks (default %d)\n", defaults->phils);
+  printf("  -t  thoughts per think period are random below this (default %d)\n", defaults->think_max);
+  printf("  -e  mouthfuls per meal are random below this (default %d)\n", defaults->eat_max);
+  printf("  -B  benchmark: run for a fixed time and report throughput, fairness and waits\n");
+  printf("  -d  benchmark length in seconds (default %.0f)\n", defaults->duration);
+  printf("  -o  benchmark, appending the results as a CSV row to this file\n");
+  printf("  -S  seed the think and eat periods, to replay a run (default: the clock)\n");
+  if (extra_usage != NULL)
+    printf("%s", extra_usage);
+  exit(0);
+}
+
+/*
+ * Parse the command line into opt, which holds the defaults on entry.
+ * Letters in extra go to handler.
+ */
+static void dp_parse_options_extra (int argc, char **argv, dp_options *opt, const char *extra,
+                                    dp_option_handler handler, const char *extra_usage)
+{
+  dp_options defaults = *opt;
+  char       optstring[64] = "n:t:e:Bd:o:S:";
+  int        c;
+
+  if (extra != NULL)
+    strncat(optstring, extra, sizeof (optstring) - strlen(optstring) - 1);
+
+  while ((c = getopt(argc, argv, optstring)) != -1) {
+    switch (c) {
+    case 'n':
+      opt->phils = atoi(optarg);
+      break;
+    case 't':
+      opt->think_max = atoi(optarg);
+      break;
+    case 'e':
+      opt->eat_max = atoi(optarg);
+      break;
+    case 'B':
+      opt->bench = 1;
+      break;
+    case 'd':
+      opt->duration = atof(optarg);
+      break;
+    case 'o':
+      opt->csv   = optarg;
+      opt->bench = 1;
+      break;
+    case 'S':
+      opt->seed   = (unsigned) strtoul(optarg, NULL, 0);
+      opt->seeded = 1;
+      break;
+    default:
+      if (c == '?' || extra == NULL || !handler(c, optarg))
+        dp_usage(argv[0], &defaults, extra_usage);
+    }
+  }
+
+  if (optind != argc)
+    dp_usage(argv[0], &defaults, extra_usage);
+  if (opt->phils < 2 || opt->think_max < 1 || opt->eat_max < 1 || opt->duration <= 0) {
+    fprintf(stderr, "Need at least 2 philosophers, positive think and eat periods and duration.\n");
+    exit(1);
+  }
+}
+
+static void dp_parse_options (int argc, char **argv, dp_options *opt)
+{
+  dp_parse_options_extra(argc, argv, opt, NULL, NULL, NULL);
+}
+
+/*
+ * Seed rand(), from which every philosopher draws its own rand_r()
+ * state. With -S the sequence of think and eat periods each
+ * philosopher goes through is the same from run to run, so a
+ * contention pattern, or a deadlock, can be replayed; the clock seed is
+ * kept in opt so that any run can be replayed later with -S.
+ */
+static void dp_seed (dp_options *opt)
+{
+  if (!opt->seeded)
+    opt->seed = (unsigned) time(NULL);
+  srand(opt->seed);
+}
+
+/*
+ * Print the benchmark results, given each philosopher's meals and wait
+ * histogram. A program with parameters of its own appends them to the
+ * CSV row: extra_header names the columns and extra_values holds them,
+ * both comma separated.
+ */
+static void dp_report_extra (const char *solution, const dp_options *opt, const int *meals,
+                             wait_histogram **waits, double elapsed, int deadlocked,
+                             const char *extra_header, const char *extra_values)
+{
+  wait_histogram *all = (wait_histogram *) calloc(1, sizeof (wait_histogram));
+  double          sum = 0, sum_sq = 0, fairness;
+  double          p50, p90, p99, p999;
+  int             i, j;
+
+  if (all == NULL) {
+    fprintf(stderr, "dp_report: allocation failed\n");
+    exit(1);
+  }
+
+  for (i = 0; i < opt->phils; i++) {
+    sum    += meals[i];
+    sum_sq += (double) meals[i] * meals[i];
+    for (j = 0; j < WAIT_BUCKETS; j++)
+      all->count[j] += waits[i]->count[j];
+  }
+  fairness = sum_sq > 0 ? sum * sum / (opt->phils * sum_sq) : 0;
+  p50  = wait_percentile(all, 50)   / 1e3;
+  p90  = wait_percentile(all, 90)   / 1e3;
+  p99  = wait_percentile(all, 99)   / 1e3;
+  p999 = wait_percentile(all, 99.9) / 1e3;
+
+  printf("%s: %d philosophers (think < %d, eat < %d, seed %u) for %.2f s%s\n", solution,
+         opt->phils, opt->think_max, opt->eat_max, opt->seed, elapsed,
+         deadlocked ? ", DEADLOCKED" : "");
+  printf("  %.0f meals: %.0f meals/s, Jain's fairness %.4f\n", sum, sum / elapsed, fairness);
+  printf("  wait for chopsticks (us): p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f\n",
+         p50, p90, p99, p999);
+
+  if (opt->csv != NULL) {
+    FILE *out = fopen(opt->csv, "a");
+    if (out == NULL) {
+      fprintf(stderr, "Unable to open \"%s\".\n", opt->csv);
+      exit(1);
+    }
+    if (ftell(out) == 0)
+      fprintf(out, "solution,philosophers,think_max,eat_max,seconds,deadlocked,meals,meals_per_sec,"
+              "fairness,wait_p50_us,wait_p90_us,wait_p99_us,wait_p999_us,seed%s%s\n",
+              extra_header != NULL ? "," : "", extra_header != NULL ? extra_header : "");
+    fprintf(out, "%s,%d,%d,%d,%.3f,%d,%.0f,%.0f,%.4f,%.2f,%.2f,%.2f,%.2f,%u%s%s\n",
+            solution, opt->phils, opt->think_max, opt->eat_max, elapsed, deadlocked,
+            sum, sum / elapsed, fairness, p50, p90, p99, p999, opt->seed,
+            extra_values != NULL ? "," : "", extra_values != NULL ? extra_values : "");
+    fclose(out);
+  }
+
+  free(all);
+}
+
+static void dp_report (const char *solution, const dp_options *opt, const int *meals,
+                       wait_histogram **waits, double elapsed, int deadlocked)
+{
+  dp_report_extra(solution, opt, meals, waits, elapsed, deadlocked, NULL, NULL);
+}
+
+/*
+ * What a benchmark run needs to see of a solution's philosophers: the
+ * meals each has eaten, its wait histogram and its thread. deadlocked,
+ * when not NULL, reports a deadlock found without waiting for the
+ * stall timeout.
+ */
+typedef struct {
+  int              (*meals)(int phil);
+  wait_histogram  *(*waits)(int phil);
+  pthread_t        (*thread)(int phil);
+  int              (*deadlocked)(void);
+} dp_solution;
+
+/*
+ * Let the philosophers eat for the configured time, then set *stop and
+ * fill in each philosopher's meals and waits. If no meal is eaten and
+ * nobody leaves the table (*finished counts those that did) for
+ * BENCH_STALL_NS, before or after *stop, they deadlocked. Returns the
+ * elapsed time in seconds.
+ */
+static inline double dp_bench_run (const dp_options *opt, const dp_solution *sol, int *stop,
+                                   int *finished, int *meals, wait_histogram **waits, int *deadlocked)
+{
+  uint64_t start, now, last_meal;
+  uint64_t end = 0;
+  int      i, total, last_total = 0;
+
+  *deadlocked = 0;
+  start = last_meal = dp_now_ns();
+  do {
+    usleep(BENCH_POLL_US);
+    now = dp_now_ns();
+
+    if (!*stop && now - start >= opt->duration * 1e9) {
+      *stop = 1;
+      end   = now;
+    }
+
+    total = __atomic_load_n(finished, __ATOMIC_ACQUIRE);
+    for (i = 0; i < opt->phils; i++)
+      total += sol->meals(i);
+    if (total != last_total) {
+      last_total = total;
+      last_meal  = now;
+    }
+    else if (now - last_meal >= BENCH_STALL_NS)
+      *deadlocked = 1;
+    if (sol->deadlocked != NULL && sol->deadlocked())
+      *deadlocked = 1;
+  } while (!*deadlocked && __atomic_load_n(finished, __ATOMIC_ACQUIRE) < opt->phils);
+
+  if (!*stop) {
+    *stop = 1;
+    end   = now;
+  }
+
+  /*
+   * Deadlocked philosophers never get back to checking stop, so only
+   * wait for them if they all left
+   */
+  if (!*deadlocked)
+    for (i = 0; i < opt->phils; i++)
+      pthread_join(sol->thread(i), NULL);
+
+  for (i = 0; i < opt->phils; i++) {
+    meals[i] = sol->meals(i);
+    waits[i] = sol->waits(i);
+  }
+  return (end - start) / 1e9;
+}
+
+/*
+ * Benchmark mode: run the philosophers and report under the solution
+ * name
+ */
+static inline void dp_benchmark (const char *solution, const dp_options *opt,
+                                 const dp_solution *sol, int *stop, int *finished)
+{
+  int             *meals = (int *) malloc(sizeof (int) * opt->phils);
+  wait_histogram **waits = (wait_histogram **) malloc(sizeof (wait_histogram *) * opt->phils);
+  double           elapsed;
+  int              deadlocked;
+
+  if (meals == NULL || waits == NULL) {
+    fprintf(stderr, "dp_benchmark: allocation failed\n");
+    exit(1);
+  }
+
+  elapsed = dp_bench_run(opt, sol, stop, finished, meals, waits, &deadlocked);
+  dp_report(solution, opt, meals, waits, elapsed, deadlocked);
+
+  free(meals);
+  free(waits);
+}
+
+#endif /* DP_BENCH_H */
@@ -0,0 +1,191 @@
+#ifndef DP_DEADLOCK_H
+#define DP_DEADLOCK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "dp_bench.h"
+
+/*
+ * Wait-for graph over the chopstick mutexes. Every philosopher records
+ * the chopstick it is about to block on and the chopsticks it holds.
+ * Before blocking it follows the graph: the chopstick's holder, the
+ * chopstick that philosopher waits for, and so on. If the walk comes
+ * back to itself, the philosophers on the walk are deadlocked. The
+ * cycle is dumped at once, instead of being inferred after an
+ * accounting period without progress.
+ *
+ * The graph is on in debug builds, which is what the Makefile builds.
+ * Compile with -DNDEBUG or -DDP_NO_DEADLOCK_CHECK to leave it out, and
+ * dp_lock(), dp_trylock() and dp_unlock() then reduce to the plain
+ * mutex calls.
+ */
+#if !defined(NDEBUG) && !defined(DP_NO_DEADLOCK_CHECK)
+#define DP_DEADLOCK_CHECK 1
+#endif
+
+#ifdef DP_DEADLOCK_CHECK
+
+typedef struct {
+  int          phils;
+  int         *holder;       /* per chopstick: philosopher holding it, or -1 */
+  int         *wants;        /* per philosopher: chopstick it is blocked on, or -1 */
+  int          deadlocked;   /* set by the philosopher that found a cycle */
+} dp_wait_graph;
+
+static dp_wait_graph WaitGraph;
+
+static void dp_wait_graph_init (int phils, int chops)
+{
+  int i;
+
+  WaitGraph.phils  = phils;
+  WaitGraph.holder = (int *) malloc(sizeof (int) * chops);
+  WaitGraph.wants  = (int *) malloc(sizeof (int) * phils);
+  if (WaitGraph.holder == NULL || WaitGraph.wants == NULL) {
+    fprintf(stderr, "dp_wait_graph_init: allocation failed\n");
+    exit(1);
+  }
+  for (i = 0; i < chops; i++)
+    WaitGraph.holder[i] = -1;
+  for (i = 0; i < phils; i++)
+    WaitGraph.wants[i] = -1;
+}
+
+/*
+ * Length of the wait-for cycle through philosopher me if it blocks on
+ * chop, or 0 if there is none
+ */
+static int dp_cycle_length (int me, int chop)
+{
+  int length = 0;
+  int phil;
+
+  while (length < WaitGraph.phils) {
+    phil = __atomic_load_n(&WaitGraph.holder[chop], __ATOMIC_SEQ_CST);
+    if (phil < 0)
+      return 0;
+    length++;
+    if (phil == me)
+      return length;
+    chop = __atomic_load_n(&WaitGraph.wants[phil], __ATOMIC_SEQ_CST);
+    if (chop < 0)
+      return 0;
+  }
+  return 0;
+}
+
+/*
+ * Look for a cycle closed by philosopher me blocking on chop, and dump
+ * it if there is one. Holders and waits are read one at a time, so a
+ * cycle counts only if a second walk finds it again.
+ */
+static void dp_check_cycle (int me, int chop)
+{
+  uint64_t start = dp_now_ns();
+  int      length, phil, next;
+
+  length = dp_cycle_length(me, chop);
+  if (length == 0 || dp_cycle_length(me, chop) != length)
+    return;
+  if (__atomic_exchange_n(&WaitGraph.deadlocked, 1, __ATOMIC_SEQ_CST))
+    return;
+
+  fprintf(stderr, "Deadlock: wait-for cycle of %d philosophers, found in %.1f us\n",
+          length, (dp_now_ns() - start) / 1e3);
+  phil = me;
+  do {
+    next = __atomic_load_n(&WaitGraph.holder[chop], __ATOMIC_SEQ_CST);
+    fprintf(stderr, "  philosopher %d waits for chopstick %d, held by philosopher %d\n",
+            phil, chop, next);
+    phil = next;
+    chop = __atomic_load_n(&WaitGraph.wants[phil], __ATOMIC_SEQ_CST);
+  } while (phil != me && chop >= 0);
+}
+
+static inline void dp_lock (int phil, int chop, pthread_mutex_t *m)
+{
+  __atomic_store_n(&WaitGraph.wants[phil], chop, __ATOMIC_SEQ_CST);
+  dp_check_cycle(phil, chop);
+  pthread_mutex_lock(m);
+  __atomic_store_n(&WaitGraph.holder[chop], phil, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&WaitGraph.wants[phil], -1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Returns 1 if chop was taken. A try-lock never blocks, so it adds no
+ * wait-for edge.
+ */
+static inline int dp_trylock (int phil, int chop, pthread_mutex_t *m)
+{
+  if (pthread_mutex_trylock(m) != 0)
+    return 0;
+  __atomic_store_n(&WaitGraph.holder[chop], phil, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+static inline void dp_unlock (int phil, int chop, pthread_mutex_t *m)
+{
+  (void) phil;
+  __atomic_store_n(&WaitGraph.holder[chop], -1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(m);
+}
+
+static inline int dp_deadlocked (void)
+{
+  return __atomic_load_n(&WaitGraph.deadlocked, __ATOMIC_SEQ_CST);
+}
+
+#else /* !DP_DEADLOCK_CHECK */
+
+static inline void dp_wait_graph_init (int phils, int chops)
+{
+  (void) phils;
+  (void) chops;
+}
+
+static inline void dp_lock (int phil, int chop, pthread_mutex_t *m)
+{
+  (void) phil;
+  (void) chop;
+  pthread_mutex_lock(m);
+}
+
+static inline int dp_trylock (int phil, int chop, pthread_mutex_t *m)
+{
+  (void) phil;
+  (void) chop;
+  return pthread_mutex_trylock(m) == 0;
+}
+
+static inline void dp_unlock (int phil, int chop, pthread_mutex_t *m)
+{
+  (void) phil;
+  (void) chop;
+  pthread_mutex_unlock(m);
+}
+
+static inline int dp_deadlocked (void)
+{
+  return 0;
+}
+
+#endif /* DP_DEADLOCK_CHECK */
+
+/*
+ * Lock and unlock chop, one of the chopsticks in the chops array,
+ * through the wait-for graph, which dumps a deadlock as soon as the
+ * philosopher that closes it is about to block
+ */
+static inline void dp_lock_chop (int phil, pthread_mutex_t *chops, pthread_mutex_t *chop)
+{
+  dp_lock(phil, (int) (chop - chops), chop);
+}
+
+static inline void dp_unlock_chop (int phil, pthread_mutex_t *chops, pthread_mutex_t *chop)
+{
+  dp_unlock(phil, (int) (chop - chops), chop);
+}
+
+#endif /* DP_DEADLOCK_H */
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dp_bench.h"
+#include "dp_deadlock.h"
+#include "dp_lockmgr.h"
+
+/*
+ * Dining philosophers on a random resource graph. Instead of a ring of
+ * chopsticks, each philosopher needs a random set of resources to eat,
+ * drawn from a pool shared by the whole table, and takes them through
+ * the lock manager in dp_lockmgr.h. This always runs as a benchmark,
+ * so that the two lock manager policies can be compared on the same
+ * graph: a -S seed gives the same graph and the same think and eat
+ * periods to both.
+ */
+#define NUM_PHILS                     5
+#define MAX_PHIL_THINK_PERIOD      1000
+#define MAX_PHIL_EAT_PERIOD         100
+#define ACCOUNTING_PERIOD             5
+#define RESOURCES_PER_PHIL            3
+
+/*
+ * Structure defining a philosopher and the resources it eats with
+ */
+typedef struct {
+  int            id;           /* Int ID number assigned by
+                                  set_table() */
+  int           *resources;    /* Sorted resource numbers needed to
+                                  eat */
+  int            nresources;   /* Entries in resources */
+  int            prog_total;   /* Meals eaten */
+  int            retries;      /* Times LM_BACKOFF gave back everything */
+  pthread_t      thread;       /* Thread structure for this
+                                  philosopher */
+  unsigned int   seed;         /* rand_r() state for think and eat
+                                  periods and backoff */
+  wait_histogram *waits;       /* Time from hungry to holding every
+                                  resource */
+} philosopher;
+
+/* GLOBALS */
+philosopher  *Diners;
+int           Stop = 0;
+int           Finished = 0;     /* philosophers that saw Stop and left */
+dp_options    Options = { NUM_PHILS, MAX_PHIL_THINK_PERIOD, MAX_PHIL_EAT_PERIOD,
+                          1, ACCOUNTING_PERIOD, NULL };
+int           Resources = 0;    /* -r: size of the pool, 0 for one per philosopher */
+int           PerPhil = RESOURCES_PER_PHIL;
+lm_policy     Policy = LM_ORDERED;
+lock_manager  Manager;
+
+/*
+ * Options of this solution on top of dp_bench.h's
+ */
+static int graph_option (int c, const char *arg)
+{
+  switch (c) {
+  case 'r':
+    Resources = atoi(arg);
+    return Resources > 0;
+  case 'k':
+    PerPhil = atoi(arg);
+    return PerPhil > 0;
+  case 'p':
+    if (strcmp(arg, "ordered") == 0)
+      Policy = LM_ORDERED;
+    else if (strcmp(arg, "backoff") == 0)
+      Policy = LM_BACKOFF;
+    else
+      return 0;
+    return 1;
+  }
+  return 0;
+}
+
+static const char *graph_usage =
+  "  -r  resources in the pool (default: one per philosopher)\n"
+  "  -k  resources each philosopher needs to eat (default 3)\n"
+  "  -p  lock manager policy: ordered or backoff (default ordered)\n";
+
+/*
+ * Do a small amount of work that we can use to represent a
+ * philosopher thinking one thought
+ */
+void think_one_thought()
+{
+  int i;
+  i = 0;
+  i++;
+}
+
+/*
+ * Do a small amount of work that we can use to represent a
+ * philosopher eating one mouthful of food
+ */
+void eat_one_mouthful()
+{
+  int i;
+  i = 0;
+  i++;
+}
+
+/*
+ * Philosopher code: think, take every resource through the lock
+ * manager, eat, give them back
+ */
+static void *dp_thread(void *arg)
+{
+  int          eat_rnd;
+  int          i;
+  philosopher *me;
+  int          think_rnd;
+  uint64_t     hungry;
+
+  me = (philosopher *) arg;
+
+  while (!Stop) {
+    think_rnd = (rand_r(&me->seed) % Options.think_max);
+    eat_rnd   = (rand_r(&me->seed) % Options.eat_max);
+
+    for (i = 0; i < think_rnd; i++){
+      think_one_thought();
+    }
+
+    hungry = dp_now_ns();
+    me->retries += lm_acquire(&Manager, me->id, me->resources, me->nresources,
+                              Policy, &me->seed);
+    wait_record(me->waits, dp_now_ns() - hungry);
+
+    for (i = 0; i < eat_rnd; i++){
+      eat_one_mouthful();
+    }
+
+    lm_release(&Manager, me->id, me->resources, me->nresources);
+
+    me->prog_total++;
+  }
+
+  __atomic_add_fetch(&Finished, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/*
+ * Set up the resource pool, deal each philosopher a random set of
+ * resources from it, and start the philosophers. The sets come from
+ * the seeded rand(), before any thread runs, so a seed always deals
+ * the same graph.
+ */
+void set_table()
+{
+  int i, j;
+
+  lm_init(&Manager, Resources);
+  dp_wait_graph_init(Options.phils, Resources);
+
+  Diners = (philosopher *) calloc(Options.phils, sizeof (philosopher));
+  if (Diners == NULL) {
+    fprintf(stderr, "set_table: allocation failed\n");
+    exit(1);
+  }
+
+  for (i = 0; i < Options.phils; i++) {
+    Diners[i].id        = i;
+    Diners[i].resources = (int *) malloc(sizeof (int) * PerPhil);
+    Diners[i].waits     = (wait_histogram *) calloc(1, sizeof (wait_histogram));
+    if (Diners[i].resources == NULL || Diners[i].waits == NULL) {
+      fprintf(stderr, "set_table: allocation failed\n");
+      exit(1);
+    }
+    /*
+     * Draw until the set holds PerPhil distinct resources; the pool is
+     * at least that big
+     */
+    Diners[i].nresources = 0;
+    while (Diners[i].nresources < PerPhil) {
+      for (j = Diners[i].nresources; j < PerPhil; j++)
+        Diners[i].resources[j] = rand() % Resources;
+      Diners[i].nresources = lm_prepare(Diners[i].resources, PerPhil);
+    }
+    Diners[i].seed = rand();
+  }
+
+  for (i = 0; i < Options.phils; i++) {
+    pthread_create(&(Diners[i].thread), NULL, dp_thread, &Diners[i]);
+  }
+}
+
+static int phil_meals (int i)
+{
+  return Diners[i].prog_total;
+}
+
+static wait_histogram *phil_waits (int i)
+{
+  return Diners[i].waits;
+}
+
+static pthread_t phil_thread (int i)
+{
+  return Diners[i].thread;
+}
+
+static const dp_solution Solution = { phil_meals, phil_waits, phil_thread, dp_deadlocked };
+
+/*
+ * Let the philosophers eat for the configured time, then report along
+ * with the graph and its retries. Neither policy should deadlock.
+ */
+void benchmark()
+{
+  int             *meals;
+  wait_histogram **waits;
+  uint64_t         retries = 0, eaten = 0;
+  int              i, deadlocked;
+  double           elapsed, per_meal;
+  char             solution[32], graph[64];
+
+  meals = (int *) malloc(sizeof (int) * Options.phils);
+  waits = (wait_histogram **) malloc(sizeof (wait_histogram *) * Options.phils);
+  if (meals == NULL || waits == NULL) {
+    fprintf(stderr, "benchmark: allocation failed\n");
+    exit(1);
+  }
+
+  elapsed = dp_bench_run(&Options, &Solution, &Stop, &Finished, meals, waits, &deadlocked);
+  for (i = 0; i < Options.phils; i++) {
+    retries += Diners[i].retries;
+    eaten   += meals[i];
+  }
+
+  snprintf(solution, sizeof (solution), "dp_graph_%s",
+           Policy == LM_ORDERED ? "ordered" : "backoff");
+  per_meal = eaten ? (double) retries / eaten : 0.0;
+  snprintf(graph, sizeof (graph), "%d,%d,%.3f", Resources, PerPhil, per_meal);
+  dp_report_extra(solution, &Options, meals, waits, elapsed, deadlocked,
+                  "resources,per_philosopher,retries_per_meal", graph);
+  printf("  graph: %d resources, %d per philosopher, %.3f retries per meal\n",
+         Resources, PerPhil, per_meal);
+
+  free(meals);
+  free(waits);
+}
+
+int main(int argc, char **argv)
+{
+  dp_parse_options_extra(argc, argv, &Options, "r:k:p:", graph_option, graph_usage);
+  Options.bench = 1;
+  if (Resources == 0)
+    Resources = Options.phils;
+  if (PerPhil > Resources) {
+    fprintf(stderr, "Need at least %d resources for %d per philosopher.\n", PerPhil, PerPhil);
+    exit(1);
+  }
+
+  dp_seed(&Options);
+  set_table();
+  benchmark();
+  return 0;
+}
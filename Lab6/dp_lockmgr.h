@@ -0,0 +1,143 @@
+#ifndef DP_LOCKMGR_H
+#define DP_LOCKMGR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "dp_deadlock.h"
+
+/*
+ * A lock manager over a table of resource mutexes, for philosophers
+ * that need any set of resources rather than the two chopsticks of a
+ * ring. A resource set is an array of resource numbers, which
+ * lm_prepare() sorts and dedups once; both policies rely on it.
+ *
+ *   LM_ORDERED  lock the set in increasing resource number. Every
+ *               philosopher takes resources in the same global order,
+ *               so no wait-for cycle can form.
+ *   LM_BACKOFF  block on one resource while holding nothing, then
+ *               try-lock the rest. If one is busy, release everything,
+ *               back off for a random, growing time, and next block on
+ *               the resource that was busy. Nobody ever blocks while
+ *               holding a resource, so there is no deadlock either,
+ *               and nobody sits on resources while waiting for others.
+ *
+ * Locks go through dp_lock() and dp_trylock(), so the wait-for graph,
+ * set up with dp_wait_graph_init() over the manager's resources,
+ * checks the manager too.
+ */
+typedef enum {
+  LM_ORDERED,
+  LM_BACKOFF
+} lm_policy;
+
+/*
+ * Backoff after the n-th failed attempt is a random delay below
+ * 2^min(n, LM_BACKOFF_MAX_SHIFT) microseconds, and a yield when that
+ * comes out as 0
+ */
+#define LM_BACKOFF_MAX_SHIFT  10
+
+typedef struct {
+  pthread_mutex_t *locks;
+  int              count;
+} lock_manager;
+
+static void lm_init (lock_manager *lm, int count)
+{
+  int i;
+
+  lm->count = count;
+  lm->locks = (pthread_mutex_t *) malloc(sizeof (pthread_mutex_t) * count);
+  if (lm->locks == NULL) {
+    fprintf(stderr, "lm_init: allocation failed\n");
+    exit(1);
+  }
+  for (i = 0; i < count; i++)
+    pthread_mutex_init(&lm->locks[i], NULL);
+}
+
+static int lm_compare (const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+/*
+ * Sort set into the global order and drop duplicates. Returns the
+ * number of resources left.
+ */
+static int lm_prepare (int *set, int n)
+{
+  int i, j;
+
+  if (n == 0)
+    return 0;
+  qsort(set, n, sizeof (int), lm_compare);
+  for (i = 1, j = 0; i < n; i++)
+    if (set[i] != set[j])
+      set[++j] = set[i];
+  return j + 1;
+}
+
+static void lm_backoff (int attempt, unsigned *seed)
+{
+  struct timespec ts;
+  int             shift = attempt < LM_BACKOFF_MAX_SHIFT ? attempt : LM_BACKOFF_MAX_SHIFT;
+  long            us    = rand_r(seed) % (1L << shift);
+
+  if (us == 0) {
+    sched_yield();
+    return;
+  }
+  ts.tv_sec  = 0;
+  ts.tv_nsec = us * 1000;
+  nanosleep(&ts, NULL);
+}
+
+/*
+ * Take every resource in set, a prepared set of n, for owner. Returns
+ * the number of times LM_BACKOFF had to give everything back, which is
+ * always 0 for LM_ORDERED.
+ */
+static int lm_acquire (lock_manager *lm, int owner, const int *set, int n,
+                       lm_policy policy, unsigned *seed)
+{
+  int first = 0;
+  int attempt, i, j;
+
+  if (policy == LM_ORDERED) {
+    for (i = 0; i < n; i++)
+      dp_lock(owner, set[i], &lm->locks[set[i]]);
+    return 0;
+  }
+
+  for (attempt = 0; n > 0; attempt++) {
+    dp_lock(owner, set[first], &lm->locks[set[first]]);
+    for (i = 0; i < n; i++)
+      if (i != first && !dp_trylock(owner, set[i], &lm->locks[set[i]]))
+        break;
+    if (i == n)
+      return attempt;
+
+    for (j = i - 1; j >= 0; j--)
+      if (j != first)
+        dp_unlock(owner, set[j], &lm->locks[set[j]]);
+    dp_unlock(owner, set[first], &lm->locks[set[first]]);
+    first = i;
+    lm_backoff(attempt, seed);
+  }
+  return 0;
+}
+
+static void lm_release (lock_manager *lm, int owner, const int *set, int n)
+{
+  int i;
+
+  for (i = n - 1; i >= 0; i--)
+    dp_unlock(owner, set[i], &lm->locks[set[i]]);
+}
+
+#endif /* DP_LOCKMGR_H */
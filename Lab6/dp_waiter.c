@@ -3,12 +3,15 @@
 #include <unistd.h>
 #include <math.h>
 #include <stdlib.h>
+#include "dp_bench.h"
+#include "dp_deadlock.h"
 
 /*
  * Some handy constants. Number of philosophers and chopsticks lets us
  * parameterize the number of concurrent threads and shared
- * resources. The maximum thinking and eating periods let us tune
- * relative periods of holding or not holding a resource. The MAX_BUF
+ * resources (these are the defaults for the command line options).
+ * The maximum thinking and eating periods let us tune relative
+ * periods of holding or not holding a resource. The MAX_BUF
  * and column_width constants help with creating output that makes
  * sense..
  */
@@ -37,18 +40,29 @@ typedef struct {
                                   sessions  */
   pthread_t      thread;       /* Thread structure for this
                                   philosopher */
+  unsigned int   seed;         /* rand_r() state for think and eat
+                                  periods */
+  wait_histogram *waits;       /* Benchmark mode: time from hungry
+                                  to holding both chopsticks */
+  int            state;        /* THINKING, HUNGRY or EATING, for
+                                  the waiter */
+  pthread_mutex_t lock;        /* Guards state; can_eat waits on it */
 } philosopher;
 
+/*
+ * What the waiter knows about each philosopher
+ */
+enum { THINKING, HUNGRY, EATING };
+
 /* GLOBALS */
-philosopher Diners[NUM_PHILS];
-int         Stop = 0;
+philosopher *Diners;
+int          Stop = 0;
+int          Finished = 0;     /* philosophers that saw Stop and left */
+dp_options   Options = { NUM_PHILS, MAX_PHIL_THINK_PERIOD, MAX_PHIL_EAT_PERIOD,
+                         0, ACCOUNTING_PERIOD, NULL };
 
 /* Each chopstick is shared between two philosophers */
-static pthread_mutex_t chopstick[NUM_CHOPS];
-
-/* WAITER SOLUTION uses these data structures */
-static pthread_mutex_t waiter;
-static int available_chopsticks[NUM_CHOPS];
+static pthread_mutex_t *chopstick;
 
 /*
  * Helper functions for grabbing chopsticks, referencing neighbors.
@@ -62,12 +76,12 @@ static int available_chopsticks[NUM_CHOPS];
  */
 philosopher *left_phil (philosopher *p)
 {
-  return &Diners[(p->id == (NUM_PHILS-1) ? 0 : (p->id)+1)];
+  return &Diners[(p->id == (Options.phils-1) ? 0 : (p->id)+1)];
 }
 
 philosopher *right_phil (philosopher *p)
 {
-  return &Diners[(p->id == 0 ? (NUM_PHILS-1) : (p->id)-1)];
+  return &Diners[(p->id == 0 ? (Options.phils-1) : (p->id)-1)];
 }
 
 pthread_mutex_t *left_chop (philosopher *p)
@@ -77,17 +91,7 @@ pthread_mutex_t *left_chop (philosopher *p)
 
 pthread_mutex_t *right_chop (philosopher *p)
 {
-  return &chopstick[(p->id == 0 ? NUM_CHOPS-1 : (p->id)-1)];
-}
-
-int *left_chop_available (philosopher *p)
-{
-  return &available_chopsticks[p->id];
-}
-
-int *right_chop_available (philosopher *p)
-{
-  return &available_chopsticks[(p->id == 0 ? NUM_CHOPS-1 : (p->id)-1)];
+  return &chopstick[(p->id == 0 ? Options.phils-1 : (p->id)-1)];
 }
 
 /*
@@ -112,29 +116,104 @@ void eat_one_mouthful()
   i++;
 }
 
-static int queue[NUM_PHILS];  
-static int queue_front = 0; 
-static int queue_rear = 0;
-static int queue_size = 0;
-static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
-
-static void enqueue(int phil_id) {
-    if (queue_size < NUM_PHILS) {
-        queue[queue_rear] = phil_id;
-        queue_rear = (queue_rear + 1) % NUM_PHILS;
-        queue_size++;
-    }
+/*
+ * The waiter seats a hungry philosopher as soon as neither neighbor is
+ * eating, and when a philosopher finishes it checks only the two
+ * neighbors that were waiting on its chopsticks, waking them through
+ * their own can_eat. There is no global lock or queue: each
+ * philosopher's state has its own lock, and the waiter takes the
+ * locks of the few philosophers involved in index order, which rules
+ * out deadlock among waiters working on overlapping neighborhoods.
+ */
+static int phil_index (int id, int offset)
+{
+  return ((id + offset) % Options.phils + Options.phils) % Options.phils;
 }
 
-static int dequeue() {
-    int phil_id = -1;
-    if (queue_size > 0) {
-        phil_id = queue[queue_front];
-        queue_front = (queue_front + 1) % NUM_PHILS;
-        queue_size--;
-    }
-    return phil_id;
+/*
+ * Lock the states of philosophers id-reach to id+reach, in index
+ * order and each once, even when the neighborhood wraps or covers a
+ * small table twice. Returns how many locks were taken, in locked.
+ */
+static int lock_neighborhood (int id, int reach, int *locked)
+{
+  int count = 0;
+  int i, j, k, index;
+
+  for (i = -reach; i <= reach; i++) {
+    index = phil_index(id, i);
+    for (j = 0; j < count && locked[j] < index; j++)
+      ;
+    if (j < count && locked[j] == index)
+      continue;
+    for (k = count; k > j; k--)
+      locked[k] = locked[k - 1];
+    locked[j] = index;
+    count++;
+  }
+
+  for (i = 0; i < count; i++)
+    pthread_mutex_lock(&Diners[locked[i]].lock);
+  return count;
 }
+
+static void unlock_neighborhood (int *locked, int count, int keep)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+    if (locked[i] != keep)
+      pthread_mutex_unlock(&Diners[locked[i]].lock);
+}
+
+/*
+ * Seat philosopher p if it is hungry and neither neighbor is eating.
+ * The caller holds the locks of p and both its neighbors.
+ */
+static void waiter_test (philosopher *p)
+{
+  if (p->state == HUNGRY &&
+      left_phil(p)->state != EATING && right_phil(p)->state != EATING) {
+    p->state = EATING;
+    pthread_cond_signal(&p->can_eat);
+  }
+}
+
+/*
+ * Ask the waiter for both chopsticks, sleeping on can_eat until a
+ * neighbor finishing seats us
+ */
+static void waiter_take (philosopher *me)
+{
+  int locked[5];
+  int count;
+
+  count = lock_neighborhood(me->id, 1, locked);
+  me->state = HUNGRY;
+  waiter_test(me);
+  unlock_neighborhood(locked, count, me->id);
+
+  while (me->state != EATING)
+    pthread_cond_wait(&me->can_eat, &me->lock);
+  pthread_mutex_unlock(&me->lock);
+}
+
+/*
+ * Tell the waiter we are done, which may seat either neighbor. Seating
+ * a neighbor looks at its other neighbor too, hence the reach of two.
+ */
+static void waiter_put (philosopher *me)
+{
+  int locked[5];
+  int count;
+
+  count = lock_neighborhood(me->id, 2, locked);
+  me->state = THINKING;
+  waiter_test(left_phil(me));
+  waiter_test(right_phil(me));
+  unlock_neighborhood(locked, count, -1);
+}
+
 /*
  * Philosopher code which makes each philosopher eat and think for a
  * random period of time.
@@ -143,61 +222,42 @@ static void *dp_thread(void *arg)
 {
   int          eat_rnd;
   int          i;
-  int          id;
   philosopher *me;
   int          think_rnd;
+  uint64_t     hungry = 0;
 
   me = (philosopher *) arg;
-  id = me->id;
 
   /*
    * While the gobal Stop flag is not set, keep thinking and eating
    * like a good Philosopher.
    */
   while (!Stop) {
-    think_rnd = (rand() % MAX_PHIL_THINK_PERIOD);
-    eat_rnd   = (rand() % MAX_PHIL_EAT_PERIOD);
+    think_rnd = (rand_r(&me->seed) % Options.think_max);
+    eat_rnd   = (rand_r(&me->seed) % Options.eat_max);
 
     for (i = 0; i < think_rnd; i++){
       think_one_thought();
     }
 
-    pthread_mutex_lock(&waiter);
-    
-    // Only enqueue if not already in queue
-    if (queue_size == 0 || queue[queue_front] != id) {
-        enqueue(id);
-    }
-    
-    while (queue[queue_front] != id || 
-           !(*left_chop_available(me) && *right_chop_available(me))) {
-        pthread_cond_wait(&queue_cond, &waiter);
-    }
-
-    dequeue();
+    if (Options.bench)
+      hungry = dp_now_ns();
 
-    *left_chop_available(me) = 0;
-    *right_chop_available(me) = 0;
-    pthread_mutex_unlock(&waiter);
+    waiter_take(me);
 
-    pthread_mutex_lock(left_chop(me));
-    pthread_mutex_lock(right_chop(me));
+    dp_lock_chop(me->id, chopstick, left_chop(me));
+    dp_lock_chop(me->id, chopstick, right_chop(me));
+    if (Options.bench)
+      wait_record(me->waits, dp_now_ns() - hungry);
 
     for (i = 0; i < eat_rnd; i++){
       eat_one_mouthful();
     }
 
-    pthread_mutex_unlock(left_chop(me));
-    pthread_mutex_unlock(right_chop(me));
+    dp_unlock_chop(me->id, chopstick, left_chop(me));
+    dp_unlock_chop(me->id, chopstick, right_chop(me));
 
-    pthread_mutex_lock(&waiter);
-    *left_chop_available(me) = 1;
-    *right_chop_available(me) = 1;
-    
-    // Broadcast to all waiting philosophers
-    pthread_cond_broadcast(&queue_cond);
-    
-    pthread_mutex_unlock(&waiter);
+    waiter_put(me);
 
     me->prog++;
     me->prog_total++;
@@ -206,6 +266,7 @@ static void *dp_thread(void *arg)
   /*
    * Philosopher thread finished, so rejoin parent
    */
+  __atomic_add_fetch(&Finished, 1, __ATOMIC_RELEASE);
   return NULL;
 }
 
@@ -218,28 +279,43 @@ void set_table()
   int i;
 
   /*
-   * Initialize mutex used in the WAITER SOLUTION to represent the
-   * waiter
+   * Allocate the philosophers and chopsticks for the table size given
+   * on the command line
    */
-  pthread_mutex_init(&waiter, NULL);
+  Diners    = (philosopher *) calloc(Options.phils, sizeof (philosopher));
+  chopstick = (pthread_mutex_t *) malloc(sizeof (pthread_mutex_t) * Options.phils);
+  if (Diners == NULL || chopstick == NULL) {
+    fprintf(stderr, "set_table: allocation failed\n");
+    exit(1);
+  }
 
   /*
-   * Initialize all the Mutexes that represent the chopsticks. The
-   * available flags are used in the WAITER SOLUTION.
+   * Initialize all the Mutexes that represent the chopsticks
    */
-  for (i = 0; i < NUM_CHOPS; i++) {
+  for (i = 0; i < Options.phils; i++)
     pthread_mutex_init(&chopstick[i], NULL);
-    available_chopsticks[i] = 1;
-  }
+  dp_wait_graph_init(Options.phils, Options.phils);
 
   /*
    * Initialize the ID number, toal and session progress of each
-   * philosopher.
+   * philosopher. Each gets its own random number seed, drawn from the
+   * seeded rand(), so that they do not serialize on rand()'s lock.
    */
-  for (i = 0; i < NUM_PHILS; i++) {
+  for (i = 0; i < Options.phils; i++) {
     Diners[i].prog = 0;
     Diners[i].prog_total = 0;
     Diners[i].id = i;
+    Diners[i].seed = rand();
+    Diners[i].state = THINKING;
+    pthread_mutex_init(&Diners[i].lock, NULL);
+    pthread_cond_init(&Diners[i].can_eat, NULL);
+    if (Options.bench) {
+      Diners[i].waits = (wait_histogram *) calloc(1, sizeof (wait_histogram));
+      if (Diners[i].waits == NULL) {
+        fprintf(stderr, "set_table: allocation failed\n");
+        exit(1);
+      }
+    }
   }
 
   /*
@@ -248,7 +324,7 @@ void set_table()
    * and the pthread_t thread element of the structure is filled in by
    * the pthread_create() call.
    */
-  for (i = 0; i < NUM_PHILS; i++) {
+  for (i = 0; i < Options.phils; i++) {
     pthread_create(&(Diners[i].thread), NULL, dp_thread, &Diners[i]);
   }
 }
@@ -267,13 +343,13 @@ void print_progress()
    * Print out the progress for the current accounting period and the
    * total for each philosopher thread.
    */
-  for (i = 0; i < NUM_PHILS;) {
+  for (i = 0; i < Options.phils;) {
     /*
      * Print them in groups of 5 across a line, so use the inner loop
      * of j on 5
      */
     for (j = 0; j < 4; j++) {
-      if (i == NUM_PHILS) {
+      if (i == Options.phils) {
         printf("\n");
         goto out;
       }
@@ -290,7 +366,7 @@ void print_progress()
       i++;
     }
 
-    if (i == NUM_PHILS) {
+    if (i == Options.phils) {
       printf("\n");
       break;
     }
@@ -312,6 +388,26 @@ out:
   printf("\n");
 }
 
+/*
+ * Benchmark mode: what dp_benchmark() sees of the philosophers
+ */
+static int phil_meals (int i)
+{
+  return Diners[i].prog_total;
+}
+
+static wait_histogram *phil_waits (int i)
+{
+  return Diners[i].waits;
+}
+
+static pthread_t phil_thread (int i)
+{
+  return Diners[i].thread;
+}
+
+static const dp_solution Solution = { phil_meals, phil_waits, phil_thread, dp_deadlocked };
+
 int main(int argc, char **argv)
 {
   int i;
@@ -320,19 +416,27 @@ int main(int argc, char **argv)
 
   iter = 0;
 
+  dp_parse_options(argc, argv, &Options);
+
   /*
-   * Randomly seed the random number generator used to control how
-   * long philosophers eat and think.
+   * Seed the random number generator used to control how long
+   * philosophers eat and think, from -S or else the clock.
    */
-  srand(time(NULL));
+  dp_seed(&Options);
 
   /*
    * Set the table means create the chopsticks and the philosophers.
    * Print out a header for the periodic updates on Philosopher state.
    */
   set_table();
+
+  if (Options.bench) {
+    dp_benchmark("dp_waiter", &Options, &Solution, &Stop, &Finished);
+    return 0;
+  }
+
   printf("\n");
-  printf("Dining Philosophers Update every %d seconds\n", ACCOUNTING_PERIOD);
+  printf("Dining Philosophers Update every %d seconds (seed %u)\n", ACCOUNTING_PERIOD, Options.seed);
   printf("-------------------------------------------\n");
 
   do {
@@ -341,7 +445,7 @@ int main(int argc, char **argv)
      * philosopher is making progress, the philosopher will
      * increment it.
      */
-    for (i = 0; i < NUM_PHILS; i++)
+    for (i = 0; i < Options.phils; i++)
       Diners[i].prog = 0;
 
     /*
@@ -349,16 +453,18 @@ int main(int argc, char **argv)
      * of ACCOUNTING_PERIOD seconds, which is a *long* time compared
      * to the time-scale of a philosopher thread, so *some* progress
      * should be made by each in this waiting time, unless deadlock
-     * has occurred.
+     * has occurred. A deadlock the wait-for graph finds cuts the
+     * period short.
      */
-    sleep(ACCOUNTING_PERIOD);
+    for (i = 0; i < ACCOUNTING_PERIOD * (1000000 / BENCH_POLL_US) && !dp_deadlocked(); i++)
+      usleep(BENCH_POLL_US);
 
     /*
-     * Check for deadlock (i.e. none of the philosophers have
-     * made progress in 5 seconds)
+     * Check for deadlock (i.e. the wait-for graph found a cycle,
+     * or none of the philosophers have made progress in 5 seconds)
      */
     deadlock = 1;
-    for (i = 0; i < NUM_PHILS; i++)
+    for (i = 0; i < Options.phils && !dp_deadlocked(); i++)
       if (Diners[i].prog)
         deadlock = 0;
 
@@ -383,13 +489,13 @@ int main(int argc, char **argv)
    * Release all locks so philosophers can exit even if they are
    * deadlocked.
    */
-  for (i = 0; i < NUM_CHOPS; i++)
+  for (i = 0; i < Options.phils; i++)
     pthread_mutex_unlock(&chopstick[i]);
 
   /*
    * Wait for philosophers to finish
    */
-  for (i = 0; i < NUM_PHILS; i++)
+  for (i = 0; i < Options.phils; i++)
     pthread_join(Diners[i].thread, NULL);
 
   return 0;
@@ -2,12 +2,19 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <semaphore.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 /*
  * Define constants for how big the shared queue should be and how
- * much total work the producers and consumers should perform
+ * much total work the producers and consumers should perform. These
+ * and the work constants below are the defaults for the command line
+ * options.
  */
 #define QUEUESIZE 5
 #define WORK_MAX 30
@@ -27,60 +34,144 @@
 #define YOU_WILL_DETERMINE_FOR_PRODUCERS 678
 #define YOU_WILL_DETERMINE_FOR_CONSUMERS 678
 
+/*
+ * The lock-free ring spins this many times on a full or empty ring
+ * before sleeping on a futex (not at all on a uniprocessor, where the
+ * thread we wait for cannot run while we spin). Its head and tail live
+ * on their own cache lines so producers and consumers do not
+ * false-share.
+ */
+#define RING_SPINS 1024
+#define CACHE_LINE 64
+
+/*
+ * Run configuration, set from the command line. In benchmark mode
+ * (-B) nothing is printed per item; instead every item's enqueue to
+ * dequeue latency and the time threads spend blocked on the queue are
+ * collected and summarized at the end.
+ */
+typedef enum { QUEUE_SEM, QUEUE_RING, QUEUE_SHARD } queue_mode;
+typedef enum { SHARD_ROUND_ROBIN, SHARD_LEAST_LOADED } shard_policy;
+
+queue_mode mode = QUEUE_SEM;
+shard_policy policy = SHARD_ROUND_ROBIN;
+int        padded = 1;    /* give each shared object its own cache line (-L) */
+int        queue_size = QUEUESIZE;
+int        work_max = WORK_MAX;
+int        producer_cpu = PRODUCER_CPU, producer_block = PRODUCER_BLOCK;
+int        consumer_cpu = CONSUMER_CPU, consumer_block = CONSUMER_BLOCK;
+int        bench = 0;
+int        batch = 1;     /* most items a sem-mode consumer takes per lock acquisition */
+int        ring_spins = RING_SPINS;
+
+/*
+ * Benchmark mode only: when each item was enqueued, and how long it
+ * then waited to be dequeued, indexed by item number.
+ */
+unsigned long long *enqueue_ns;
+unsigned long long *latency_ns;
+
+static inline unsigned long long now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Allocate an object that threads on different CPUs update. In the
+ * padded layout (the default) it starts on a cache line of its own and
+ * its size is rounded up to whole lines, so nothing allocated after it
+ * can share its last line. The packed layout is plain malloc(), which
+ * puts small objects like the queue semaphores next to each other.
+ */
+void *layoutAlloc (size_t size)
+{
+  if (!padded)
+    return malloc (size);
+  return aligned_alloc (CACHE_LINE, (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+}
+
 /*****************************************************
  *   Shared Queue Related Structures and Routines    *
  *****************************************************/
 typedef struct {
   // These should be protected by mutex
-  int buf[QUEUESIZE];   /* Array for Queue contents, managed as circular queue */
   int head;             /* Index of the queue head */
   int tail;             /* Index of the queue tail, the next empty slot */  
 
   // These two won't be used in the real solution
   int full;             /* Flag set when queue is full  */
   int empty;            /* Flag set when queue is empty */
+} queueIndex;
 
+typedef struct {
+  // Set up by queueInit and only read afterwards, outside the mutex too
   pthread_mutex_t *mutex;    /* Mutex protecting this Queue's data: buf, head and tail */
   sem_t  *slotsToPut;  		 /* Used by producers to await room to produce */
   sem_t  *slotsToGet; 		 /* Used by consumers to await something to consume */
+  int *buf;             /* Array for Queue contents, managed as circular queue */
+  int size;             /* Number of slots in buf */
+
+  /*
+   * The indexes written under the mutex. In the packed layout ix points
+   * at packed_ix, on the same line as the pointers above; in the padded
+   * layout it gets a cache line of its own.
+   */
+  queueIndex *ix;
+  queueIndex  packed_ix;
 } queue;
 
 /*
  * Create the queue shared among all producers and consumers
  */
-queue *queueInit (void)
+queue *queueInit (int size)
 {
   queue *q;
 
   /*
    * Allocate the structure that holds all queue information
    */
-  q = (queue *)malloc (sizeof (queue));
+  q = (queue *)layoutAlloc (sizeof (queue));
   if (q == NULL) 
 	  return (NULL);
   /*
    * Initialize the state variables. See the definition of the Queue
    * structure for the definition of each.
    */
-  q->empty = 1;  
-  q->full  = 0;   
+  q->ix = padded ? (queueIndex *) layoutAlloc (sizeof (queueIndex)) : &q->packed_ix;
+  if (q->ix == NULL) {
+    free (q);
+    return (NULL);
+  }
+  q->ix->empty = 1;  
+  q->ix->full  = 0;   
+
+  q->size  = size;
+  q->buf   = (int *) malloc (sizeof (int) * size);
+  if (q->buf == NULL) {
+    if (q->ix != &q->packed_ix)
+      free (q->ix);
+    free (q);
+    return (NULL);
+  }
 
-  q->head  = 0;   
-  q->tail  = 0;   
+  q->ix->head  = 0;   
+  q->ix->tail  = 0;   
 
   /*
    * Allocate and initialize the queue mutex
    */
-  q->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+  q->mutex = (pthread_mutex_t *) layoutAlloc (sizeof (pthread_mutex_t));
   pthread_mutex_init (q->mutex, NULL);
 
   /*
    * Allocate and initialize the slotsToPut and slotsToGet semaphores
    */
-  q->slotsToPut = (sem_t *) malloc (sizeof (sem_t));
-  sem_init (q->slotsToPut, 0, QUEUESIZE);
+  q->slotsToPut = (sem_t *) layoutAlloc (sizeof (sem_t));
+  sem_init (q->slotsToPut, 0, size);
 
-  q->slotsToGet = (sem_t *) malloc (sizeof (sem_t));
+  q->slotsToGet = (sem_t *) layoutAlloc (sizeof (sem_t));
   sem_init (q->slotsToGet, 0, 0);
 
   return (q);
@@ -106,8 +197,11 @@ void queueDelete (queue *q)
   free (q->slotsToGet);
 
   /*
-   * Deallocate the queue structure
+   * Deallocate the queue contents and structure
    */
+  free (q->buf);
+  if (q->ix != &q->packed_ix)
+    free (q->ix);
   free (q);
 }
 
@@ -117,29 +211,29 @@ void queueAdd (queue *q, int in)
   /*
    * Put the input item into the free slot
    */
-  q->buf[q->tail] = in;
-  q->tail++;
+  q->buf[q->ix->tail] = in;
+  q->ix->tail++;
 
   /*
    * Wrapping the value of tail around to zero if we reached the end of
    * the array. This implements the circularity of the queue inthe
    * array.
    */
-  if (q->tail == QUEUESIZE)
-    q->tail = 0;
+  if (q->ix->tail == q->size)
+    q->ix->tail = 0;
 
   /*
    * If the tail pointer is equal to the head, then the next empty
    * slot in the queue is occupied and the queue is FULL
    */
-  if (q->tail == q->head)
-    q->full = 1;
+  if (q->ix->tail == q->ix->head)
+    q->ix->full = 1;
 
   /*
    * Since we just added an element to the queue, it is certainly not
    * empty.
    */
-  q->empty = 0;
+  q->ix->empty = 0;
 
   return;
 }
@@ -150,31 +244,270 @@ void queueRemove (queue *q, int *out)
    * Copy the element at head into the output variable and increment
    * the head pointer to move to the next element.
    */
-  *out = q->buf[q->head];
-  q->head++;
+  *out = q->buf[q->ix->head];
+  q->ix->head++;
 
   /*
    * Wrapping the index around to zero if it reached the size of the
    * array. This implements the circualrity of the queue int he array.
    */
-  if (q->head == QUEUESIZE)
-    q->head = 0;
+  if (q->ix->head == q->size)
+    q->ix->head = 0;
 
   /*
    * If head catches up to tail as we delete an item, then the queue
    * is empty.
    */
-  if (q->head == q->tail)
-    q->empty = 1;
+  if (q->ix->head == q->ix->tail)
+    q->ix->empty = 1;
 
   /*
    * since we took an item out, the queue is certainly not full
    */
-  q->full = 0;
+  q->ix->full = 0;
 
   return;
 }
 
+/*
+ * Remove up to max items from the head of the queue into out, in
+ * order, and return how many were removed. Like queueRemove(), the
+ * caller must hold the queue mutex.
+ */
+int queueRemoveMany (queue *q, int *out, int max)
+{
+  int n = 0;
+
+  while (n < max && !q->ix->empty)
+    queueRemove (q, &out[n++]);
+
+  return n;
+}
+
+/*****************************************************
+ *   Lock-free Bounded MPMC Ring (Vyukov)            *
+ *****************************************************/
+/*
+ * Each cell carries a sequence number that tells producers and
+ * consumers whose turn it is. For the cell at position pos:
+ *   seq == pos        the cell is free for the producer claiming pos
+ *   seq == pos + 1    the cell holds the item for the consumer claiming pos
+ * and the consumer hands it back to the producer of pos + size.
+ * Producers and consumers only contend on their own end of the ring.
+ * With a single cell, pos + size is pos + 1, so a free cell would look
+ * full: the ring needs at least two cells.
+ */
+typedef struct {
+  atomic_size_t seq;
+  int           value;
+} ringCell;
+
+typedef struct {
+  _Alignas(CACHE_LINE) atomic_size_t tail;     /* next position to put, shared by producers */
+  _Alignas(CACHE_LINE) atomic_size_t head;     /* next position to get, shared by consumers */
+
+  /*
+   * Futex words bumped when a slot frees up / an item arrives, and the
+   * number of threads sleeping on each. Wakers only make the syscall
+   * when somebody is actually asleep.
+   */
+  _Alignas(CACHE_LINE) atomic_uint notFull;
+  atomic_int  fullWaiters;
+  _Alignas(CACHE_LINE) atomic_uint notEmpty;
+  atomic_int  emptyWaiters;
+
+  _Alignas(CACHE_LINE) size_t size;
+  ringCell *cells;
+} ring;
+
+static inline void cpu_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  __asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+static void futex_wait (atomic_uint *word, unsigned int seen)
+{
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static void futex_wake (atomic_uint *word, atomic_int *waiters)
+{
+  /*
+   * Pairs with the waiter incrementing waiters before it re-checks the
+   * ring: either we see the waiter, or it sees our update.
+   */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+    atomic_fetch_add(word, 1);
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+ring *ringInit (size_t size)
+{
+  ring   *r;
+  size_t  i;
+
+  r = (ring *)aligned_alloc (CACHE_LINE, sizeof (ring));
+  if (r == NULL)
+    return (NULL);
+  memset (r, 0, sizeof (ring));
+
+  r->size  = size;
+  r->cells = (ringCell *) malloc (sizeof (ringCell) * size);
+  if (r->cells == NULL) {
+    free (r);
+    return (NULL);
+  }
+
+  for (i = 0; i < size; i++)
+    atomic_init (&r->cells[i].seq, i);
+
+  return (r);
+}
+
+void ringDelete (ring *r)
+{
+  free (r->cells);
+  free (r);
+}
+
+/*
+ * Try to put/get one item without waiting. Return 1 on success and 0
+ * if the ring was full/empty.
+ */
+int ringTryAdd (ring *r, int in)
+{
+  ringCell *cell;
+  size_t    pos = atomic_load_explicit (&r->tail, memory_order_relaxed);
+
+  for (;;) {
+    cell = &r->cells[pos % r->size];
+    size_t   seq = atomic_load_explicit (&cell->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit (&r->tail, &pos, pos + 1,
+                                                 memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+      return 0;
+    else
+      pos = atomic_load_explicit (&r->tail, memory_order_relaxed);
+  }
+
+  cell->value = in;
+  atomic_store_explicit (&cell->seq, pos + 1, memory_order_release);
+  return 1;
+}
+
+int ringTryRemove (ring *r, int *out)
+{
+  ringCell *cell;
+  size_t    pos = atomic_load_explicit (&r->head, memory_order_relaxed);
+
+  for (;;) {
+    cell = &r->cells[pos % r->size];
+    size_t   seq = atomic_load_explicit (&cell->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit (&r->head, &pos, pos + 1,
+                                                 memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+      return 0;
+    else
+      pos = atomic_load_explicit (&r->head, memory_order_relaxed);
+  }
+
+  *out = cell->value;
+  atomic_store_explicit (&cell->seq, pos + r->size, memory_order_release);
+  return 1;
+}
+
+/*
+ * Put an item, spinning for a while and then sleeping while the ring
+ * is full. Any time spent waiting is added to blocked_ns.
+ */
+void ringAdd (ring *r, int in, unsigned long long *blocked_ns)
+{
+  unsigned long long start;
+  int spins;
+
+  if (ringTryAdd (r, in))
+    goto added;
+
+  start = now_ns ();
+  for (;;) {
+    for (spins = 0; spins < ring_spins; spins++) {
+      if (ringTryAdd (r, in))
+        goto waited;
+      cpu_relax ();
+    }
+
+    /*
+     * Announce ourselves before the last check so that a consumer
+     * freeing a slot after it cannot miss us.
+     */
+    atomic_fetch_add (&r->fullWaiters, 1);
+    unsigned int seen = atomic_load (&r->notFull);
+    if (ringTryAdd (r, in)) {
+      atomic_fetch_sub (&r->fullWaiters, 1);
+      goto waited;
+    }
+    futex_wait (&r->notFull, seen);
+    atomic_fetch_sub (&r->fullWaiters, 1);
+  }
+
+waited:
+  *blocked_ns += now_ns () - start;
+added:
+  futex_wake (&r->notEmpty, &r->emptyWaiters);
+}
+
+/*
+ * Get an item, spinning for a while and then sleeping while the ring
+ * is empty. Any time spent waiting is added to blocked_ns.
+ */
+void ringRemove (ring *r, int *out, unsigned long long *blocked_ns)
+{
+  unsigned long long start;
+  int spins;
+
+  if (ringTryRemove (r, out))
+    goto removed;
+
+  start = now_ns ();
+  for (;;) {
+    for (spins = 0; spins < ring_spins; spins++) {
+      if (ringTryRemove (r, out))
+        goto waited;
+      cpu_relax ();
+    }
+
+    atomic_fetch_add (&r->emptyWaiters, 1);
+    unsigned int seen = atomic_load (&r->notEmpty);
+    if (ringTryRemove (r, out)) {
+      atomic_fetch_sub (&r->emptyWaiters, 1);
+      goto waited;
+    }
+    futex_wait (&r->notEmpty, seen);
+    atomic_fetch_sub (&r->emptyWaiters, 1);
+  }
+
+waited:
+  *blocked_ns += now_ns () - start;
+removed:
+  futex_wake (&r->notFull, &r->fullWaiters);
+}
+
 /******************************************************
  *   Producer and Consumer Structures and Routines    *
  ******************************************************/
@@ -193,8 +526,12 @@ void queueRemove (queue *q, int *out)
  */
 typedef struct {
   queue *q;       
+  ring  *r;       /* used instead of q in ring mode */
   int   *count;   
   int    tid;
+  unsigned long long blocked_ns;  /* time spent waiting for a slot (producers) or an item (consumers) */
+  int    steals;  /* shard mode: items this consumer took from other consumers' queues */
+  int    items;   /* items this thread produced or consumed */
 } pcdata;
 
 int memory_access_area[100000];
@@ -262,6 +599,34 @@ void do_work(int cpu_iterations, int blocking_time)
   }
 }
 
+/*
+ * sem_wait() that adds the time it had to block to blocked_ns. The
+ * uncontended case costs no clock reads.
+ */
+void sem_wait_timed (sem_t *sem, unsigned long long *blocked_ns)
+{
+  unsigned long long start;
+
+  if (sem_trywait (sem) == 0)
+    return;
+
+  start = now_ns ();
+  sem_wait (sem);
+  *blocked_ns += now_ns () - start;
+}
+
+/*
+ * Benchmark mode: note the dequeue of count items taken at once.
+ */
+static void record_latencies (const int *items, int count)
+{
+  unsigned long long now = now_ns ();
+  int i;
+
+  for (i = 0; i < count; i++)
+    latency_ns[items[i]] = now - enqueue_ns[items[i]];
+}
+
 void *producer (void *parg)
 {
   queue  *fifo;
@@ -286,7 +651,7 @@ void *producer (void *parg)
      * it. Finally, at the end of the loop, outside the critical
      * section, announce that we produced it.
      */
-    do_work(PRODUCER_CPU, PRODUCER_BLOCK);
+    do_work(producer_cpu, producer_block);
 
     /*
      * If the queue is full, we have no place to put anything we
@@ -301,10 +666,10 @@ void *producer (void *parg)
      * additional sem_post for the producers and consumers to free up ones
      * that are in the waiting queue for fifo->slotsToPut and fifo->slotsToGet respectively
      */
-    sem_wait(fifo->slotsToPut);
+    sem_wait_timed(fifo->slotsToPut, &mydata->blocked_ns);
     pthread_mutex_lock (fifo->mutex);
 
-    if (*total_inserted >= WORK_MAX) {
+    if (*total_inserted >= work_max) {
       pthread_mutex_unlock(fifo->mutex);
       sem_post(fifo->slotsToGet);
       sem_post(fifo->slotsToPut);
@@ -319,6 +684,8 @@ void *producer (void *parg)
      */
 
     item = (*total_inserted);
+    if (bench)
+      enqueue_ns[item] = now_ns ();
     queueAdd (fifo, item);
     ++(*total_inserted);
 
@@ -329,18 +696,22 @@ void *producer (void *parg)
      * Announce the production outside the critical section 
      * Let the consumers know that there is item in the buffer
      */
-    printf("prod %d:  %d.\n", my_tid, item);
+    mydata->items++;
+    if (!bench)
+      printf("prod %d:  %d.\n", my_tid, item);
 
   }
 
-  printf("prod %d:  exited\n", my_tid);
+  if (!bench)
+    printf("prod %d:  exited\n", my_tid);
   return (NULL);
 }
 
 void *consumer (void *carg)
 {
   queue  *fifo;
-  int     item;
+  int    *items;
+  int     claimed, taken, i;
   pcdata *mydata;
   int     my_tid;
   int    *total_consumed;
@@ -351,13 +722,15 @@ void *consumer (void *carg)
   total_consumed = mydata->count; // this one is also shared!
   my_tid         = mydata->tid;
 
+  items = (int *) malloc (sizeof (int) * batch);
+
   /*
    * Continue producing until the total consumed by all consumers
    * reaches the configured maximum
    */
   while (1) {
     pthread_mutex_lock(fifo->mutex);
-    if (*total_consumed >= WORK_MAX) {
+    if (*total_consumed >= work_max) {
       pthread_mutex_unlock(fifo->mutex);
       sem_post(fifo->slotsToGet);
       sem_post(fifo->slotsToPut);
@@ -365,30 +738,390 @@ void *consumer (void *carg)
     }
     pthread_mutex_unlock(fifo->mutex);
 
-    sem_wait(fifo->slotsToGet);
+    /*
+     * Wait for one item, then claim up to batch - 1 more that are
+     * already there without waiting for them.
+     */
+    sem_wait_timed(fifo->slotsToGet, &mydata->blocked_ns);
+    claimed = 1;
+    while (claimed < batch && sem_trywait(fifo->slotsToGet) == 0)
+      claimed++;
+
     pthread_mutex_lock(fifo->mutex);
 
-    if (*total_consumed >= WORK_MAX) {
+    if (*total_consumed >= work_max) {
       pthread_mutex_unlock(fifo->mutex);
-      sem_post(fifo->slotsToGet);
+      for (i = 0; i < claimed; i++)
+        sem_post(fifo->slotsToGet);
       sem_post(fifo->slotsToPut);
       break;
     }
 
-    queueRemove(fifo, &item);
-    (*total_consumed)++;
-    
-    do_work(CONSUMER_CPU, CONSUMER_CPU);
-    printf("con %d:   %d.\n", my_tid, item);
+    /*
+     * Only the queue manipulation happens under the lock. Some of the
+     * posts we claimed may be the wake-ups exiting producers hand out
+     * rather than items, so take what is actually there.
+     */
+    taken = claimed;
+    if (taken > work_max - *total_consumed)
+      taken = work_max - *total_consumed;
+    taken = queueRemoveMany(fifo, items, taken);
+    *total_consumed += taken;
 
     pthread_mutex_unlock(fifo->mutex);
-    sem_post(fifo->slotsToPut);
+
+    for (i = taken; i < claimed; i++)
+      sem_post(fifo->slotsToGet);
+    for (i = 0; i < taken; i++)
+      sem_post(fifo->slotsToPut);
+
+    /*
+     * Consume the items outside the critical section so consumers run
+     * in parallel.
+     */
+    mydata->items += taken;
+    if (bench)
+      record_latencies(items, taken);
+
+    for (i = 0; i < taken; i++) {
+      do_work(consumer_cpu, consumer_block);
+      if (!bench)
+        printf("con %d:   %d.\n", my_tid, items[i]);
+    }
+  }
+
+  free (items);
+  if (!bench)
+    printf("con %d:   exited\n", my_tid);
+  return (NULL);
+}
+
+/*
+ * Ring mode producer and consumer. There is no lock: producers claim
+ * the number of the next item with an atomic increment, and each
+ * consumer claims the right to take one item the same way, so exactly
+ * work_max items go through the ring and nobody waits for an item that
+ * will never come.
+ */
+void *producer_ring (void *parg)
+{
+  pcdata *mydata = (pcdata *) parg;
+  ring   *fifo = mydata->r;
+  int    *total_inserted = mydata->count;
+  int     my_tid = mydata->tid;
+  int     item;
+
+  while (1) {
+    do_work(producer_cpu, producer_block);
+
+    item = __atomic_fetch_add (total_inserted, 1, __ATOMIC_RELAXED);
+    if (item >= work_max)
+      break;
+
+    if (bench)
+      enqueue_ns[item] = now_ns ();
+    ringAdd (fifo, item, &mydata->blocked_ns);
+
+    mydata->items++;
+    if (!bench)
+      printf("prod %d:  %d.\n", my_tid, item);
+  }
+
+  if (!bench)
+    printf("prod %d:  exited\n", my_tid);
+  return (NULL);
+}
+
+void *consumer_ring (void *carg)
+{
+  pcdata *mydata = (pcdata *) carg;
+  ring   *fifo = mydata->r;
+  int    *total_consumed = mydata->count;
+  int     my_tid = mydata->tid;
+  int     item;
+
+  while (1) {
+    if (__atomic_fetch_add (total_consumed, 1, __ATOMIC_RELAXED) >= work_max)
+      break;
+
+    ringRemove (fifo, &item, &mydata->blocked_ns);
+
+    mydata->items++;
+    if (bench)
+      record_latencies(&item, 1);
+
+    do_work(consumer_cpu, consumer_block);
+    if (!bench)
+      printf("con %d:   %d.\n", my_tid, item);
+  }
+
+  if (!bench)
+    printf("con %d:   exited\n", my_tid);
+  return (NULL);
+}
+
+/***************************************************
+ *   Sharded Queues                                *
+ ***************************************************/
+
+/*
+ * Shard mode gives every consumer its own semaphore queue. Producers
+ * spread items over the queues (round robin or to the shortest one),
+ * each consumer works on its own queue and, when that is empty, steals
+ * from the others before going to sleep on its own. Every queue keeps
+ * an owner until all items are consumed, so an item is never stranded
+ * in a queue nobody will look at.
+ *
+ * When the last item is consumed every queue gets one extra
+ * slotsToGet post. A consumer that takes such a post finds its queue
+ * empty, passes the post on and exits.
+ */
+queue **shards;
+int     nshards;
+int     shard_consumed;
+
+/*
+ * Take an item from q, waiting for one only if wait is set. Returns 1
+ * with the item in *out, 0 if there was nothing to take, and -1 once
+ * all items have been consumed.
+ */
+int shardRemove (queue *q, int *out, int wait, unsigned long long *blocked_ns)
+{
+  if (wait)
+    sem_wait_timed (q->slotsToGet, blocked_ns);
+  else if (sem_trywait (q->slotsToGet) != 0)
+    return 0;
+
+  pthread_mutex_lock (q->mutex);
+  if (q->ix->empty) {
+    pthread_mutex_unlock (q->mutex);
+    sem_post (q->slotsToGet);
+    return -1;
+  }
+  queueRemove (q, out);
+  pthread_mutex_unlock (q->mutex);
+  sem_post (q->slotsToPut);
+
+  return 1;
+}
+
+/*
+ * The queue a producer should put its next item in.
+ */
+static queue *shardPick (int *cursor)
+{
+  int i, best, items, fewest;
+
+  if (policy == SHARD_ROUND_ROBIN)
+    return shards[(*cursor)++ % nshards];
+
+  /*
+   * Least loaded: the queue with the fewest items waiting, starting
+   * the scan at the cursor so ties do not all go to queue 0
+   */
+  best = *cursor % nshards;
+  sem_getvalue (shards[best]->slotsToGet, &fewest);
+  for (i = 1; i < nshards && fewest > 0; i++) {
+    int next = (*cursor + i) % nshards;
+
+    sem_getvalue (shards[next]->slotsToGet, &items);
+    if (items < fewest) {
+      fewest = items;
+      best   = next;
+    }
+  }
+  (*cursor)++;
+
+  return shards[best];
+}
+
+void *producer_shard (void *parg)
+{
+  pcdata *mydata = (pcdata *) parg;
+  int    *total_inserted = mydata->count;
+  int     my_tid = mydata->tid;
+  int     cursor = my_tid;
+  int     item;
+  queue  *q;
+
+  while (1) {
+    do_work(producer_cpu, producer_block);
+
+    item = __atomic_fetch_add (total_inserted, 1, __ATOMIC_RELAXED);
+    if (item >= work_max)
+      break;
+
+    q = shardPick (&cursor);
+    sem_wait_timed (q->slotsToPut, &mydata->blocked_ns);
+    pthread_mutex_lock (q->mutex);
+    if (bench)
+      enqueue_ns[item] = now_ns ();
+    queueAdd (q, item);
+    pthread_mutex_unlock (q->mutex);
+    sem_post (q->slotsToGet);
+
+    mydata->items++;
+    if (!bench)
+      printf("prod %d:  %d.\n", my_tid, item);
+  }
+
+  if (!bench)
+    printf("prod %d:  exited\n", my_tid);
+  return (NULL);
+}
+
+void *consumer_shard (void *carg)
+{
+  pcdata *mydata = (pcdata *) carg;
+  int     my_tid = mydata->tid;
+  queue  *mine = shards[my_tid];
+  int     item, got, i;
+
+  while (1) {
+    /*
+     * Our own queue first, then the others, then sleep on our own
+     */
+    got = shardRemove (mine, &item, 0, &mydata->blocked_ns);
+    for (i = 1; got == 0 && i < nshards; i++) {
+      got = shardRemove (shards[(my_tid + i) % nshards], &item, 0, &mydata->blocked_ns);
+      if (got > 0)
+        mydata->steals++;
+    }
+    if (got == 0)
+      got = shardRemove (mine, &item, 1, &mydata->blocked_ns);
+    if (got < 0)
+      break;
+
+    mydata->items++;
+    if (bench)
+      record_latencies(&item, 1);
+
+    do_work(consumer_cpu, consumer_block);
+    if (!bench)
+      printf("con %d:   %d.\n", my_tid, item);
+
+    if (__atomic_add_fetch (&shard_consumed, 1, __ATOMIC_RELAXED) == work_max)
+      for (i = 0; i < nshards; i++)
+        sem_post (shards[i]->slotsToGet);
   }
 
-  printf("con %d:   exited\n", my_tid);
+  if (!bench)
+    printf("con %d:   exited\n", my_tid);
   return (NULL);
 }
 
+/***************************************************
+ *   False Sharing Benchmark                       *
+ ***************************************************/
+
+/*
+ * -F: every thread increments a counter of its own, first with all
+ * the counters packed into one array and then with one counter per
+ * cache line. The threads never touch each other's counters, so any
+ * slowdown of the packed run is the cache line bouncing between CPUs.
+ */
+typedef struct {
+  _Alignas(CACHE_LINE) volatile unsigned long value;
+} paddedCounter;
+
+typedef struct {
+  volatile unsigned long *counter;
+  long iterations;
+} bumpArgs;
+
+void *bump (void *arg)
+{
+  bumpArgs *b = (bumpArgs *) arg;
+  long i;
+
+  for (i = 0; i < b->iterations; i++)
+    (*b->counter)++;
+  return (NULL);
+}
+
+/*
+ * Time one run; returns nanoseconds per increment seen by each thread.
+ */
+static double bumpRun (int threads, long iterations, int pad)
+{
+  size_t stride = pad ? sizeof (paddedCounter) : sizeof (unsigned long);
+  char *counters = (char *) aligned_alloc (CACHE_LINE, (stride * threads + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+  pthread_t *tids = (pthread_t *) malloc (sizeof (pthread_t) * threads);
+  bumpArgs *args = (bumpArgs *) malloc (sizeof (bumpArgs) * threads);
+  unsigned long long start, elapsed;
+  int i;
+
+  if (counters == NULL || tids == NULL || args == NULL) {
+    fprintf (stderr, "false sharing: allocation failed\n");
+    exit (1);
+  }
+  memset (counters, 0, stride * threads);
+
+  start = now_ns ();
+  for (i = 0; i < threads; i++) {
+    args[i].counter    = (volatile unsigned long *) (counters + i * stride);
+    args[i].iterations = iterations;
+    pthread_create (&tids[i], NULL, bump, &args[i]);
+  }
+  for (i = 0; i < threads; i++)
+    pthread_join (tids[i], NULL);
+  elapsed = now_ns () - start;
+
+  for (i = 0; i < threads; i++)
+    if (*args[i].counter != (unsigned long) iterations) {
+      fprintf (stderr, "false sharing: thread %d counted %lu\n", i, *args[i].counter);
+      exit (1);
+    }
+
+  free (counters);
+  free (tids);
+  free (args);
+
+  return (double) elapsed / iterations;
+}
+
+void falseSharing (int threads, long iterations)
+{
+  double packed_ns = bumpRun (threads, iterations, 0);
+  double padded_ns = bumpRun (threads, iterations, 1);
+
+  printf("false sharing: %d threads, %ld increments each\n", threads, iterations);
+  printf("  packed counters (%zu bytes apart): %.2f ns/increment\n", sizeof (unsigned long), packed_ns);
+  printf("  padded counters (%zu bytes apart): %.2f ns/increment (%.2fx)\n",
+         sizeof (paddedCounter), padded_ns, packed_ns / padded_ns);
+}
+
+/*
+ * Parse "cpu,block" for -P and -C.
+ */
+static void parse_work (const char *arg, int *cpu, int *block)
+{
+  if (sscanf (arg, "%d,%d", cpu, block) != 2 || *cpu < 0 || *block < 0) {
+    fprintf (stderr, "Bad work \"%s\", expected cpu_iterations,blocking_ms.\n", arg);
+    exit (1);
+  }
+}
+
+static int compare_ull (const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *) a;
+  unsigned long long y = *(const unsigned long long *) b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * Latency at percentile pct of the sorted latencies, in microseconds.
+ */
+static double percentile_us (const unsigned long long *sorted, int count, double pct)
+{
+  int index = (int) (pct / 100.0 * count);
+
+  if (index >= count)
+    index = count - 1;
+  return sorted[index] / 1e3;
+}
+
 /***************************************************
  *   Main allocates structures, creates threads,   *
  *   waits to tear down.                           *
@@ -399,34 +1132,199 @@ int main (int argc, char *argv[])
   int        cons;
   int       *concount;
 
-  queue     *fifo;
-  int        i;
+  queue     *fifo = NULL;
+  ring      *rfifo = NULL;
+  int        i, c;
+  struct timespec start, end;
 
   pthread_t *pro;
   int       *procount;
   int        pros;
 
   pcdata    *thread_args;
+  pcdata   **pro_args, **con_args;
+  const char *csv = NULL;
+  const char *name;
+  long       fs_iterations = 0;
+  void *(*produce) (void *), *(*consume) (void *);
 
   /*
-   * Check the number of arguments and determine the numebr of
-   * producers and consumers
+   * Parse the options, then check the number of arguments and
+   * determine the numebr of producers and consumers
    */
-  if (argc != 3) {
-    printf("Usage: ./producer_consumer number_of_producers number_of_consumers\n");
+  while ((c = getopt (argc, argv, "q:d:k:s:n:P:C:Bo:L:F:")) != -1) {
+    switch (c) {
+    case 'q':
+      if (strcmp (optarg, "sem") == 0)
+        mode = QUEUE_SEM;
+      else if (strcmp (optarg, "ring") == 0)
+        mode = QUEUE_RING;
+      else if (strcmp (optarg, "shard") == 0)
+        mode = QUEUE_SHARD;
+      else {
+        fprintf (stderr, "Unknown queue \"%s\", use sem, ring or shard.\n", optarg);
+        exit (1);
+      }
+      break;
+
+    case 'd':
+      if (strcmp (optarg, "rr") == 0)
+        policy = SHARD_ROUND_ROBIN;
+      else if (strcmp (optarg, "least") == 0)
+        policy = SHARD_LEAST_LOADED;
+      else {
+        fprintf (stderr, "Unknown distribution \"%s\", use rr or least.\n", optarg);
+        exit (1);
+      }
+      break;
+
+    case 'k':
+      batch = atoi (optarg);
+      break;
+
+    case 's':
+      queue_size = atoi (optarg);
+      break;
+
+    case 'n':
+      work_max = atoi (optarg);
+      break;
+
+    case 'P':
+      parse_work (optarg, &producer_cpu, &producer_block);
+      break;
+
+    case 'C':
+      parse_work (optarg, &consumer_cpu, &consumer_block);
+      break;
+
+    case 'B':
+      bench = 1;
+      break;
+
+    case 'o':
+      csv   = optarg;
+      bench = 1;
+      break;
+
+    case 'L':
+      if (strcmp (optarg, "padded") == 0)
+        padded = 1;
+      else if (strcmp (optarg, "packed") == 0)
+        padded = 0;
+      else {
+        fprintf (stderr, "Unknown layout \"%s\", use padded or packed.\n", optarg);
+        exit (1);
+      }
+      break;
+
+    case 'F':
+      fs_iterations = atol (optarg);
+      break;
+
+    default:
+      argc = 0;  /* print the usage */
+      break;
+    }
+  }
+
+  if (argc - optind != 2) {
+    printf("Usage: ./producer_consumer [-q sem|ring|shard] [-d rr|least] [-k batch] [-s queue_size]\n");
+    printf("                           [-n items] [-P cpu,block] [-C cpu,block] [-B] [-o file.csv]\n");
+    printf("                           [-L padded|packed] [-F increments]\n");
+    printf("                           number_of_producers number_of_consumers\n");
+    printf("  -q  queue: mutex and semaphores (sem, default), lock-free ring (ring) or\n");
+    printf("      one sem queue per consumer with work stealing (shard)\n");
+    printf("  -d  shard queue: producers put items round robin (rr, default) or in the\n");
+    printf("      least loaded queue (least)\n");
+    printf("  -k  sem queue: take up to this many items per lock acquisition (default 1)\n");
+    printf("  -s  queue slots, per consumer for shard (default %d)\n", QUEUESIZE);
+    printf("  -n  items to produce (default %d)\n", WORK_MAX);
+    printf("  -P  producer work per item: CPU iterations, ms blocked (default %d,%d)\n", PRODUCER_CPU, PRODUCER_BLOCK);
+    printf("  -C  consumer work per item: CPU iterations, ms blocked (default %d,%d)\n", CONSUMER_CPU, CONSUMER_BLOCK);
+    printf("  -B  benchmark: no per-item output; report throughput, latency and blocked time\n");
+    printf("  -o  benchmark, appending the results as a CSV row to this file\n");
+    printf("  -L  shared counters, semaphores and thread data each on their own cache\n");
+    printf("      line (padded, default) or allocated back to back (packed)\n");
+    printf("  -F  instead of the queue, time producers + consumers threads each doing\n");
+    printf("      this many increments on packed and on padded counters\n");
     exit(0);
   }
 
-  pros = atoi(argv[1]);
-  cons = atoi(argv[2]);
+  if (queue_size < 1 || work_max < 1) {
+    fprintf (stderr, "The queue size and item count must be positive.\n");
+    exit (1);
+  }
+  if (batch < 1 || batch > queue_size) {
+    fprintf (stderr, "The batch size must be between 1 and %d.\n", queue_size);
+    exit (1);
+  }
+
+  if (sysconf (_SC_NPROCESSORS_ONLN) == 1)
+    ring_spins = 0;
+
+  pros = atoi(argv[optind]);
+  cons = atoi(argv[optind + 1]);
+
+  if (fs_iterations > 0) {
+    falseSharing (pros + cons, fs_iterations);
+    return 0;
+  }
 
   /*
-   * Create the shared queue
+   * Create the shared queue, or one queue per consumer
    */
-  fifo = queueInit ();
-  if (fifo ==  NULL) {
-    fprintf (stderr, "main: Queue Init failed.\n");
-    exit (1);
+  switch (mode) {
+  case QUEUE_RING:
+    if (queue_size < 2) {
+      fprintf (stderr, "The ring queue needs at least two slots.\n");
+      exit (1);
+    }
+    name    = "ring";
+    produce = producer_ring;
+    consume = consumer_ring;
+    batch   = 1;
+    rfifo   = ringInit (queue_size);
+    if (rfifo == NULL) {
+      fprintf (stderr, "main: Queue Init failed.\n");
+      exit (1);
+    }
+    break;
+
+  case QUEUE_SHARD:
+    if (cons < 1) {
+      fprintf (stderr, "The shard queue needs at least one consumer.\n");
+      exit (1);
+    }
+    name    = policy == SHARD_ROUND_ROBIN ? "shard-rr" : "shard-least";
+    produce = producer_shard;
+    consume = consumer_shard;
+    batch   = 1;
+    nshards = cons;
+    shards  = (queue **) malloc (sizeof (queue *) * cons);
+    if (shards == NULL) {
+      fprintf (stderr, "main: Queue Init failed.\n");
+      exit (1);
+    }
+    for (i = 0; i < nshards; i++) {
+      shards[i] = queueInit (queue_size);
+      if (shards[i] == NULL) {
+        fprintf (stderr, "main: Queue Init failed.\n");
+        exit (1);
+      }
+    }
+    break;
+
+  default:
+    name    = "sem";
+    produce = producer;
+    consume = consumer;
+    fifo    = queueInit (queue_size);
+    if (fifo == NULL) {
+      fprintf (stderr, "main: Queue Init failed.\n");
+      exit (1);
+    }
+    break;
   }
 
   /*
@@ -434,14 +1332,14 @@ int main (int argc, char *argv[])
    * among all producers, and one to track how many items were
    * consumed, shared among all consumers.
    */
-  procount = (int *) malloc (sizeof (int));
+  procount = (int *) layoutAlloc (sizeof (int));
   if (procount == NULL) { 
     fprintf(stderr, "procount allocation failed\n"); 
     exit(1); 
   }
   *procount=0;
   
-  concount = (int *) malloc (sizeof (int));
+  concount = (int *) layoutAlloc (sizeof (int));
   if (concount == NULL) { 
     fprintf(stderr, "concount allocation failed\n"); 
     exit(1); 
@@ -464,6 +1362,28 @@ int main (int argc, char *argv[])
     exit(1); 
   }
 
+  /*
+   * Keep each thread's arguments so that the time it spent blocked
+   * can be collected after it exits
+   */
+  pro_args = (pcdata **) malloc (sizeof (pcdata *) * pros);
+  con_args = (pcdata **) malloc (sizeof (pcdata *) * cons);
+  if (pro_args == NULL || con_args == NULL) {
+    fprintf(stderr, "thread args\n");
+    exit(1);
+  }
+
+  if (bench) {
+    enqueue_ns = (unsigned long long *) malloc (sizeof (unsigned long long) * work_max);
+    latency_ns = (unsigned long long *) malloc (sizeof (unsigned long long) * work_max);
+    if (enqueue_ns == NULL || latency_ns == NULL) {
+      fprintf(stderr, "latency arrays\n");
+      exit(1);
+    }
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
   /*
    * Create the specified number of producers
    */
@@ -471,7 +1391,7 @@ int main (int argc, char *argv[])
     /*
      * Allocate memory for each producer's arguments
      */
-    thread_args = (pcdata *)malloc (sizeof (pcdata));
+    thread_args = (pcdata *)layoutAlloc (sizeof (pcdata));
     if (thread_args == NULL) {
       fprintf (stderr, "main: Thread_Args Init failed.\n");
       exit (1);
@@ -481,9 +1401,14 @@ int main (int argc, char *argv[])
      * Fill them in and then create the producer thread
      */
     thread_args->q     = fifo;
+    thread_args->r     = rfifo;
     thread_args->count = procount;
     thread_args->tid   = i;
-    pthread_create (&pro[i], NULL, producer, thread_args);
+    thread_args->blocked_ns = 0;
+    thread_args->steals = 0;
+    thread_args->items  = 0;
+    pro_args[i] = thread_args;
+    pthread_create (&pro[i], NULL, produce, thread_args);
   }
 
   /*
@@ -493,7 +1418,7 @@ int main (int argc, char *argv[])
     /*
      * Allocate space for next consumer's args
      */
-    thread_args = (pcdata *)malloc (sizeof (pcdata));
+    thread_args = (pcdata *)layoutAlloc (sizeof (pcdata));
     if (thread_args == NULL) {
       fprintf (stderr, "main: Thread_Args Init failed.\n");
       exit (1);
@@ -503,9 +1428,14 @@ int main (int argc, char *argv[])
      * Fill them in and create the thread
      */
     thread_args->q     = fifo;
+    thread_args->r     = rfifo;
     thread_args->count = concount;
     thread_args->tid   = i;
-    pthread_create (&con[i], NULL, consumer, thread_args);
+    thread_args->blocked_ns = 0;
+    thread_args->steals = 0;
+    thread_args->items  = 0;
+    con_args[i] = thread_args;
+    pthread_create (&con[i], NULL, consume, thread_args);
   }
 
   /*
@@ -519,12 +1449,110 @@ int main (int argc, char *argv[])
   for (i=0; i<cons; i++)
     pthread_join (con[i], NULL);
 
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  if (!bench) {
+    /*
+     * Report the throughput on stderr, which keeps the narrative on
+     * stdout unchanged.
+     */
+    fprintf (stderr, "%s queue (batch %d): %d items, %d producers, %d consumers in %.3f s (%.0f items/s)\n",
+             name, batch, work_max, pros, cons, elapsed, work_max / elapsed);
+  } else {
+    unsigned long long put_blocked = 0, get_blocked = 0;
+    double p50, p90, p99, p999, max;
+    int steals = 0;
+    int produced = 0, pro_min = work_max, pro_max = 0;
+    int consumed = 0, con_min = work_max, con_max = 0;
+
+    /*
+     * Add up what each thread counted on its own
+     */
+    for (i=0; i<pros; i++) {
+      put_blocked += pro_args[i]->blocked_ns;
+      produced    += pro_args[i]->items;
+      pro_min      = pro_args[i]->items < pro_min ? pro_args[i]->items : pro_min;
+      pro_max      = pro_args[i]->items > pro_max ? pro_args[i]->items : pro_max;
+    }
+    for (i=0; i<cons; i++) {
+      get_blocked += con_args[i]->blocked_ns;
+      steals      += con_args[i]->steals;
+      consumed    += con_args[i]->items;
+      con_min      = con_args[i]->items < con_min ? con_args[i]->items : con_min;
+      con_max      = con_args[i]->items > con_max ? con_args[i]->items : con_max;
+    }
+    if (produced != work_max || consumed != work_max)
+      fprintf (stderr, "main: %d items produced and %d consumed, expected %d\n",
+               produced, consumed, work_max);
+
+    qsort (latency_ns, work_max, sizeof (unsigned long long), compare_ull);
+    p50  = percentile_us (latency_ns, work_max, 50);
+    p90  = percentile_us (latency_ns, work_max, 90);
+    p99  = percentile_us (latency_ns, work_max, 99);
+    p999 = percentile_us (latency_ns, work_max, 99.9);
+    max  = latency_ns[work_max - 1] / 1e3;
+
+    printf("%s queue (%s), %d slots, batch %d: %d producers (work %d,%d), %d consumers (work %d,%d)\n",
+           name, padded ? "padded" : "packed", queue_size, batch, pros, producer_cpu, producer_block, cons, consumer_cpu, consumer_block);
+    printf("  %d items in %.3f s: %.0f items/s\n", work_max, elapsed, work_max / elapsed);
+    printf("  items per producer %d-%d, per consumer %d-%d\n", pro_min, pro_max, con_min, con_max);
+    printf("  latency (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           p50, p90, p99, p999, max);
+    printf("  blocked (ms, summed over threads): producers on slotsToPut %.1f, consumers on slotsToGet %.1f\n",
+           put_blocked / 1e6, get_blocked / 1e6);
+    if (mode == QUEUE_SHARD)
+      printf("  steals: %d (%.1f%% of items)\n", steals, 100.0 * steals / work_max);
+
+    /*
+     * Append a row for sweeps, starting the file with a header
+     */
+    if (csv != NULL) {
+      FILE *out = fopen (csv, "a");
+      if (out == NULL) {
+        fprintf (stderr, "Unable to open \"%s\".\n", csv);
+        exit (1);
+      }
+      if (ftell (out) == 0)
+        fprintf (out, "queue,producers,consumers,queue_size,batch,items,"
+                 "producer_cpu,producer_block,consumer_cpu,consumer_block,"
+                 "seconds,items_per_sec,lat_p50_us,lat_p90_us,lat_p99_us,lat_p999_us,lat_max_us,"
+                 "put_blocked_ms,get_blocked_ms,steals,layout\n");
+      fprintf (out, "%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.6f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f,%.3f,%d,%s\n",
+               name, pros, cons, queue_size, batch, work_max,
+               producer_cpu, producer_block, consumer_cpu, consumer_block,
+               elapsed, work_max / elapsed, p50, p90, p99, p999, max,
+               put_blocked / 1e6, get_blocked / 1e6, steals,
+               padded ? "padded" : "packed");
+      fclose (out);
+    }
+
+    free (enqueue_ns);
+    free (latency_ns);
+  }
+
+  for (i=0; i<pros; i++)
+    free (pro_args[i]);
+  for (i=0; i<cons; i++)
+    free (con_args[i]);
+  free (pro_args);
+  free (con_args);
+
   /*
    * Delete the shared fifo, now that we know there are no users of
    * it. Since we are about to exit we could skip this step, but we
    * put it here for neatness' sake.
    */
-  queueDelete (fifo);
+  if (mode == QUEUE_RING)
+    ringDelete (rfifo);
+  else if (mode == QUEUE_SHARD) {
+    for (i = 0; i < nshards; i++)
+      queueDelete (shards[i]);
+    free (shards);
+  }
+  else
+    queueDelete (fifo);
 
   return 0;
 }
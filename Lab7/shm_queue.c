@@ -0,0 +1,905 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+
+/*
+ * The bounded producer/consumer queue of producer_consumer.c, shared
+ * between two processes instead of two threads. Where Lab4's
+ * shared_memory3.c gets an anonymous SysV segment with shmget(), this
+ * uses a named POSIX segment (shm_open() and mmap()), so the producer
+ * and consumer can be unrelated processes as well as a parent and its
+ * forked child.
+ *
+ * The queue holds fixed-size records. A producer reserves the next
+ * free record, writes it where it lies in the shared segment and
+ * commits it; the consumer peeks at it in place and releases it. No
+ * record is copied on its way through, unlike a pipe, which copies
+ * every byte into the kernel and back out. -m pipe runs the same
+ * workload over a pipe for comparison.
+ *
+ * -m bytes replaces the record slots with a byte ring that carries
+ * messages of any size up to the ring's capacity, still written and
+ * read in place.
+ */
+#define SLOTS     64
+#define RECORDS   1000000
+#define RECORD    64
+#define SHM_NAME  "/producer_consumer"
+#define RING_BYTES (1 << 20)
+
+#define CACHE_LINE 64
+
+/*
+ * Every record starts with this header; the rest is payload
+ */
+typedef struct {
+  uint64_t seq;       /* record number, checked by the consumer */
+  uint64_t sent_ns;   /* CLOCK_MONOTONIC when the producer committed it */
+} record_header;
+
+/*****************************************************
+ *   Shared Queue Related Structures and Routines    *
+ *****************************************************/
+
+/*
+ * The whole queue lives in the shared segment. There is one producer
+ * and one consumer, so the semaphores alone order the updates of head
+ * and tail and no mutex is needed. The semaphores are process-shared.
+ */
+typedef struct {
+  sem_t  slotsToPut;          /* Used by the producer to await room to produce */
+  sem_t  slotsToGet;          /* Used by the consumer to await something to consume */
+  size_t slots;               /* Number of records */
+  size_t record_size;         /* Bytes per record, header included */
+  volatile int ready;         /* Set once the producer has initialized the queue */
+
+  _Alignas(CACHE_LINE) size_t tail;   /* Next record to produce, producer only */
+  _Alignas(CACHE_LINE) size_t head;   /* Next record to consume, consumer only */
+
+  _Alignas(CACHE_LINE) char records[];
+} shmQueue;
+
+static size_t shmQueueBytes (size_t slots, size_t record_size)
+{
+  return sizeof (shmQueue) + slots * record_size;
+}
+
+/*
+ * Create the queue in the named shared memory segment, replacing any
+ * left over from an earlier run.
+ */
+shmQueue *shmQueueCreate (const char *name, size_t slots, size_t record_size)
+{
+  size_t    bytes = shmQueueBytes (slots, record_size);
+  shmQueue *q;
+  int       fd;
+
+  shm_unlink (name);
+  fd = shm_open (name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    return (NULL);
+  if (ftruncate (fd, bytes) == -1) {
+    close (fd);
+    return (NULL);
+  }
+
+  q = (shmQueue *) mmap (NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (q == MAP_FAILED)
+    return (NULL);
+
+  q->slots       = slots;
+  q->record_size = record_size;
+  q->head        = 0;
+  q->tail        = 0;
+  sem_init (&q->slotsToPut, 1, slots);
+  sem_init (&q->slotsToGet, 1, 0);
+
+  __atomic_store_n (&q->ready, 1, __ATOMIC_RELEASE);
+
+  return (q);
+}
+
+/*
+ * Map a segment created by another process, waiting for the producer
+ * to create and size it.
+ */
+static void *shmAttach (const char *name)
+{
+  struct stat st;
+  void       *seg;
+  int         fd;
+
+  while ((fd = shm_open (name, O_RDWR, 0)) == -1) {
+    if (errno != ENOENT)
+      return (NULL);
+    usleep (1000);
+  }
+
+  /*
+   * The producer sizes the segment right after creating it
+   */
+  do {
+    if (fstat (fd, &st) == -1) {
+      close (fd);
+      return (NULL);
+    }
+  } while (st.st_size == 0 && usleep (1000) == 0);
+
+  seg = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+
+  return seg == MAP_FAILED ? NULL : seg;
+}
+
+/*
+ * Attach to a queue created by another process, waiting for the
+ * producer to initialize it.
+ */
+shmQueue *shmQueueOpen (const char *name)
+{
+  shmQueue *q = (shmQueue *) shmAttach (name);
+
+  if (q == NULL)
+    return (NULL);
+  while (!__atomic_load_n (&q->ready, __ATOMIC_ACQUIRE))
+    usleep (1000);
+
+  return (q);
+}
+
+void shmQueueClose (shmQueue *q)
+{
+  munmap (q, shmQueueBytes (q->slots, q->record_size));
+}
+
+/*
+ * Wait for a free record and return where to write it
+ */
+void *shmReserve (shmQueue *q)
+{
+  while (sem_wait (&q->slotsToPut) == -1 && errno == EINTR)
+    continue;
+  return q->records + (q->tail % q->slots) * q->record_size;
+}
+
+/*
+ * Hand the reserved record to the consumer
+ */
+void shmCommit (shmQueue *q)
+{
+  q->tail++;
+  sem_post (&q->slotsToGet);
+}
+
+/*
+ * Wait for the next record and return where to read it
+ */
+const void *shmPeek (shmQueue *q)
+{
+  while (sem_wait (&q->slotsToGet) == -1 && errno == EINTR)
+    continue;
+  return q->records + (q->head % q->slots) * q->record_size;
+}
+
+/*
+ * Give the record just read back to the producer
+ */
+void shmRelease (shmQueue *q)
+{
+  q->head++;
+  sem_post (&q->slotsToPut);
+}
+
+/*****************************************************
+ *   Byte Ring                                       *
+ *****************************************************/
+
+/*
+ * A single-producer, single-consumer ring of variable-size messages.
+ * head and tail count bytes ever consumed and produced, so the bytes
+ * in use are tail - head. Each message is a header holding its length
+ * followed by the payload, padded to 8 bytes. A message never wraps:
+ * when it does not fit before the end of the ring, the producer writes
+ * a BYTE_RING_WRAP header there and puts the message at the start.
+ * The padding is shorter than the message, so any message of up to half
+ * the capacity, padding included, always fits once the ring drains.
+ *
+ * The waiting side sleeps on a futex word that the other side bumps
+ * when it publishes, as in producer_consumer.c's ring, but without
+ * FUTEX_PRIVATE_FLAG since the ring is shared between processes.
+ */
+#define BYTE_RING_WRAP UINT32_MAX
+
+typedef struct {
+  uint32_t len;       /* payload bytes, or BYTE_RING_WRAP */
+  uint32_t unused;
+} byteRingHeader;
+
+typedef struct {
+  size_t       capacity;        /* bytes in data, a multiple of 8 */
+  volatile int ready;           /* Set once the producer has initialized the ring */
+
+  _Alignas(CACHE_LINE) atomic_ulong tail;   /* published by commit */
+  atomic_uint  produced;                    /* futex word bumped by commit */
+  atomic_int   emptyWaiters;
+  size_t       skip;                        /* producer only: wrap padding before the open reservation */
+
+  _Alignas(CACHE_LINE) atomic_ulong head;   /* published by release */
+  atomic_uint  consumed;                    /* futex word bumped by release */
+  atomic_int   fullWaiters;
+  size_t       peeked;                      /* consumer only: bytes held by the peeked message */
+
+  _Alignas(CACHE_LINE) char data[];
+} byteRing;
+
+static size_t align8 (size_t n)
+{
+  return (n + 7) & ~(size_t) 7;
+}
+
+static void shared_futex_wait (atomic_uint *word, unsigned int seen)
+{
+  syscall (SYS_futex, word, FUTEX_WAIT, seen, NULL, NULL, 0);
+}
+
+static void shared_futex_wake (atomic_uint *word, atomic_int *waiters)
+{
+  /*
+   * Pairs with the waiter raising waiters before it re-checks the
+   * ring: either we see the waiter, or it sees our update.
+   */
+  atomic_fetch_add (word, 1);
+  atomic_thread_fence (memory_order_seq_cst);
+  if (atomic_load_explicit (waiters, memory_order_relaxed) > 0)
+    syscall (SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/*
+ * Create the byte ring in the named shared memory segment
+ */
+byteRing *byteRingCreate (const char *name, size_t capacity)
+{
+  size_t    bytes;
+  byteRing *r;
+  int       fd;
+
+  capacity = align8 (capacity);
+  bytes    = sizeof (byteRing) + capacity;
+
+  shm_unlink (name);
+  fd = shm_open (name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    return (NULL);
+  if (ftruncate (fd, bytes) == -1) {
+    close (fd);
+    return (NULL);
+  }
+
+  r = (byteRing *) mmap (NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (r == MAP_FAILED)
+    return (NULL);
+
+  r->capacity = capacity;
+  atomic_init (&r->tail, 0);
+  atomic_init (&r->head, 0);
+  atomic_init (&r->produced, 0);
+  atomic_init (&r->consumed, 0);
+  atomic_init (&r->emptyWaiters, 0);
+  atomic_init (&r->fullWaiters, 0);
+  r->skip   = 0;
+  r->peeked = 0;
+
+  __atomic_store_n (&r->ready, 1, __ATOMIC_RELEASE);
+
+  return (r);
+}
+
+/*
+ * Attach to a ring created by another process
+ */
+byteRing *byteRingOpen (const char *name)
+{
+  byteRing *r = (byteRing *) shmAttach (name);
+
+  if (r == NULL)
+    return (NULL);
+  while (!__atomic_load_n (&r->ready, __ATOMIC_ACQUIRE))
+    usleep (1000);
+
+  return (r);
+}
+
+void byteRingClose (byteRing *r)
+{
+  munmap (r, sizeof (byteRing) + r->capacity);
+}
+
+/*
+ * Wait for room for a message of up to len bytes and return where to
+ * write its payload. Returns NULL if the message is over half the
+ * ring.
+ */
+void *byteReserve (byteRing *r, size_t len)
+{
+  size_t   need = sizeof (byteRingHeader) + align8 (len);
+  uint64_t tail = atomic_load_explicit (&r->tail, memory_order_relaxed);
+  size_t   pos  = tail % r->capacity;
+  size_t   skip = r->capacity - pos < need ? r->capacity - pos : 0;
+  unsigned int seen;
+
+  if (2 * need > r->capacity)
+    return (NULL);
+
+  /*
+   * Wait until the consumer has freed the wrap padding and the message
+   */
+  while (r->capacity - (tail - atomic_load_explicit (&r->head, memory_order_acquire)) < skip + need) {
+    seen = atomic_load (&r->consumed);
+    atomic_fetch_add (&r->fullWaiters, 1);
+    if (r->capacity - (tail - atomic_load (&r->head)) < skip + need)
+      shared_futex_wait (&r->consumed, seen);
+    atomic_fetch_sub (&r->fullWaiters, 1);
+  }
+
+  if (skip > 0) {
+    ((byteRingHeader *) (r->data + pos))->len = BYTE_RING_WRAP;
+    pos = 0;
+  }
+  r->skip = skip;
+
+  return r->data + pos + sizeof (byteRingHeader);
+}
+
+/*
+ * Publish the reserved message, which may be shorter than reserved
+ */
+void byteCommit (byteRing *r, size_t len)
+{
+  uint64_t tail = atomic_load_explicit (&r->tail, memory_order_relaxed);
+  size_t   need = sizeof (byteRingHeader) + align8 (len);
+  size_t   pos  = r->skip > 0 ? 0 : tail % r->capacity;
+
+  ((byteRingHeader *) (r->data + pos))->len = len;
+
+  atomic_store_explicit (&r->tail, tail + r->skip + need, memory_order_release);
+  r->skip = 0;
+  shared_futex_wake (&r->produced, &r->emptyWaiters);
+}
+
+/*
+ * Wait for the next message and return where its payload is, with its
+ * length in *len
+ */
+const void *bytePeek (byteRing *r, size_t *len)
+{
+  uint64_t head = atomic_load_explicit (&r->head, memory_order_relaxed);
+  size_t   pos  = head % r->capacity;
+  size_t   skip = 0;
+  byteRingHeader *h;
+  unsigned int seen;
+
+  while (atomic_load_explicit (&r->tail, memory_order_acquire) == head) {
+    seen = atomic_load (&r->produced);
+    atomic_fetch_add (&r->emptyWaiters, 1);
+    if (atomic_load (&r->tail) == head)
+      shared_futex_wait (&r->produced, seen);
+    atomic_fetch_sub (&r->emptyWaiters, 1);
+  }
+
+  h = (byteRingHeader *) (r->data + pos);
+  if (h->len == BYTE_RING_WRAP) {
+    skip = r->capacity - pos;
+    h    = (byteRingHeader *) r->data;
+  }
+
+  *len      = h->len;
+  r->peeked = skip + sizeof (byteRingHeader) + align8 (h->len);
+
+  return h + 1;
+}
+
+/*
+ * Give the peeked message's bytes back to the producer
+ */
+void byteRelease (byteRing *r)
+{
+  uint64_t head = atomic_load_explicit (&r->head, memory_order_relaxed);
+
+  atomic_store_explicit (&r->head, head + r->peeked, memory_order_release);
+  r->peeked = 0;
+  shared_futex_wake (&r->consumed, &r->fullWaiters);
+}
+
+/***************************************************
+ *   Producer and Consumer                         *
+ ***************************************************/
+
+static inline uint64_t now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Run configuration, set from the command line
+ */
+typedef enum { TRANSPORT_SHM, TRANSPORT_BYTES, TRANSPORT_PIPE } transport;
+
+transport   via = TRANSPORT_SHM;
+long        records = RECORDS;
+size_t      slots = SLOTS;
+size_t      record_size = RECORD;
+size_t      ring_bytes = 0;     /* byte ring capacity, 0 for the default */
+int         variable = 0;       /* byte ring: vary message sizes up to record_size */
+const char *shm_name = SHM_NAME;
+const char *csv = NULL;
+
+/*
+ * Size of message seq: record_size, or with -V anything from one
+ * payload byte up to record_size, picked by hashing seq so that the
+ * consumer can check it
+ */
+static size_t message_size (uint64_t seq)
+{
+  size_t payload = record_size - sizeof (record_header);
+
+  if (!variable)
+    return record_size;
+  return sizeof (record_header) + 1 + (size_t) ((seq * 2654435761u) >> 7) % payload;
+}
+
+/*
+ * Fill in a record: the header and a payload byte pattern that
+ * depends on the record number
+ */
+static void fill_record (void *rec, uint64_t seq, size_t size)
+{
+  record_header *h = (record_header *) rec;
+
+  memset ((char *) rec + sizeof (record_header), (int) (seq & 0xff),
+          size - sizeof (record_header));
+  h->seq     = seq;
+  h->sent_ns = now_ns ();
+}
+
+/*
+ * Check a record and return its latency. The first and last payload
+ * bytes are compared so that the payload is actually read.
+ */
+static uint64_t check_record (const void *rec, uint64_t seq, size_t size)
+{
+  const record_header *h = (const record_header *) rec;
+  const unsigned char *payload = (const unsigned char *) rec + sizeof (record_header);
+  size_t last = size - sizeof (record_header) - 1;
+
+  if (h->seq != seq || payload[0] != (seq & 0xff) || payload[last] != (seq & 0xff)) {
+    fprintf (stderr, "consumer: record %llu is corrupt\n", (unsigned long long) seq);
+    exit (1);
+  }
+  return now_ns () - h->sent_ns;
+}
+
+void produce_shm (shmQueue *q)
+{
+  long i;
+
+  for (i = 0; i < records; i++) {
+    fill_record (shmReserve (q), i, record_size);
+    shmCommit (q);
+  }
+}
+
+void consume_shm (shmQueue *q, uint64_t *latency)
+{
+  long i;
+
+  for (i = 0; i < records; i++) {
+    latency[i] = check_record (shmPeek (q), i, record_size);
+    shmRelease (q);
+  }
+}
+
+void produce_bytes (byteRing *r)
+{
+  size_t size;
+  long   i;
+
+  for (i = 0; i < records; i++) {
+    size = message_size (i);
+    fill_record (byteReserve (r, size), i, size);
+    byteCommit (r, size);
+  }
+}
+
+void consume_bytes (byteRing *r, uint64_t *latency)
+{
+  const void *msg;
+  size_t      len;
+  long        i;
+
+  for (i = 0; i < records; i++) {
+    msg = bytePeek (r, &len);
+    if (len != message_size (i)) {
+      fprintf (stderr, "consumer: message %ld is %zu bytes, expected %zu\n", i, len, message_size (i));
+      exit (1);
+    }
+    latency[i] = check_record (msg, i, len);
+    byteRelease (r);
+  }
+}
+
+/*
+ * The pipe baseline builds each record in a private buffer and
+ * copies it through the kernel
+ */
+static void pipe_io (int fd, char *buf, size_t len, int writing)
+{
+  ssize_t done;
+
+  while (len > 0) {
+    done = writing ? write (fd, buf, len) : read (fd, buf, len);
+    if (done <= 0) {
+      if (done == -1 && errno == EINTR)
+        continue;
+      perror (writing ? "write" : "read");
+      exit (1);
+    }
+    buf += done;
+    len -= done;
+  }
+}
+
+void produce_pipe (int fd)
+{
+  char *buf = (char *) malloc (record_size);
+  long  i;
+
+  for (i = 0; i < records; i++) {
+    fill_record (buf, i, record_size);
+    pipe_io (fd, buf, record_size, 1);
+  }
+  free (buf);
+}
+
+void consume_pipe (int fd, uint64_t *latency)
+{
+  char *buf = (char *) malloc (record_size);
+  long  i;
+
+  for (i = 0; i < records; i++) {
+    pipe_io (fd, buf, record_size, 0);
+    latency[i] = check_record (buf, i, record_size);
+  }
+  free (buf);
+}
+
+/***************************************************
+ *   Reporting                                     *
+ ***************************************************/
+
+static int compare_u64 (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static double percentile_us (const uint64_t *sorted, long count, double pct)
+{
+  long index = (long) (pct / 100.0 * count);
+
+  if (index >= count)
+    index = count - 1;
+  return sorted[index] / 1e3;
+}
+
+/*
+ * Called by the consumer once every record has arrived
+ */
+void report (uint64_t *latency, double elapsed)
+{
+  const char *names[] = { "shm", "bytes", "pipe" };
+  const char *name = names[via];
+  double bytes = 0, p50, p99, max;
+  long   i;
+
+  for (i = 0; i < records; i++)
+    bytes += message_size (i);
+
+  qsort (latency, records, sizeof (uint64_t), compare_u64);
+  p50 = percentile_us (latency, records, 50);
+  p99 = percentile_us (latency, records, 99);
+  max = latency[records - 1] / 1e3;
+
+  if (via == TRANSPORT_BYTES)
+    printf("%s: %ld messages of %s%zu bytes, %zu byte ring\n", name, records,
+           variable ? "up to " : "", record_size, ring_bytes);
+  else
+    printf("%s: %ld records of %zu bytes, %zu slots\n", name, records, record_size, slots);
+  printf("  %.3f s: %.0f records/s, %.1f MB/s\n", elapsed, records / elapsed, bytes / elapsed / 1e6);
+  printf("  latency (us): p50 %.1f  p99 %.1f  max %.1f\n", p50, p99, max);
+
+  if (csv != NULL) {
+    FILE *out = fopen (csv, "a");
+    if (out == NULL) {
+      fprintf (stderr, "Unable to open \"%s\".\n", csv);
+      exit (1);
+    }
+    if (ftell (out) == 0)
+      fprintf (out, "transport,records,record_bytes,variable,slots,ring_bytes,seconds,records_per_sec,"
+               "mb_per_sec,lat_p50_us,lat_p99_us,lat_max_us\n");
+    fprintf (out, "%s,%ld,%zu,%d,%zu,%zu,%.6f,%.0f,%.1f,%.1f,%.1f,%.1f\n",
+             name, records, record_size, variable,
+             via == TRANSPORT_BYTES ? 0 : slots, via == TRANSPORT_BYTES ? ring_bytes : 0,
+             elapsed, records / elapsed, bytes / elapsed / 1e6, p50, p99, max);
+    fclose (out);
+  }
+}
+
+/***************************************************
+ *   Main                                          *
+ ***************************************************/
+
+static void usage (void)
+{
+  printf("Usage: ./shm_queue [-m shm|bytes|pipe] [-R both|producer|consumer] [-N name]\n");
+  printf("                   [-n records] [-r record_bytes] [-s slots] [-b ring_bytes] [-V]\n");
+  printf("                   [-o file.csv]\n");
+  printf("  -m  move the records through shared memory record slots (shm, default), a\n");
+  printf("      shared memory byte ring (bytes) or a pipe (pipe)\n");
+  printf("  -R  fork a consumer (both, default), or run one side against a separately\n");
+  printf("      started other side (shm and bytes only)\n");
+  printf("  -N  shared memory object name (default %s)\n", SHM_NAME);
+  printf("  -n  records to move (default %d)\n", RECORDS);
+  printf("  -r  bytes per record, at least %zu (default %d)\n", sizeof (record_header) + 1, RECORD);
+  printf("  -s  queue slots (default %d)\n", SLOTS);
+  printf("  -b  byte ring capacity, at least two records (default %d, or 16 records if larger)\n", RING_BYTES);
+  printf("  -V  byte ring: messages of varying size up to the record size\n");
+  printf("  -o  append the results as a CSV row to this file\n");
+  exit (0);
+}
+
+int main (int argc, char *argv[])
+{
+  const char *role = "both";
+  shmQueue   *q = NULL;
+  byteRing   *r = NULL;
+  uint64_t   *latency;
+  uint64_t    start;
+  int         fds[2];
+  int         c, status;
+  pid_t       pid;
+
+  while ((c = getopt (argc, argv, "m:R:N:n:r:s:b:Vo:")) != -1) {
+    switch (c) {
+    case 'm':
+      if (strcmp (optarg, "shm") == 0)
+        via = TRANSPORT_SHM;
+      else if (strcmp (optarg, "bytes") == 0)
+        via = TRANSPORT_BYTES;
+      else if (strcmp (optarg, "pipe") == 0)
+        via = TRANSPORT_PIPE;
+      else {
+        fprintf (stderr, "Unknown transport \"%s\", use shm, bytes or pipe.\n", optarg);
+        exit (1);
+      }
+      break;
+
+    case 'R':
+      role = optarg;
+      break;
+
+    case 'N':
+      shm_name = optarg;
+      break;
+
+    case 'n':
+      records = atol (optarg);
+      break;
+
+    case 'r':
+      record_size = strtoul (optarg, NULL, 10);
+      break;
+
+    case 's':
+      slots = strtoul (optarg, NULL, 10);
+      break;
+
+    case 'b':
+      ring_bytes = strtoul (optarg, NULL, 10);
+      break;
+
+    case 'V':
+      variable = 1;
+      break;
+
+    case 'o':
+      csv = optarg;
+      break;
+
+    default:
+      usage ();
+    }
+  }
+
+  if (optind != argc)
+    usage ();
+  if (records < 1 || slots < 1 || record_size <= sizeof (record_header)) {
+    fprintf (stderr, "Need at least one record and slot, and records over %zu bytes.\n",
+             sizeof (record_header));
+    exit (1);
+  }
+
+  /*
+   * Keep records 8-byte aligned in the shared segment
+   */
+  record_size = (record_size + 7) & ~(size_t) 7;
+
+  if (variable && via != TRANSPORT_BYTES) {
+    fprintf (stderr, "Only the byte ring carries messages of varying size.\n");
+    exit (1);
+  }
+  if (ring_bytes == 0) {
+    ring_bytes = 16 * (sizeof (byteRingHeader) + record_size);
+    if (ring_bytes < RING_BYTES)
+      ring_bytes = RING_BYTES;
+  }
+  ring_bytes = align8 (ring_bytes);
+  if (2 * (sizeof (byteRingHeader) + record_size) > ring_bytes) {
+    fprintf (stderr, "A %zu byte ring holds records of up to half its size, not %zu bytes.\n",
+             ring_bytes, record_size);
+    exit (1);
+  }
+
+  if (strcmp (role, "both") != 0 && via == TRANSPORT_PIPE) {
+    fprintf (stderr, "The pipe baseline always forks its consumer.\n");
+    exit (1);
+  }
+
+  /*
+   * One side only, with the other side started separately
+   */
+  if (strcmp (role, "producer") == 0) {
+    if (via == TRANSPORT_BYTES) {
+      r = byteRingCreate (shm_name, ring_bytes);
+      if (r == NULL) {
+        perror ("shm_queue: producer");
+        exit (1);
+      }
+      produce_bytes (r);
+      byteRingClose (r);
+      return 0;
+    }
+
+    q = shmQueueCreate (shm_name, slots, record_size);
+    if (q == NULL) {
+      perror ("shm_queue: producer");
+      exit (1);
+    }
+    produce_shm (q);
+    shmQueueClose (q);
+    return 0;
+  }
+
+  latency = (uint64_t *) malloc (sizeof (uint64_t) * records);
+  if (latency == NULL) {
+    fprintf (stderr, "latency array\n");
+    exit (1);
+  }
+
+  if (strcmp (role, "consumer") == 0) {
+    if (via == TRANSPORT_BYTES) {
+      r = byteRingOpen (shm_name);
+      if (r == NULL) {
+        perror ("shm_queue: consumer");
+        exit (1);
+      }
+      ring_bytes = r->capacity;
+      start = now_ns ();
+      consume_bytes (r, latency);
+      report (latency, (now_ns () - start) / 1e9);
+      byteRingClose (r);
+      shm_unlink (shm_name);
+      return 0;
+    }
+
+    q = shmQueueOpen (shm_name);
+    if (q == NULL) {
+      perror ("shm_queue: consumer");
+      exit (1);
+    }
+    slots       = q->slots;
+    record_size = q->record_size;
+    start = now_ns ();
+    consume_shm (q, latency);
+    report (latency, (now_ns () - start) / 1e9);
+    shmQueueClose (q);
+    shm_unlink (shm_name);
+    return 0;
+  }
+
+  if (strcmp (role, "both") != 0)
+    usage ();
+
+  /*
+   * Set up the queue, ring or pipe, then fork the consumer. The
+   * parent produces.
+   */
+  if (via == TRANSPORT_SHM) {
+    q = shmQueueCreate (shm_name, slots, record_size);
+    if (q == NULL) {
+      perror ("shm_queue");
+      exit (1);
+    }
+  }
+  else if (via == TRANSPORT_BYTES) {
+    r = byteRingCreate (shm_name, ring_bytes);
+    if (r == NULL) {
+      perror ("shm_queue");
+      exit (1);
+    }
+  }
+  else if (pipe (fds) == -1) {
+    perror ("pipe");
+    exit (1);
+  }
+
+  start = now_ns ();
+  if ((pid = fork ()) == -1) {
+    fprintf (stderr, "Error in fork\n");
+    exit (1);
+  }
+  else if (pid == 0) {
+    /* child process: consume */
+    if (via == TRANSPORT_SHM)
+      consume_shm (q, latency);
+    else if (via == TRANSPORT_BYTES)
+      consume_bytes (r, latency);
+    else {
+      close (fds[1]);
+      consume_pipe (fds[0], latency);
+    }
+    report (latency, (now_ns () - start) / 1e9);
+    exit (0);
+  }
+
+  /* parent process: produce, then wait for the consumer to finish */
+  if (via == TRANSPORT_SHM)
+    produce_shm (q);
+  else if (via == TRANSPORT_BYTES)
+    produce_bytes (r);
+  else {
+    close (fds[0]);
+    produce_pipe (fds[1]);
+    close (fds[1]);
+  }
+  waitpid (pid, &status, 0);
+
+  if (via == TRANSPORT_SHM) {
+    shmQueueClose (q);
+    shm_unlink (shm_name);
+  }
+  else if (via == TRANSPORT_BYTES) {
+    byteRingClose (r);
+    shm_unlink (shm_name);
+  }
+  free (latency);
+
+  return WIFEXITED (status) ? WEXITSTATUS (status) : 1;
+}
@@ -0,0 +1,107 @@
+/** @file decisioncmp.c
+ *
+ * Compares two decision logs written by "simulator -D" and reports the
+ * first scheduling decision on which they diverge. Both logs are
+ * streamed, so arbitrarily long runs can be checked in constant memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE 256
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s <expected decision log> <actual decision log>\n", program_name);
+	fprintf(stderr, "       %s ref/proc1-c2-rr2.log out/proc1-c2-rr2.log\n", program_name);
+}
+
+/*
+ * Read the next decision line (skipping the "#" trailer). Returns 1 if a
+ * line was read and 0 at the end of the log. The trailer, if any, is
+ * copied into trailer.
+ */
+int next_decision(FILE *log, char *line, char *trailer)
+{
+	while (fgets(line, MAX_LINE, log) != NULL)
+	{
+		if (line[0] == '#')
+		{
+			strcpy(trailer, line);
+			continue;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	FILE *expected = fopen(argv[1], "r");
+	if (expected == NULL)
+	{
+		fprintf(stderr, "Unable to open file \"%s\".\n", argv[1]);
+		return 2;
+	}
+
+	FILE *actual = fopen(argv[2], "r");
+	if (actual == NULL)
+	{
+		fprintf(stderr, "Unable to open file \"%s\".\n", argv[2]);
+		fclose(expected);
+		return 2;
+	}
+
+	char expected_line[MAX_LINE], actual_line[MAX_LINE];
+	char expected_trailer[MAX_LINE] = "", actual_trailer[MAX_LINE] = "";
+	long decision = 0;
+	int status = 0;
+
+	for (;;)
+	{
+		int have_expected = next_decision(expected, expected_line, expected_trailer);
+		int have_actual = next_decision(actual, actual_line, actual_trailer);
+
+		if (!have_expected && !have_actual)
+			break;
+
+		decision++;
+
+		if (have_expected != have_actual || strcmp(expected_line, actual_line) != 0)
+		{
+			printf("Decision %ld differs (time event core job):\n", decision);
+			printf("  expected: %s", have_expected ? expected_line : "<end of log>\n");
+			printf("  actual:   %s", have_actual ? actual_line : "<end of log>\n");
+			status = 1;
+			break;
+		}
+	}
+
+	/*
+	 * The logs agree line by line; make sure neither was cut short by a
+	 * run that failed part way (the trailer is written last).
+	 */
+	if (status == 0 && strcmp(expected_trailer, actual_trailer) != 0)
+	{
+		printf("Trailers differ:\n");
+		printf("  expected: %s", expected_trailer[0] ? expected_trailer : "<missing>\n");
+		printf("  actual:   %s", actual_trailer[0] ? actual_trailer : "<missing>\n");
+		status = 1;
+	}
+
+	if (status == 0)
+		printf("Identical: %ld decision(s). %s", decision, expected_trailer[0] ? expected_trailer : "\n");
+
+	fclose(expected);
+	fclose(actual);
+
+	return status;
+}
@@ -0,0 +1,135 @@
+/** @file libhistogram.c
+ */
+
+#include <string.h>
+
+#include "libhistogram.h"
+
+// Bucket helper methods
+
+int histogram_bucket(int64_t value) {
+  if (value < HISTOGRAM_SUB_COUNT) return value < 0 ? 0 : (int)value;
+
+  // position of the leading one bit, at least HISTOGRAM_SUB_BITS here
+  const int msb = 63 - __builtin_clzll((uint64_t)value);
+  const int sub = (int)(value >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1);
+
+  return HISTOGRAM_SUB_COUNT + (msb - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT + sub;
+}
+
+int64_t histogram_bucket_low(int bucket) {
+  if (bucket < HISTOGRAM_SUB_COUNT) return bucket;
+
+  const int msb = (bucket - HISTOGRAM_SUB_COUNT) / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS;
+  const int64_t sub = (bucket - HISTOGRAM_SUB_COUNT) % HISTOGRAM_SUB_COUNT;
+
+  return ((int64_t)1 << msb) | (sub << (msb - HISTOGRAM_SUB_BITS));
+}
+
+int64_t histogram_bucket_high(int bucket) {
+  if (bucket < HISTOGRAM_SUB_COUNT) return bucket;
+
+  const int msb = (bucket - HISTOGRAM_SUB_COUNT) / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS;
+
+  return histogram_bucket_low(bucket) + ((int64_t)1 << (msb - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+
+/**
+  Initializes an empty histogram.
+
+  @param h a pointer to an instance of the histogram_t data structure
+ */
+void histogram_init(histogram_t *h)
+{
+  memset(h, 0, sizeof(histogram_t));
+}
+
+
+/**
+  Adds one value to the histogram. This is constant time: one bucket
+  index computation and a handful of additions.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @param value the value to record. Negative values are recorded as 0.
+ */
+void histogram_record(histogram_t *h, int64_t value)
+{
+  if (value < 0) value = 0;
+
+  h->counts[histogram_bucket(value)]++;
+
+  if (h->total == 0 || value < h->min) h->min = value;
+  if (h->total == 0 || value > h->max) h->max = value;
+  h->sum += value;
+  h->total++;
+}
+
+
+/**
+  Returns the value below or at which the given percentage of all
+  recorded values fall. The answer is the top of the matching bucket
+  (clamped to the largest recorded value), so it never understates the
+  real percentile.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @param percentile a percentage between 0 and 100
+  @return the percentile value
+  @return 0 if the histogram is empty
+ */
+int64_t histogram_percentile(const histogram_t *h, double percentile)
+{
+  if (h->total == 0) return 0;
+  if (percentile >= 100.0) return h->max;
+
+  uint64_t rank = (uint64_t)(percentile / 100.0 * h->total + 0.5);
+  if (rank < 1) rank = 1;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank) {
+      int64_t high = histogram_bucket_high(i);
+      return high < h->max ? high : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+
+/**
+  Returns the exact mean of all recorded values.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @return the mean value
+  @return 0 if the histogram is empty
+ */
+double histogram_mean(const histogram_t *h)
+{
+  return h->total == 0 ? 0.0 : (double)h->sum / h->total;
+}
+
+
+/**
+  Writes one "name,low,high,count,cumulative" CSV row per non-empty
+  bucket. No header is written, so several histograms can share a file.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @param name the value of the first column
+  @param scale bucket bounds are divided by this before printing (e.g. for fixed-point values)
+  @param out the stream to write to
+ */
+void histogram_print_csv(const histogram_t *h, const char *name, double scale, FILE *out)
+{
+  uint64_t seen = 0;
+
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (h->counts[i] == 0) continue;
+
+    seen += h->counts[i];
+    fprintf(out, "%s,%g,%g,%llu,%llu\n", name,
+            histogram_bucket_low(i) / scale, histogram_bucket_high(i) / scale,
+            (unsigned long long)h->counts[i], (unsigned long long)seen);
+  }
+}
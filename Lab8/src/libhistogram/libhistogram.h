@@ -0,0 +1,44 @@
+/** @file libhistogram.h
+ */
+
+#ifndef LIBHISTOGRAM_H_
+#define LIBHISTOGRAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+  Log-linear bucketing in the style of HdrHistogram. Values below
+  2 * HISTOGRAM_SUB_COUNT get a bucket each; above that every power of two
+  is split into HISTOGRAM_SUB_COUNT equal buckets, which bounds the
+  relative error of any reported value to 1 / HISTOGRAM_SUB_COUNT (~3%).
+*/
+#define HISTOGRAM_SUB_BITS   5
+#define HISTOGRAM_SUB_COUNT  (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS    (HISTOGRAM_SUB_COUNT * (64 - HISTOGRAM_SUB_BITS + 1))
+
+/**
+  Histogram Data Structure
+*/
+typedef struct _histogram_t
+{
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total; // number of recorded values
+  int64_t  sum;   // sum of recorded values
+  int64_t  min;
+  int64_t  max;
+} histogram_t;
+
+// histogram methods
+void    histogram_init       (histogram_t *h);
+void    histogram_record     (histogram_t *h, int64_t value);
+int64_t histogram_percentile (const histogram_t *h, double percentile);
+double  histogram_mean       (const histogram_t *h);
+void    histogram_print_csv  (const histogram_t *h, const char *name, double scale, FILE *out);
+
+// bucket helper methods
+int     histogram_bucket     (int64_t value); // index of the bucket holding value
+int64_t histogram_bucket_low (int bucket);    // smallest value stored in bucket
+int64_t histogram_bucket_high(int bucket);    // largest value stored in bucket
+
+#endif /* LIBHISTOGRAM_H_ */
@@ -6,9 +6,14 @@
 
 #include "libpriqueue.h"
 
+#ifdef PRIQUEUE_INSTRUMENT
+_Thread_local priqueue_counters_t priqueue_counters;
+#endif
+
 // Node helper methods
 
 node_t *new_node (void *item, node_t *next) {
+  PRIQUEUE_COUNT(mallocs, 1);
   node_t * node = malloc(sizeof(node_t));
   node->item = item;
   node->next = next;
@@ -33,10 +38,12 @@ void destroy_list (node_t *node) {
 node_t *node_at (node_t *node, int index) {
   if (index < 0 || node == NULL) return NULL;
 
+  PRIQUEUE_COUNT(node_at_nodes, index > 0);
   return index == 0 ? node : node_at(node->next, index - 1);
 }
 
 int list_size(node_t *node) {
+  PRIQUEUE_COUNT(size_nodes, node != NULL);
   return node == NULL ? 0 : 1 + list_size(node->next);
 }
 
@@ -80,6 +87,7 @@ int priqueue_offer(priqueue_t *q, void *ptr)
   node_t *target = q->top;
 
   for (; target != NULL; ++i) {
+    PRIQUEUE_COUNT(comparisons, 1);
     if(q->comparer(ptr, target->item) < 0) {
       node_t *node = new_node(ptr, target);
 
@@ -93,6 +101,7 @@ int priqueue_offer(priqueue_t *q, void *ptr)
       }
       return i;
     }
+    PRIQUEUE_COUNT(offer_nodes, 1);
     prev = target;
     target = target->next;
   }
@@ -167,6 +176,7 @@ int priqueue_remove(priqueue_t *q, void *ptr)
   node_t *prev = NULL;
 
   while (target != NULL) {
+    PRIQUEUE_COUNT(remove_nodes, 1);
     if(target->item == ptr) { // TODO: compare by pointer or value?
       // special case: if target == q->top, must re-assign q->top to next element
       if (target == q->top) q->top = q->top->next;
@@ -187,6 +197,33 @@ int priqueue_remove(priqueue_t *q, void *ptr)
 }
 
 
+/**
+  Removes the first element for which match(element, arg) is nonzero,
+  walking the queue once.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param match a function pointer that tests one element against arg
+  @param arg passed to match along with each element
+  @return the element removed from the queue
+  @return NULL if no element matched
+ */
+void *priqueue_remove_if(priqueue_t *q, int(*match)(const void *, const void *), const void *arg)
+{
+  node_t *prev = NULL;
+
+  for (node_t *target = q->top; target != NULL; prev = target, target = target->next) {
+    PRIQUEUE_COUNT(remove_nodes, 1);
+    if (match(target->item, arg)) {
+      if (prev == NULL) q->top = target->next;
+      else prev->next = target->next;
+      return destroy_node(target);
+    }
+  }
+
+  return NULL;
+}
+
+
 /**
   Removes the specified index from the queue, moving later elements up
   a spot in the queue to fill the gap.
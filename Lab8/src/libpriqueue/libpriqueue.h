@@ -22,6 +22,28 @@ typedef struct _priqueue_t
   node_t *top;
 } priqueue_t;
 
+/**
+  Hot path counters, kept only when built with -DPRIQUEUE_INSTRUMENT
+  (`make INSTRUMENT=1`). They are per thread and cover every queue the
+  thread uses; take a copy before and after the work to be measured.
+*/
+typedef struct _priqueue_counters_t
+{
+  unsigned long long comparisons;   // calls of a queue's comparer
+  unsigned long long offer_nodes;   // nodes passed over by priqueue_offer
+  unsigned long long node_at_nodes; // nodes passed over by node_at
+  unsigned long long remove_nodes;  // nodes passed over by priqueue_remove
+  unsigned long long size_nodes;    // nodes counted by list_size
+  unsigned long long mallocs;       // nodes allocated
+} priqueue_counters_t;
+
+#ifdef PRIQUEUE_INSTRUMENT
+extern _Thread_local priqueue_counters_t priqueue_counters;
+#define PRIQUEUE_COUNT(counter, n) (priqueue_counters.counter += (n))
+#else
+#define PRIQUEUE_COUNT(counter, n) ((void)0)
+#endif
+
 /*
   For a given priqueue_t<T> (elements of type T)...
 
@@ -47,6 +69,7 @@ void * priqueue_peek     (priqueue_t *q);
 void * priqueue_poll     (priqueue_t *q);
 void * priqueue_at       (priqueue_t *q, int index);
 int    priqueue_remove   (priqueue_t *q, void *ptr);
+void * priqueue_remove_if(priqueue_t *q, int(*match)(const void *, const void *), const void *arg);
 void * priqueue_remove_at(priqueue_t *q, int index);
 int    priqueue_size     (priqueue_t *q);
 
@@ -4,27 +4,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef SCHEDULER_INSTRUMENT_RDTSC
+#include <x86intrin.h>
+#endif
 
 #include "libscheduler.h"
 #include "../libpriqueue/libpriqueue.h"
 
 
+/**
+  The entry points timed by the instrumentation.
+*/
+typedef enum {ENTRY_NEW_JOB = 0, ENTRY_JOB_FINISHED, ENTRY_QUANTUM_EXPIRED, ENTRY_JOB_BLOCKED,
+              ENTRY_JOB_UNBLOCKED, ENTRY_AVERAGES, ENTRY_SHOW_QUEUE, ENTRIES} entry_t;
+
+/**
+  Everything counted by a scheduler built with SCHEDULER_INSTRUMENT.
+*/
+typedef struct _scheduler_counters_t
+{
+    unsigned long long calls[ENTRIES];
+    unsigned long long time[ENTRIES];       // ns, or TSC cycles with SCHEDULER_INSTRUMENT_RDTSC
+    unsigned long long max_time[ENTRIES];
+    unsigned long long preemptions;
+    unsigned long long quantum_expirations;
+    unsigned long long mallocs;             // job_t allocations (queue nodes are counted by libpriqueue)
+    priqueue_counters_t priqueue_start;     // this thread's libpriqueue counters when the scheduler was made
+} scheduler_counters_t;
+
+
 /**
   Stores information making up a job to be scheduled including any statistics.
 
   You may need to define some global variables or a struct to store your job queue elements. 
 */
 
-typedef struct _completed_job_t {
-    int arrival_time;
-    int start_time;
-    int end_time;
-    int first_run_time;
-    int total_run_time;
-} completed_job_t;
-
-completed_job_t *completed_jobs = NULL;
-int completed_jobs_count = 0;
 
 typedef struct _job_t
 {
@@ -39,20 +55,97 @@ typedef struct _job_t
     int total_run_time;
     int first_run_time;
     int quantum_used;
+    int ready_time;     // when the job last entered the ready queue (arrival or end of I/O)
+    int blocked_time;   // when the job last blocked for I/O
+    int io_time;        // total time spent blocked for I/O
+    int last_core;      // the core the job last ran on, or -1
 } job_t;
 
-priqueue_t job_queue;
-int num_cores;
-scheme_t scheduler_scheme;
-job_t **core_jobs;
-int total_jobs;
+/**
+  All of the state belonging to one simulated machine. Keeping it together
+  (instead of in file-level globals) lets several independent schedulers
+  live in the same process.
+*/
+struct _scheduler_t
+{
+    priqueue_t job_queue;
+    priqueue_t blocked_jobs;
+    int num_cores;
+    scheme_t scheme;
+    job_t **core_jobs;
+    int total_jobs;
+    histogram_t latency[LATENCY_METRICS];
+
+    // Machine topology; without one every core is alike and in one domain
+    int has_topology;
+    int *socket;
+    int *cache_domain;
+    int *speed;
+    scheduler_migrations_t migrations;
+
+#ifdef SCHEDULER_INSTRUMENT
+    scheduler_counters_t counters;
+#endif
+};
+
+/**
+  The instance used by the original, context-free scheduler_* functions.
+*/
+static scheduler_t default_scheduler;
+
+#ifdef SCHEDULER_INSTRUMENT
+static const char *entry_names[ENTRIES] = {
+    "new_job", "job_finished", "quantum_expired", "job_blocked", "job_unblocked", "average_*", "show_queue"
+};
+
+static inline unsigned long long instrument_now(void)
+{
+#ifdef SCHEDULER_INSTRUMENT_RDTSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+  Times one call of an entry point. INSTRUMENT_ENTRY() declares one of
+  these at the top of the function; the cleanup attribute charges the
+  elapsed time on every return path.
+*/
+typedef struct _instrument_scope_t
+{
+    scheduler_counters_t *counters;
+    entry_t entry;
+    unsigned long long start;
+} instrument_scope_t;
+
+static inline void instrument_leave(instrument_scope_t *scope)
+{
+    const unsigned long long elapsed = instrument_now() - scope->start;
+
+    scope->counters->calls[scope->entry]++;
+    scope->counters->time[scope->entry] += elapsed;
+    if (elapsed > scope->counters->max_time[scope->entry]) {
+        scope->counters->max_time[scope->entry] = elapsed;
+    }
+}
+
+#define INSTRUMENT_ENTRY(s, entry) \
+    instrument_scope_t instrument_scope_ __attribute__((cleanup(instrument_leave))) = { &(s)->counters, (entry), instrument_now() }
+#define INSTRUMENT_COUNT(s, counter) ((s)->counters.counter++)
+#else
+#define INSTRUMENT_ENTRY(s, entry) ((void)0)
+#define INSTRUMENT_COUNT(s, counter) ((void)0)
+#endif
 
 static int compare_fcfs(const void *const lhs, const void *const rhs)
 {
     job_t *job1 = (job_t*)lhs;
     job_t *job2 = (job_t*)rhs;
 
-    return job1->arrival_time - job2->arrival_time;
+    return job1->ready_time - job2->ready_time;
 }
 
 static int compare_sjf(const void *const lhs, const void *const rhs)
@@ -99,110 +192,279 @@ static int compare_rr(const void *const lhs, const void *const rhs)
     return 0;
 }
 
+static int job_has_number(const void *const item, const void *const job_number)
+{
+    return ((const job_t*)item)->job_number == *(const int*)job_number;
+}
+
+static void scheduler_init(scheduler_t *s, const int cores, const scheme_t scheme)
+{
+    s->num_cores = cores;
+    s->scheme = scheme;
+    s->core_jobs = malloc(sizeof(job_t*) * cores);
+    s->total_jobs = 0;
+    for (int i = 0; i < LATENCY_METRICS; i++) {
+        histogram_init(&s->latency[i]);
+    }
+    
+    for (int i = 0; i < cores; i++) {
+        s->core_jobs[i] = NULL;
+    }
+
+    s->has_topology = 0;
+    s->socket = malloc(sizeof(int) * cores);
+    s->cache_domain = malloc(sizeof(int) * cores);
+    s->speed = malloc(sizeof(int) * cores);
+    for (int i = 0; i < cores; i++) {
+        s->socket[i] = 0;
+        s->cache_domain[i] = 0;
+        s->speed[i] = SPEED_SCALE;
+    }
+    memset(&s->migrations, 0, sizeof(s->migrations));
+
+#ifdef SCHEDULER_INSTRUMENT
+    memset(&s->counters, 0, sizeof(s->counters));
+    s->counters.priqueue_start = priqueue_counters;
+#endif
+
+    switch(scheme) {
+        case FCFS: priqueue_init(&s->job_queue, compare_fcfs); break;
+        case SJF:  priqueue_init(&s->job_queue, compare_sjf);  break;
+        case PSJF: priqueue_init(&s->job_queue, compare_psjf); break;
+        case PRI:  priqueue_init(&s->job_queue, compare_pri);  break;
+        case PPRI: priqueue_init(&s->job_queue, compare_ppri); break;
+        case RR:   priqueue_init(&s->job_queue, compare_rr);   break;
+    }
+
+    priqueue_init(&s->blocked_jobs, compare_rr);
+}
+
 /**
-  Initalizes the scheduler.
- 
+  Creates a new, independent scheduler.
+
+  Every scheduler_t owns its own job queue, cores and statistics, so any
+  number of them may exist at once and each may be driven from its own
+  thread. A single scheduler_t must not be used by two threads at once.
+
   Assumptions:
-    - You may assume this will be the first scheduler function called.
-    - You may assume this function will be called once once.
     - You may assume that cores is a positive, non-zero number.
     - You may assume that scheme is a valid scheduling scheme.
 
   @param cores the number of cores that is available by the scheduler. These cores will be known as core(id=0), core(id=1), ..., core(id=cores-1).
   @param scheme  the scheduling scheme that should be used. This value will be one of the six enum values of scheme_t
+  @return the new scheduler, to be released with scheduler_destroy()
+  @return NULL if memory could not be allocated
 */
-void scheduler_start_up(const int cores, const scheme_t scheme)
+scheduler_t *scheduler_create(const int cores, const scheme_t scheme)
 {
-    num_cores = cores;
-    scheduler_scheme = scheme;
-    core_jobs = malloc(sizeof(job_t*) * cores);
-    total_jobs = 0;
-    completed_jobs_count = 0;
-    completed_jobs = NULL;
-    
-    for (int i = 0; i < cores; i++) {
-        core_jobs[i] = NULL;
+    scheduler_t *s = malloc(sizeof(scheduler_t));
+    if (!s) {
+        return NULL;
     }
 
-    switch(scheme) {
-        case FCFS: priqueue_init(&job_queue, compare_fcfs); break;
-        case SJF:  priqueue_init(&job_queue, compare_sjf);  break;
-        case PSJF: priqueue_init(&job_queue, compare_psjf); break;
-        case PRI:  priqueue_init(&job_queue, compare_pri);  break;
-        case PPRI: priqueue_init(&job_queue, compare_ppri); break;
-        case RR:   priqueue_init(&job_queue, compare_rr);   break;
-    }
+    scheduler_init(s, cores, scheme);
+    return s;
 }
 
+static void scheduler_set_topology(scheduler_t *s, const scheduler_topology_t *topology)
+{
+    s->has_topology = 1;
+    for (int i = 0; i < topology->cores; i++) {
+        s->socket[i] = topology->socket ? topology->socket[i] : 0;
+        s->cache_domain[i] = topology->cache_domain ? topology->cache_domain[i] : 0;
+        s->speed[i] = topology->speed ? topology->speed[i] : SPEED_SCALE;
+    }
+}
 
 /**
-  Called when a new job arrives.
- 
-  If multiple cores are idle, the job should be assigned to the core with the
-  lowest id.
-  If the job arriving should be scheduled to run during the next
-  time cycle, return the zero-based index of the core the job should be
-  scheduled on. If another job is already running on the core specified,
-  this will preempt the currently running job.
-  Assumption:
-    - You may assume that every job wil have a unique arrival time.
+  Creates a new, independent scheduler for a machine whose cores differ.
+
+  Jobs are placed on the idle core closest to where they last ran (the
+  same core, then the same cache domain, then the same socket), falling
+  back to the fastest idle core. A core that goes idle with nothing
+  queued takes over a job running on a slower core, preferring one from
+  its own cache domain and then its own socket.
+
+  @param topology the sockets, cache domains and speeds of the cores. topology->cores must be positive and every speed positive.
+  @param scheme  the scheduling scheme that should be used.
+  @return the new scheduler, to be released with scheduler_destroy()
+  @return NULL if memory could not be allocated
+*/
+scheduler_t *scheduler_create_topology(const scheduler_topology_t *topology, const scheme_t scheme)
+{
+    scheduler_t *s = scheduler_create(topology->cores, scheme);
+    if (!s) {
+        return NULL;
+    }
 
-  @param job_number a globally unique identification number of the job arriving.
-  @param time the current time of the simulator.
-  @param running_time the total number of time units this job will run before it will be finished.
-  @param priority the priority of the job. (The lower the value, the higher the priority.)
-  @return index of core job should be scheduled on
-  @return -1 if no scheduling changes should be made. 
- 
- */
+    scheduler_set_topology(s, topology);
+    return s;
+}
 
-inline static int find_free_core()
+
+/*
+  Adds a finished job to the latency histograms. Constant time, so the
+  cost of collecting statistics does not grow with the length of a run.
+*/
+static void record_completion(scheduler_t *s, const job_t *job, const int time)
 {
-    for (int i = 0; i < num_cores; i++) {
-        if (core_jobs[i] == NULL) return i;
+    const int turnaround_time = time - job->arrival_time;
+
+    histogram_record(&s->latency[WAITING_TIME], turnaround_time - job->total_run_time - job->io_time);
+    histogram_record(&s->latency[TURNAROUND_TIME], turnaround_time);
+    histogram_record(&s->latency[RESPONSE_TIME], job->first_run_time - job->arrival_time);
+    histogram_record(&s->latency[SLOWDOWN], (int64_t)turnaround_time * SLOWDOWN_SCALE / job->total_run_time);
+}
+
+/*
+  The work a core gets through in elapsed time units.
+*/
+static inline int work_done(const scheduler_t *s, const int core_id, const int elapsed)
+{
+    return elapsed * s->speed[core_id] / SPEED_SCALE;
+}
+
+/*
+  Puts job on core_id, counting a migration if it last ran elsewhere.
+*/
+static void assign_core(scheduler_t *s, job_t *job, const int core_id)
+{
+    const int last = job->last_core;
+
+    if (last != -1 && last != core_id) {
+        s->migrations.migrations++;
+        if (s->cache_domain[last] != s->cache_domain[core_id]) {
+            s->migrations.cross_domain++;
+        }
+        if (s->socket[last] != s->socket[core_id]) {
+            s->migrations.cross_socket++;
+        }
     }
-    return -1;
+
+    s->core_jobs[core_id] = job;
+    job->core_id = core_id;
+    job->last_core = core_id;
 }
 
-int scheduler_new_job(const int job_number, const int time, const int running_time, const int priority)
+/*
+  How close core_id is to where job last ran: 3 for the same core, 2 for
+  the same cache domain, 1 for the same socket and 0 otherwise.
+*/
+static int affinity(const scheduler_t *s, const job_t *job, const int core_id)
 {
-    if (running_time <= 0 || time < 0) {
-        return -1;
+    const int last = job->last_core;
+
+    if (last == -1) return 0;
+    if (last == core_id) return 3;
+    if (s->cache_domain[last] == s->cache_domain[core_id]) return 2;
+    if (s->socket[last] == s->socket[core_id]) return 1;
+    return 0;
+}
+
+/*
+  With nothing queued, lets the idle core core_id take over a job running
+  on a slower core (big.LITTLE up-migration). Jobs in core_id's own cache
+  domain are preferred, then its own socket, then the slowest core.
+  Returns the job moved, or NULL.
+*/
+static job_t *pull_running_job(scheduler_t *s, const int core_id, const int time)
+{
+    int best = -1, best_affinity = -1;
+
+    for (int i = 0; i < s->num_cores; i++) {
+        if (!s->core_jobs[i] || s->speed[i] >= s->speed[core_id]) {
+            continue;
+        }
+
+        int a = s->cache_domain[i] == s->cache_domain[core_id] ? 2 : s->socket[i] == s->socket[core_id] ? 1 : 0;
+        if (a > best_affinity || (a == best_affinity && s->speed[i] < s->speed[best])) {
+            best = i;
+            best_affinity = a;
+        }
     }
-    
-    job_t *job = malloc(sizeof(job_t));
-    if (!job) {
-        return -1;
+
+    if (best == -1) {
+        return NULL;
     }
-    job->job_number = job_number;
-    job->arrival_time = time;
-    job->running_time = running_time;
-    job->time_remaining = running_time;
-    job->priority = priority;
-    job->core_id = -1;
+
+    job_t *job = s->core_jobs[best];
+    job->time_remaining -= work_done(s, best, time - job->start_time);
     job->start_time = time;
-    job->end_time = -1;
-    job->first_run_time = -1;
-    job->quantum_used = 0;
-    total_jobs++;
+    s->core_jobs[best] = NULL;
+    s->migrations.upmigrations++;
+    return job;
+}
 
-    const int free_core = find_free_core();
+/*
+  Runs the job at the head of the queue on the (idle) core core_id.
+  Returns its job number, or -1 if the queue is empty.
+*/
+static int schedule_next(scheduler_t *s, const int core_id, const int time)
+{
+    job_t *next_job;
+
+    if (priqueue_size(&s->job_queue) > 0) {
+        next_job = priqueue_poll(&s->job_queue);
+    } else if (s->has_topology && (next_job = pull_running_job(s, core_id, time)) != NULL) {
+        assign_core(s, next_job, core_id);
+        return next_job->job_number;
+    } else {
+        return -1;
+    }
+
+    assign_core(s, next_job, core_id);
+    next_job->start_time = time;
+    if (next_job->first_run_time == -1) {
+        next_job->first_run_time = time;
+    }
+    return next_job->job_number;
+}
+
+/*
+  Picks the idle core for job: the lowest numbered one, or with a
+  topology the one closest to where it last ran, then the fastest.
+*/
+static int find_free_core(const scheduler_t *s, const job_t *job)
+{
+    int best = -1;
+
+    for (int i = 0; i < s->num_cores; i++) {
+        if (s->core_jobs[i] != NULL) continue;
+        if (!s->has_topology) return i;
+
+        if (best == -1 || affinity(s, job, i) > affinity(s, job, best) ||
+            (affinity(s, job, i) == affinity(s, job, best) && s->speed[i] > s->speed[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+  Puts a job that just became ready (a new arrival, or a job whose I/O
+  completed) on a free core, on a core it preempts, or in the job queue.
+  Returns the core it was put on or -1 if it was queued.
+*/
+static int place_job(scheduler_t *s, job_t *job, const int time)
+{
+    const int free_core = find_free_core(s, job);
     if (free_core != -1) {
-        job->core_id = free_core;
-        job->first_run_time = time;
-        core_jobs[free_core] = job;
+        assign_core(s, job, free_core);
+        if (job->first_run_time == -1) {
+            job->first_run_time = time;
+        }
         return free_core;
     }
 
-    if (scheduler_scheme == PSJF) {
+    if (s->scheme == PSJF) {
         // Find job with most remaining time
         int max_remaining = -1;
         int core_to_preempt = -1;
         
-        for (int i = 0; i < num_cores; i++) {
-            if (core_jobs[i]) {
-                int elapsed = time - core_jobs[i]->start_time;
-                int remaining = core_jobs[i]->time_remaining - elapsed;
+        for (int i = 0; i < s->num_cores; i++) {
+            if (s->core_jobs[i]) {
+                int elapsed = time - s->core_jobs[i]->start_time;
+                int remaining = s->core_jobs[i]->time_remaining - work_done(s, i, elapsed);
                 
                 if (remaining > job->time_remaining && 
                     (max_remaining == -1 || remaining > max_remaining)) {
@@ -213,50 +475,107 @@ int scheduler_new_job(const int job_number, const int time, const int running_ti
         }
         
         if (core_to_preempt != -1) {
-            int elapsed = time - core_jobs[core_to_preempt]->start_time;
-            core_jobs[core_to_preempt]->time_remaining -= elapsed;
-            core_jobs[core_to_preempt]->start_time = time;
-            priqueue_offer(&job_queue, core_jobs[core_to_preempt]);
+            int elapsed = time - s->core_jobs[core_to_preempt]->start_time;
+            s->core_jobs[core_to_preempt]->time_remaining -= work_done(s, core_to_preempt, elapsed);
+            s->core_jobs[core_to_preempt]->start_time = time;
+            priqueue_offer(&s->job_queue, s->core_jobs[core_to_preempt]);
+            INSTRUMENT_COUNT(s, preemptions);
             
-            job->core_id = core_to_preempt;
+            assign_core(s, job, core_to_preempt);
             job->start_time = time;
-            job->first_run_time = time;
-            core_jobs[core_to_preempt] = job;
+            if (job->first_run_time == -1) {
+                job->first_run_time = time;
+            }
             return core_to_preempt;
         }
     }
-    else if (scheduler_scheme == PPRI) {
+    else if (s->scheme == PPRI) {
         // Find job with lowest priority
         int highest_priority = -1;
         int core_to_preempt = -1;
         
-        for (int i = 0; i < num_cores; i++) {
-            if (core_jobs[i] && core_jobs[i]->priority > job->priority) {
-                if (highest_priority == -1 || core_jobs[i]->priority > highest_priority) {
-                    highest_priority = core_jobs[i]->priority;
+        for (int i = 0; i < s->num_cores; i++) {
+            if (s->core_jobs[i] && s->core_jobs[i]->priority > job->priority) {
+                if (highest_priority == -1 || s->core_jobs[i]->priority > highest_priority) {
+                    highest_priority = s->core_jobs[i]->priority;
                     core_to_preempt = i;
                 }
             }
         }
         
         if (core_to_preempt != -1) {
-            int elapsed = time - core_jobs[core_to_preempt]->start_time;
-            core_jobs[core_to_preempt]->time_remaining -= elapsed;
-            core_jobs[core_to_preempt]->start_time = time;
-            priqueue_offer(&job_queue, core_jobs[core_to_preempt]);
+            int elapsed = time - s->core_jobs[core_to_preempt]->start_time;
+            s->core_jobs[core_to_preempt]->time_remaining -= work_done(s, core_to_preempt, elapsed);
+            s->core_jobs[core_to_preempt]->start_time = time;
+            priqueue_offer(&s->job_queue, s->core_jobs[core_to_preempt]);
+            INSTRUMENT_COUNT(s, preemptions);
             
-            job->core_id = core_to_preempt;
+            assign_core(s, job, core_to_preempt);
             job->start_time = time;
-            job->first_run_time = time;
-            core_jobs[core_to_preempt] = job;
+            if (job->first_run_time == -1) {
+                job->first_run_time = time;
+            }
             return core_to_preempt;
         }
     }
     
-    priqueue_offer(&job_queue, job);
+    priqueue_offer(&s->job_queue, job);
     return -1;
 }
 
+/**
+  Called when a new job arrives.
+ 
+  If multiple cores are idle, the job should be assigned to the core with the
+  lowest id.
+  If the job arriving should be scheduled to run during the next
+  time cycle, return the zero-based index of the core the job should be
+  scheduled on. If another job is already running on the core specified,
+  this will preempt the currently running job.
+  Assumption:
+    - You may assume that every job wil have a unique arrival time.
+
+  @param s the scheduler to operate on.
+  @param job_number a globally unique identification number of the job arriving.
+  @param time the current time of the simulator.
+  @param running_time the total number of time units this job will run before it will be finished.
+  @param priority the priority of the job. (The lower the value, the higher the priority.)
+  @return index of core job should be scheduled on
+  @return -1 if no scheduling changes should be made. 
+ 
+ */
+int scheduler_new_job_ctx(scheduler_t *s, const int job_number, const int time, const int running_time, const int priority)
+{
+    INSTRUMENT_ENTRY(s, ENTRY_NEW_JOB);
+    if (running_time <= 0 || time < 0) {
+        return -1;
+    }
+    
+    job_t *job = malloc(sizeof(job_t));
+    INSTRUMENT_COUNT(s, mallocs);
+    if (!job) {
+        return -1;
+    }
+    job->job_number = job_number;
+    job->arrival_time = time;
+    job->running_time = running_time;
+    job->time_remaining = running_time;
+    job->priority = priority;
+    job->core_id = -1;
+    job->start_time = time;
+    job->end_time = -1;
+    job->first_run_time = -1;
+    job->quantum_used = 0;
+    job->total_run_time = running_time;
+    job->ready_time = time;
+    job->blocked_time = -1;
+    job->io_time = 0;
+    job->last_core = -1;
+    s->total_jobs++;
+
+    return place_job(s, job, time);
+}
+
 /**
   Called when a job has completed execution.
  
@@ -265,39 +584,26 @@ int scheduler_new_job(const int job_number, const int time, const int running_ti
   finished job, return the job_number of the job that should be scheduled to
   run on core core_id.
  
+  @param s the scheduler to operate on.
   @param core_id the zero-based index of the core where the job was located.
   @param job_number a globally unique identification number of the job.
   @param time the current time of the simulator.
   @return job_number of the job that should be scheduled to run on core core_id
   @return -1 if core should remain idle.
  */
-int scheduler_job_finished(const int core_id, const int job_number, const int time)
+int scheduler_job_finished_ctx(scheduler_t *s, const int core_id, const int job_number, const int time)
 {
-    if (core_jobs[core_id]) {
-        core_jobs[core_id]->end_time = time;
+    INSTRUMENT_ENTRY(s, ENTRY_JOB_FINISHED);
+    if (s->core_jobs[core_id]) {
+        s->core_jobs[core_id]->end_time = time;
 
-        completed_jobs = realloc(completed_jobs, (completed_jobs_count + 1) * sizeof(completed_job_t));
-        completed_jobs[completed_jobs_count].arrival_time = core_jobs[core_id]->arrival_time;
-        completed_jobs[completed_jobs_count].first_run_time = core_jobs[core_id]->first_run_time;
-        completed_jobs[completed_jobs_count].end_time = time;
-        completed_jobs_count++;
+        record_completion(s, s->core_jobs[core_id], time);
 
-        free(core_jobs[core_id]);
-        core_jobs[core_id] = NULL;
-    }
-    
-    if (priqueue_size(&job_queue) > 0) {
-        job_t *next_job = priqueue_poll(&job_queue);
-        core_jobs[core_id] = next_job;
-        next_job->core_id = core_id;
-        next_job->start_time = time;
-        if (next_job->first_run_time == -1) {
-            next_job->first_run_time = time;
-        }
-        return next_job->job_number;
+        free(s->core_jobs[core_id]);
+        s->core_jobs[core_id] = NULL;
     }
     
-    return -1;
+    return schedule_next(s, core_id, time);
 }
 
 /**
@@ -308,64 +614,110 @@ int scheduler_job_finished(const int core_id, const int job_number, const int ti
   the quantum expiration, return the job_number of the job that should be
   scheduled to run on core core_id.
 
+  @param s the scheduler to operate on.
   @param core_id the zero-based index of the core where the quantum has expired.
   @param time the current time of the simulator. 
   @return job_number of the job that should be scheduled on core cord_id
   @return -1 if core should remain idle
  */
 
-int scheduler_quantum_expired(const int core_id, const int time)
+int scheduler_quantum_expired_ctx(scheduler_t *s, const int core_id, const int time)
 {
-    if (scheduler_scheme != RR) {
+    INSTRUMENT_ENTRY(s, ENTRY_QUANTUM_EXPIRED);
+    if (s->scheme != RR) {
         return -1;
     }
     
-    job_t *current_job = core_jobs[core_id];
+    job_t *current_job = s->core_jobs[core_id];
     if (!current_job) {
-        if (priqueue_size(&job_queue) > 0) {
-            job_t *next_job = priqueue_poll(&job_queue);
-            core_jobs[core_id] = next_job;
-            next_job->core_id = core_id;
-            next_job->start_time = time;
-            if (next_job->first_run_time == -1) {
-                next_job->first_run_time = time;
-            }
-            return next_job->job_number;
-        }
-        return -1;
+        return schedule_next(s, core_id, time);
     }
 
+    INSTRUMENT_COUNT(s, quantum_expirations);
     const int elapsed = time - current_job->start_time;
-    current_job->time_remaining -= elapsed;
+    current_job->time_remaining -= work_done(s, core_id, elapsed);
 
     if (current_job->time_remaining <= 0) {
-        completed_jobs = realloc(completed_jobs, (completed_jobs_count + 1) * sizeof(completed_job_t));
-        completed_jobs[completed_jobs_count].arrival_time = current_job->arrival_time;
-        completed_jobs[completed_jobs_count].first_run_time = current_job->first_run_time;
-        completed_jobs[completed_jobs_count].end_time = time;
-        completed_jobs_count++;
+        record_completion(s, current_job, time);
         
-        free(core_jobs[core_id]);
-        core_jobs[core_id] = NULL;
+        free(s->core_jobs[core_id]);
+        s->core_jobs[core_id] = NULL;
     } else {
         current_job->start_time = time;
         current_job->core_id = -1;
-        priqueue_offer(&job_queue, current_job);
-        core_jobs[core_id] = NULL;
+        priqueue_offer(&s->job_queue, current_job);
+        s->core_jobs[core_id] = NULL;
     }
     
-    if (priqueue_size(&job_queue) > 0) {
-        job_t *next_job = priqueue_poll(&job_queue);
-        core_jobs[core_id] = next_job;
-        next_job->core_id = core_id;
-        next_job->start_time = time;
-        if (next_job->first_run_time == -1) {
-            next_job->first_run_time = time;
-        }
-        return next_job->job_number;
+    return schedule_next(s, core_id, time);
+}
+
+/**
+  Called when the job running on a core stops to wait for I/O.
+
+  The job leaves the core and waits, outside of the job queue, until
+  scheduler_job_unblocked() reports that its I/O has completed. If any job
+  should be scheduled to run on the core it free'd up, return the
+  job_number of the job that should be scheduled to run on core core_id.
+
+  @param s the scheduler to operate on.
+  @param core_id the zero-based index of the core where the job was located.
+  @param job_number a globally unique identification number of the job.
+  @param time the current time of the simulator.
+  @return job_number of the job that should be scheduled to run on core core_id
+  @return -1 if core should remain idle.
+ */
+int scheduler_job_blocked_ctx(scheduler_t *s, const int core_id, const int job_number, const int time)
+{
+    INSTRUMENT_ENTRY(s, ENTRY_JOB_BLOCKED);
+    job_t *job = s->core_jobs[core_id];
+
+    if (job) {
+        job->core_id = -1;
+        job->time_remaining = 0;
+        job->blocked_time = time;
+        priqueue_offer(&s->blocked_jobs, job);
+        s->core_jobs[core_id] = NULL;
     }
-    
-    return -1;
+
+    return schedule_next(s, core_id, time);
+}
+
+/**
+  Called when the I/O a job was blocked on has completed and the job is
+  ready to run its next CPU burst.
+
+  The job is placed exactly like a new arrival: on the lowest idle core,
+  on a core it preempts (PSJF, PPRI), or in the job queue. Its response
+  time is still measured from its original arrival.
+
+  @param s the scheduler to operate on.
+  @param job_number the job whose I/O completed. It must have been passed to scheduler_job_blocked().
+  @param time the current time of the simulator.
+  @param running_time the length of the job's next CPU burst.
+  @return index of core job should be scheduled on
+  @return -1 if no scheduling changes should be made.
+ */
+int scheduler_job_unblocked_ctx(scheduler_t *s, const int job_number, const int time, const int running_time)
+{
+    INSTRUMENT_ENTRY(s, ENTRY_JOB_UNBLOCKED);
+    if (running_time <= 0) {
+        return -1;
+    }
+
+    job_t *job = priqueue_remove_if(&s->blocked_jobs, job_has_number, &job_number);
+    if (!job) {
+        return -1;
+    }
+
+    job->io_time += time - job->blocked_time;
+    job->running_time = running_time;
+    job->time_remaining = running_time;
+    job->total_run_time += running_time;
+    job->start_time = time;
+    job->ready_time = time;
+
+    return place_job(s, job, time);
 }
 
 /**
@@ -373,21 +725,16 @@ int scheduler_quantum_expired(const int core_id, const int time)
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param s the scheduler to operate on.
   @return the average waiting time of all jobs scheduled.
  */
 
-float scheduler_average_waiting_time()
+float scheduler_average_waiting_time_ctx(scheduler_t *s)
 {
-    if (total_jobs == 0) return 0.0f;
+    INSTRUMENT_ENTRY(s, ENTRY_AVERAGES);
+    if (s->total_jobs == 0) return 0.0f;
     
-    float total_waiting_time = 0.0f;
-    for (int i = 0; i < completed_jobs_count; i++) {
-        int turnaround_time = completed_jobs[i].end_time - completed_jobs[i].arrival_time;
-        int running_time = completed_jobs[i].total_run_time;
-        total_waiting_time += (float)(turnaround_time - running_time);
-    }
-    
-    return total_waiting_time / total_jobs;
+    return (float)s->latency[WAITING_TIME].sum / s->total_jobs;
 }
 
 /**
@@ -395,21 +742,16 @@ float scheduler_average_waiting_time()
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param s the scheduler to operate on.
   @return the average turnaround time of all jobs scheduled.
  */
 
-float scheduler_average_turnaround_time()
+float scheduler_average_turnaround_time_ctx(scheduler_t *s)
 {
-    if (total_jobs == 0) return 0.0f;
-    
-    float total_turnaround_time = 0.0f;
-    
-    for (int i = 0; i < completed_jobs_count; i++) {
-        total_turnaround_time += (float)(completed_jobs[i].end_time - 
-                                       completed_jobs[i].arrival_time);
-    }
+    INSTRUMENT_ENTRY(s, ENTRY_AVERAGES);
+    if (s->total_jobs == 0) return 0.0f;
     
-    return total_turnaround_time / total_jobs;
+    return (float)s->latency[TURNAROUND_TIME].sum / s->total_jobs;
 }
 
 /**
@@ -417,38 +759,77 @@ float scheduler_average_turnaround_time()
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param s the scheduler to operate on.
   @return the average response time of all jobs scheduled.
  */
 
-float scheduler_average_response_time()
+float scheduler_average_response_time_ctx(scheduler_t *s)
 {
-    if (total_jobs == 0) return 0.0f;
+    INSTRUMENT_ENTRY(s, ENTRY_AVERAGES);
+    if (s->total_jobs == 0) return 0.0f;
     
-    float total_response_time = 0.0f;
-    for (int i = 0; i < completed_jobs_count; i++) {
-        total_response_time += (float)(completed_jobs[i].first_run_time - completed_jobs[i].arrival_time);
+    return (float)s->latency[RESPONSE_TIME].sum / s->total_jobs;
+}
+
+/**
+  Returns the distribution of one latency metric over all finished jobs.
+  SLOWDOWN (turnaround time / running time) is stored in fixed point,
+  multiplied by SLOWDOWN_SCALE.
+
+  @param s the scheduler to operate on.
+  @param metric which distribution to return
+  @return the histogram, owned by the scheduler and valid until it is destroyed
+ */
+const histogram_t *scheduler_latency_histogram_ctx(scheduler_t *s, const latency_metric_t metric)
+{
+    return &s->latency[metric];
+}
+
+/**
+  Returns how often jobs changed core, and how many of those moves left
+  their cache domain or socket.
+
+  @param s the scheduler to operate on.
+  @param migrations filled in with the counts so far.
+ */
+void scheduler_migrations_ctx(scheduler_t *s, scheduler_migrations_t *migrations)
+{
+    *migrations = s->migrations;
+}
+
+static void scheduler_release(scheduler_t *s)
+{
+    for (int i = 0; i < s->num_cores; i++) {
+        if (s->core_jobs[i]) {
+            free(s->core_jobs[i]);
+        }
     }
-    
-    return total_response_time / total_jobs;
+
+    free(s->core_jobs);
+    free(s->socket);
+    free(s->cache_domain);
+    free(s->speed);
+    priqueue_destroy(&s->job_queue);
+
+    while (priqueue_size(&s->blocked_jobs) > 0) {
+        free(priqueue_poll(&s->blocked_jobs));
+    }
+    priqueue_destroy(&s->blocked_jobs);
 }
 
 /**
-  Free any memory associated with your scheduler.
- 
-  Assumption:
-    - This function will be the last function called in your library.
+  Free any memory associated with a scheduler made by scheduler_create().
+
+  @param s the scheduler to destroy. It must not be used afterwards.
 */
-void scheduler_clean_up()
+void scheduler_destroy(scheduler_t *s)
 {
-    for (int i = 0; i < num_cores; i++) {
-        if (core_jobs[i]) {
-            free(core_jobs[i]);
-        }
+    if (!s) {
+        return;
     }
 
-    free(core_jobs);
-    free(completed_jobs);
-    priqueue_destroy(&job_queue);
+    scheduler_release(s);
+    free(s);
 }
 
 
@@ -462,12 +843,163 @@ void scheduler_clean_up()
   
   This function is not required and will not be graded. You may leave it
   blank if you do not find it useful.
+ 
+  @param s the scheduler to operate on.
  */
-void scheduler_show_queue()
+void scheduler_show_queue_ctx(scheduler_t *s)
 {
-    for (int i = 0; i < priqueue_size(&job_queue); i++) {
-        const job_t *const job = priqueue_at(&job_queue, i);
+    INSTRUMENT_ENTRY(s, ENTRY_SHOW_QUEUE);
+    for (int i = 0; i < priqueue_size(&s->job_queue); i++) {
+        const job_t *const job = priqueue_at(&s->job_queue, i);
         printf("%d(%d) ", job->job_number, job->core_id);
     }
     printf("\n");
 }
+
+/**
+  Prints what the instrumentation counted since s was created: calls and
+  time per entry point, preemptions, quantum expirations, allocations and
+  the libpriqueue work done by the calling thread. Prints nothing unless
+  built with SCHEDULER_INSTRUMENT.
+
+  @param s the scheduler to report on.
+  @param out where to print the summary.
+ */
+void scheduler_print_counters_ctx(scheduler_t *s, FILE *out)
+{
+#ifdef SCHEDULER_INSTRUMENT
+    const scheduler_counters_t *c = &s->counters;
+#ifdef SCHEDULER_INSTRUMENT_RDTSC
+    const char *unit = "cycles";
+#else
+    const char *unit = "ns";
+#endif
+
+    fprintf(out, "Scheduler instrumentation (%s):\n", unit);
+    fprintf(out, "  %-16s %12s %14s %10s %10s\n", "entry point", "calls", "total", "mean", "max");
+    for (int i = 0; i < ENTRIES; i++) {
+        if (c->calls[i] == 0) {
+            continue;
+        }
+        fprintf(out, "  %-16s %12llu %14llu %10.1f %10llu\n", entry_names[i], c->calls[i], c->time[i],
+                (double)c->time[i] / c->calls[i], c->max_time[i]);
+    }
+
+    fprintf(out, "  preemptions %llu, quantum expirations %llu, job mallocs %llu\n",
+            c->preemptions, c->quantum_expirations, c->mallocs);
+
+#ifdef PRIQUEUE_INSTRUMENT
+    const priqueue_counters_t *start = &c->priqueue_start;
+    fprintf(out, "  priqueue: comparisons %llu, node mallocs %llu\n",
+            priqueue_counters.comparisons - start->comparisons, priqueue_counters.mallocs - start->mallocs);
+    fprintf(out, "  priqueue nodes traversed: offer %llu, node_at %llu, remove %llu, size %llu\n",
+            priqueue_counters.offer_nodes - start->offer_nodes, priqueue_counters.node_at_nodes - start->node_at_nodes,
+            priqueue_counters.remove_nodes - start->remove_nodes, priqueue_counters.size_nodes - start->size_nodes);
+#endif
+#endif
+}
+
+
+/*
+  The original single-instance API. Each function forwards to its _ctx
+  counterpart on default_scheduler.
+*/
+
+/**
+  Initalizes the scheduler.
+ 
+  Assumptions:
+    - You may assume this will be the first scheduler function called.
+    - You may assume this function will be called once once.
+    - You may assume that cores is a positive, non-zero number.
+    - You may assume that scheme is a valid scheduling scheme.
+
+  @param cores the number of cores that is available by the scheduler. These cores will be known as core(id=0), core(id=1), ..., core(id=cores-1).
+  @param scheme  the scheduling scheme that should be used. This value will be one of the six enum values of scheme_t
+*/
+void scheduler_start_up(const int cores, const scheme_t scheme)
+{
+    scheduler_init(&default_scheduler, cores, scheme);
+}
+
+/**
+  Initalizes the scheduler for a machine described by topology (see
+  scheduler_create_topology()) instead of cores identical cores.
+*/
+void scheduler_start_up_topology(const scheduler_topology_t *topology, const scheme_t scheme)
+{
+    scheduler_init(&default_scheduler, topology->cores, scheme);
+    scheduler_set_topology(&default_scheduler, topology);
+}
+
+int scheduler_new_job(const int job_number, const int time, const int running_time, const int priority)
+{
+    return scheduler_new_job_ctx(&default_scheduler, job_number, time, running_time, priority);
+}
+
+int scheduler_job_finished(const int core_id, const int job_number, const int time)
+{
+    return scheduler_job_finished_ctx(&default_scheduler, core_id, job_number, time);
+}
+
+int scheduler_quantum_expired(const int core_id, const int time)
+{
+    return scheduler_quantum_expired_ctx(&default_scheduler, core_id, time);
+}
+
+int scheduler_job_blocked(const int core_id, const int job_number, const int time)
+{
+    return scheduler_job_blocked_ctx(&default_scheduler, core_id, job_number, time);
+}
+
+int scheduler_job_unblocked(const int job_number, const int time, const int running_time)
+{
+    return scheduler_job_unblocked_ctx(&default_scheduler, job_number, time, running_time);
+}
+
+float scheduler_average_waiting_time()
+{
+    return scheduler_average_waiting_time_ctx(&default_scheduler);
+}
+
+float scheduler_average_turnaround_time()
+{
+    return scheduler_average_turnaround_time_ctx(&default_scheduler);
+}
+
+float scheduler_average_response_time()
+{
+    return scheduler_average_response_time_ctx(&default_scheduler);
+}
+
+const histogram_t *scheduler_latency_histogram(const latency_metric_t metric)
+{
+    return scheduler_latency_histogram_ctx(&default_scheduler, metric);
+}
+
+void scheduler_migrations(scheduler_migrations_t *migrations)
+{
+    scheduler_migrations_ctx(&default_scheduler, migrations);
+}
+
+/**
+  Free any memory associated with your scheduler.
+ 
+  Assumption:
+    - This function will be the last function called in your library.
+*/
+void scheduler_clean_up()
+{
+    scheduler_print_counters_ctx(&default_scheduler, stderr);
+    scheduler_release(&default_scheduler);
+}
+
+void scheduler_show_queue()
+{
+    scheduler_show_queue_ctx(&default_scheduler);
+}
+
+void scheduler_print_counters(FILE *out)
+{
+    scheduler_print_counters_ctx(&default_scheduler, out);
+}
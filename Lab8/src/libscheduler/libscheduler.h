@@ -4,20 +4,104 @@
 #ifndef LIBSCHEDULER_H_
 #define LIBSCHEDULER_H_
 
+#include <stdio.h>
+
+#include "../libhistogram/libhistogram.h"
+
 /**
   Constants which represent the different scheduling algorithms
 */
 typedef enum {FCFS = 0, SJF, PSJF, PRI, PPRI, RR} scheme_t;
 
+/**
+  Per-job latency metrics the scheduler keeps a histogram of
+*/
+typedef enum {WAITING_TIME = 0, TURNAROUND_TIME, RESPONSE_TIME, SLOWDOWN, LATENCY_METRICS} latency_metric_t;
+
+/**
+  SLOWDOWN values are fixed point: a job that took twice its running time is recorded as 2 * SLOWDOWN_SCALE
+*/
+#define SLOWDOWN_SCALE 1000
+
+/**
+  Core speeds are fixed point: a core with speed SPEED_SCALE does one time unit of work per time unit
+*/
+#define SPEED_SCALE 100
+
+/**
+  Describes the machine's cores for topology-aware placement. Core i sits
+  on socket socket[i] and shares a last-level cache with the other cores
+  of cache_domain[i] (numbered across the whole machine). speed[i] is its
+  relative speed, so a big.LITTLE part might use SPEED_SCALE for the big
+  cores and 40 for the LITTLE ones. The arrays are copied.
+*/
+typedef struct _scheduler_topology_t
+{
+    int cores;
+    const int *socket;
+    const int *cache_domain;
+    const int *speed;
+} scheduler_topology_t;
+
+/**
+  How often jobs resumed on a different core than the one they last ran on
+*/
+typedef struct _scheduler_migrations_t
+{
+    int migrations;    // any change of core
+    int cross_domain;  // the new core is in a different cache domain
+    int cross_socket;  // the new core is on a different socket
+    int upmigrations;  // a running job was moved to a faster core that went idle
+} scheduler_migrations_t;
+
 void  scheduler_start_up               (const int cores, const scheme_t scheme);
+void  scheduler_start_up_topology      (const scheduler_topology_t *topology, const scheme_t scheme);
 int   scheduler_new_job                (const int job_number, const int time, const int running_time, const int priority);
 int   scheduler_job_finished           (const int core_id, const int job_number, const int time);
 int   scheduler_quantum_expired        (const int core_id, const int time);
+int   scheduler_job_blocked            (const int core_id, const int job_number, const int time);
+int   scheduler_job_unblocked          (const int job_number, const int time, const int running_time);
 float scheduler_average_turnaround_time();
 float scheduler_average_waiting_time   ();
 float scheduler_average_response_time  ();
 void  scheduler_clean_up               ();
 
+const histogram_t *scheduler_latency_histogram(const latency_metric_t metric);
+void  scheduler_migrations             (scheduler_migrations_t *migrations);
+
 void  scheduler_show_queue             ();
 
+/**
+  Hot path instrumentation. Only collected when built with
+  -DSCHEDULER_INSTRUMENT (`make INSTRUMENT=1`, or `make INSTRUMENT=rdtsc`
+  to time in TSC cycles instead of nanoseconds); otherwise these print
+  nothing and the counting compiles away. scheduler_clean_up() prints the
+  summary to stderr by itself.
+*/
+void  scheduler_print_counters         (FILE *out);
+
+/**
+  Opaque handle to one independent scheduler instance. The functions above
+  operate on a single built-in instance; the _ctx functions below take the
+  instance explicitly so that several can be used at once.
+*/
+typedef struct _scheduler_t scheduler_t;
+
+scheduler_t *scheduler_create                      (const int cores, const scheme_t scheme);
+scheduler_t *scheduler_create_topology             (const scheduler_topology_t *topology, const scheme_t scheme);
+int          scheduler_new_job_ctx                 (scheduler_t *s, const int job_number, const int time, const int running_time, const int priority);
+int          scheduler_job_finished_ctx            (scheduler_t *s, const int core_id, const int job_number, const int time);
+int          scheduler_quantum_expired_ctx         (scheduler_t *s, const int core_id, const int time);
+int          scheduler_job_blocked_ctx             (scheduler_t *s, const int core_id, const int job_number, const int time);
+int          scheduler_job_unblocked_ctx           (scheduler_t *s, const int job_number, const int time, const int running_time);
+float        scheduler_average_turnaround_time_ctx (scheduler_t *s);
+float        scheduler_average_waiting_time_ctx    (scheduler_t *s);
+float        scheduler_average_response_time_ctx   (scheduler_t *s);
+const histogram_t *scheduler_latency_histogram_ctx (scheduler_t *s, const latency_metric_t metric);
+void         scheduler_migrations_ctx              (scheduler_t *s, scheduler_migrations_t *migrations);
+void         scheduler_destroy                     (scheduler_t *s);
+
+void         scheduler_show_queue_ctx              (scheduler_t *s);
+void         scheduler_print_counters_ctx          (scheduler_t *s, FILE *out);
+
 #endif /* LIBSCHEDULER_H_ */
@@ -7,7 +7,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "libscheduler/libscheduler.h"
 
@@ -16,14 +18,132 @@ typedef struct _simulator_job_list_t
 {
 	int job_id, arrival_time, run_time, priority;
 	int core_id, arrived;
+
+	/*
+	 * The bursts that follow the first CPU burst (run_time), alternating
+	 * I/O and CPU: io, cpu, io, cpu, ... The array is shared read-only by
+	 * every copy of the trace.
+	 */
+	const int *bursts;
+	int burst_count, next_burst;
+	int io_remaining;  /* time left on the current I/O burst, -1 when not blocked */
+	int io_ticket;     /* order in the device queue, lowest is served first */
+	int credit;        /* work done towards the next time unit, in SPEED_SCALE units */
 } simulator_job_list_t;
 
+/*
+ * Percentiles reported for every latency metric, and the names used for
+ * the metrics in printed reports and CSV columns.
+ */
+#define REPORT_PERCENTILES 5
+static const double report_percentiles[REPORT_PERCENTILES] = { 50, 90, 99, 99.9, 100 };
+static const char *report_percentile_names[REPORT_PERCENTILES] = { "p50", "p90", "p99", "p99.9", "max" };
+static const char *latency_names[LATENCY_METRICS] = { "Waiting Time", "Turnaround Time", "Response Time", "Slowdown" };
+static const char *latency_csv_names[LATENCY_METRICS] = { "waiting", "turnaround", "response", "slowdown" };
+
+/*
+ * How to run a single simulation.
+ */
+typedef struct _simulator_options_t
+{
+	int cores, scheme, quantum;
+	int verbose;
+	FILE *histogram_out;  /* if set, the latency histograms are written here as CSV */
+	FILE *decision_out;   /* if set, every scheduling decision is logged here */
+	const scheduler_topology_t *topology;  /* if set, the cores are described by it */
+} simulator_options_t;
+
+/*
+ * Summary of a single simulation run. Percentiles are in time units,
+ * except for SLOWDOWN which is a ratio.
+ */
+typedef struct _simulator_result_t
+{
+	int jobs, time;
+	float waiting_time, turnaround_time, response_time;
+	double percentiles[LATENCY_METRICS][REPORT_PERCENTILES];
+	float cpu_utilization;  /* fraction of core time spent running jobs */
+	float io_utilization;   /* fraction of time the I/O device was busy */
+	float io_overlap;       /* fraction of time the device and at least one core were both busy */
+	scheduler_migrations_t migrations;
+	int decisions;
+	unsigned long long decision_hash;
+} simulator_result_t;
+
+/*
+ * Every scheduling decision is folded into a 64-bit FNV-1a hash, so two
+ * runs can be checked for identical behaviour without keeping the logs.
+ */
+#define DECISION_HASH_INIT  0xcbf29ce484222325ULL
+#define DECISION_HASH_PRIME 0x100000001b3ULL
+
+/*
+ * One (trace, cores, scheme) combination of a parameter sweep.
+ */
+typedef struct _simulator_run_t
+{
+	int trace, cores, scheme, quantum;
+	const char *scheme_name;
+	int status;
+	simulator_result_t result;
+} simulator_run_t;
+
+/*
+ * Everything a sweep worker thread needs. Workers take the next run to
+ * simulate from next_run.
+ */
+typedef struct _simulator_sweep_t
+{
+	simulator_job_list_t **traces;
+	int *trace_counts;
+	simulator_run_t *runs;
+	int runs_count;
+	int next_run;
+	const scheduler_topology_t *topology;
+} simulator_sweep_t;
+
 void print_usage(char *program_name)
 {
-	fprintf(stderr, "Usage: %s -c <cores> -s <scheme> <input file>\n", program_name);
+	fprintf(stderr, "Usage: %s -c <cores> -s <scheme> [-T <topology>] [-P] [-H <histogram csv>] [-D <decision log>] <input file>\n", program_name);
 	fprintf(stderr, "       %s -c 2 -s fcfs examples/proc1.csv\n", program_name);
 	fprintf(stderr, "\n");
+	fprintf(stderr, "Sweep: %s -c <cores,...> -s <scheme,...> [-j <workers>] [-o <csv>] <input file>...\n", program_name);
+	fprintf(stderr, "       %s -c 1,2,4,8 -s fcfs,sjf,rr1,rr4 -j 8 -o sweep.csv examples/proc*.csv\n", program_name);
+	fprintf(stderr, "\n");
 	fprintf(stderr, "Acceptable schemes are: fcfs, sjf, psjf, pri, ppri, rr#\n");
+	fprintf(stderr, "-P prints latency percentiles after the averages; -H writes the latency histograms.\n");
+	fprintf(stderr, "-D writes a decision log that decisioncmp can compare against another run.\n");
+	fprintf(stderr, "-T describes the cores: sockets are separated by '|', cache domains by '/' and each domain\n");
+	fprintf(stderr, "   lists [count*]speed for its cores (%d is full speed). Eg. -T '4*100/4*40' or -T 2x2x4.\n", SPEED_SCALE);
+	fprintf(stderr, "An optional fourth trace column lists I/O and CPU bursts after the first CPU burst: io;cpu;io;cpu...\n");
+}
+
+/*
+ * Translate a scheme name into a scheme_t (and quantum for RR).
+ * Returns 0 on success, -1 for an unknown name and -2 for an RR scheme
+ * without a positive quantum.
+ */
+int parse_scheme(const char *name, int *scheme, int *quantum)
+{
+	*quantum = 0;
+
+	if (strcasecmp(name, "FCFS") == 0) { *scheme = FCFS; }
+	else if (strcasecmp(name, "SJF") == 0) { *scheme = SJF; }
+	else if (strcasecmp(name, "PSJF") == 0) { *scheme = PSJF; }
+	else if (strcasecmp(name, "PRI") == 0) { *scheme = PRI; }
+	else if (strcasecmp(name, "PPRI") == 0) { *scheme = PPRI; }
+	else if (strncasecmp(name, "RR", 2) == 0)
+	{
+		*scheme = RR;
+		*quantum = atoi(name + 2);
+
+		if (*quantum <= 0)
+			return -2;
+	}
+	else
+		return -1;
+
+	return 0;
 }
 
 int set_active_job(int job_id, int core_id, simulator_job_list_t *jobs, int active_jobs)
@@ -31,7 +151,7 @@ int set_active_job(int job_id, int core_id, simulator_job_list_t *jobs, int acti
 	int i;
 	for (i = 0; i < active_jobs; i++)
 	{
-		if (jobs[i].job_id == job_id && jobs[i].arrived)
+		if (jobs[i].job_id == job_id && jobs[i].arrived && jobs[i].io_remaining < 0)
 		{
 			jobs[i].core_id = core_id;
 			return 1;
@@ -79,87 +199,202 @@ void print_available_cores(int cores)
 }
 
 
-int main(int argc, char **argv)
+/*
+ * Parse the optional fourth column of a trace line: the I/O and CPU
+ * bursts that follow the first CPU burst, separated by ';' and starting
+ * with an I/O burst (eg. "3;5;2;4"). An empty column means the job never
+ * blocks. Returns 0 on success and -1 if the column is malformed.
+ */
+int parse_bursts(const char *column, simulator_job_list_t *job)
 {
-	int c;
-	int cores = 0, scheme = -1, quantum = 0;
-	char *file_name;
-
-	/*
-	 * Parse command line options.
-	 */
-	while ((c = getopt(argc, argv, "c:s:")) != -1)
-	{
-		switch (c)
-		{
-			case 'c':
-				cores = atoi(optarg);
+	int count = 0, size = 0;
+	int *bursts = NULL;
+	const char *p = column;
 
-				if (cores <= 0)
-				{
-					fprintf(stderr, "Option -c <cores> require a positive number.\n");
-					print_usage(argv[0]);
-					return 1;
-				}
-				break;
+	job->bursts = NULL;
+	job->burst_count = 0;
 
-			case 's':
-				if (strcasecmp(optarg, "FCFS") == 0) { scheme = FCFS; }
-				else if (strcasecmp(optarg, "SJF") == 0) { scheme = SJF; }
-				else if (strcasecmp(optarg, "PSJF") == 0) { scheme = PSJF; }
-				else if (strcasecmp(optarg, "PRI") == 0) { scheme = PRI; }
-				else if (strcasecmp(optarg, "PPRI") == 0) { scheme = PPRI; }
-				else if (strncasecmp(optarg, "RR", 2) == 0)
-				{
-					scheme = RR;
-					quantum = atoi(optarg + 2);
+	for (;;)
+	{
+		char *end;
+		long value;
 
-					if (quantum <= 0)
-					{
-						fprintf(stderr, "Option -s <scheme> requires a positive number for the quantum of RR. (Eg: -s RR2)\n");
-						print_usage(argv[0]);
-						return 1;
-					}
-				}
-				break;
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '"')
+			p++;
+		if (*p == '\0')
+			break;
 
-			case '?':
-				print_usage(argv[0]);
-				return 1;
+		value = strtol(p, &end, 10);
+		if (end == p || value <= 0)
+		{
+			free(bursts);
+			return -1;
+		}
 
-			default:
-				printf("....\n");
-				break;
+		if (count == size)
+		{
+			size = size ? size * 2 : 8;
+			bursts = realloc(bursts, size * sizeof(int));
+			if (!bursts)
+				return -1;
+		}
+		bursts[count++] = (int)value;
+
+		p = end;
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '"')
+			p++;
+		if (*p == ';')
+			p++;
+		else if (*p != '\0')
+		{
+			free(bursts);
+			return -1;
 		}
 	}
 
-	if (cores == 0)
+	/* Every I/O burst must be followed by the CPU burst it wakes up for */
+	if (count % 2 != 0)
 	{
-		fprintf(stderr, "Required option -c <cores> is not present.\n");
-		print_usage(argv[0]);
-		return 1;
+		free(bursts);
+		return -1;
 	}
 
-	if (scheme == -1)
+	job->bursts = bursts;
+	job->burst_count = count;
+	return 0;
+}
+
+/*
+ * Parse a topology description (see print_usage()) into topology, whose
+ * arrays are allocated here and released with free_topology(). Cache
+ * domains are numbered across the whole machine. Returns 0 on success
+ * and -1 if the description is malformed.
+ */
+int parse_topology(const char *spec, scheduler_topology_t *topology)
+{
+	int cores = 0, size = 0, socket = 0, domain = 0;
+	int *sockets = NULL, *domains = NULL, *speeds = NULL;
+	int s, d, c, n = 0;
+	const char *p = spec;
+
+	if (sscanf(spec, "%dx%dx%d%n", &s, &d, &c, &n) == 3 && spec[n] == '\0' && s > 0 && d > 0 && c > 0)
 	{
-		fprintf(stderr, "Required option -s <scheme> is not present.\n");
-		print_usage(argv[0]);
-		return 1;
+		static char shorthand[64];
+		int i, j;
+
+		/* Rewrite "SxDxC" as "C*100/C*100|C*100/C*100" and parse that */
+		char *q = shorthand;
+		for (i = 0; i < s; i++)
+			for (j = 0; j < d; j++)
+			{
+				int room = (int)(sizeof(shorthand) - (q - shorthand));
+				int len = snprintf(q, room, "%s%d*%d", i + j == 0 ? "" : j == 0 ? "|" : "/", c, SPEED_SCALE);
+				if (len >= room)
+					return -1;
+				q += len;
+			}
+		p = shorthand;
 	}
 
-	if (optind == argc - 1)
-		file_name = argv[optind];
-	else
+	for (;;)
 	{
-		fprintf(stderr, "A single input file is required.\n");
-		print_usage(argv[0]);
-		return 1;
+		char *end;
+		long count = 1, speed = strtol(p, &end, 10);
+
+		if (end == p)
+			goto fail;
+
+		if (*end == '*')
+		{
+			count = speed;
+			p = end + 1;
+			speed = strtol(p, &end, 10);
+			if (end == p)
+				goto fail;
+		}
+
+		if (count <= 0 || speed <= 0 || count > 4096 - cores)
+			goto fail;
+
+		while (count--)
+		{
+			if (cores == size)
+			{
+				size = size ? size * 2 : 16;
+				sockets = realloc(sockets, size * sizeof(int));
+				domains = realloc(domains, size * sizeof(int));
+				speeds = realloc(speeds, size * sizeof(int));
+				if (!sockets || !domains || !speeds)
+					goto fail;
+			}
+
+			sockets[cores] = socket;
+			domains[cores] = domain;
+			speeds[cores] = (int)speed;
+			cores++;
+		}
+
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p == '/')
+		{
+			domain++;
+			p++;
+		}
+		else if (*p == '|')
+		{
+			domain++;
+			socket++;
+			p++;
+		}
+		else if (*p == '\0')
+			break;
+		else
+			goto fail;
 	}
 
+	topology->cores = cores;
+	topology->socket = sockets;
+	topology->cache_domain = domains;
+	topology->speed = speeds;
+	return 0;
 
-	/*
-	 * Open the file, read the file, and populate the jobs data structure.
-	 */
+fail:
+	free(sockets);
+	free(domains);
+	free(speeds);
+	return -1;
+}
+
+void free_topology(scheduler_topology_t *topology)
+{
+	free((int *)topology->socket);
+	free((int *)topology->cache_domain);
+	free((int *)topology->speed);
+}
+
+/*
+ * Release a trace returned by load_trace().
+ */
+void free_trace(simulator_job_list_t *jobs, int jobs_count)
+{
+	int i;
+	for (i = 0; i < jobs_count; i++)
+		free((int *)jobs[i].bursts);
+	free(jobs);
+}
+
+/*
+ * Open the file, read the file, and populate the jobs data structure.
+ * Returns 0 on success and 2 on failure (the simulator's exit code for
+ * input errors).
+ *
+ * Each line holds "arrival time,run time,priority" and optionally a
+ * fourth column of I/O and CPU bursts (see parse_bursts()).
+ */
+int load_trace(const char *file_name, simulator_job_list_t **jobs_out, int *jobs_count_out)
+{
 	FILE *file = fopen(file_name, "r");
 	if (file == NULL)
 	{
@@ -172,13 +407,14 @@ int main(int argc, char **argv)
 	int jobs_ct = 10;
 	simulator_job_list_t* jobs = malloc(jobs_ct * sizeof(simulator_job_list_t));
 
-	char line[1024 + 1];
-	fgets(line, 1024, file);  // Ignore the first (header) line
-	while (fgets(line, 1024, file) != NULL)
+	char line[4096 + 1];
+	fgets(line, 4096, file);  // Ignore the first (header) line
+	while (fgets(line, 4096, file) != NULL)
 	{
 		char *arrival_time = strtok(line, ",");
 		char *run_time = strtok(NULL, ",");
 		char *priority = strtok(NULL, ",");
+		char *bursts = strtok(NULL, ",");
 
 		if (arrival_time != NULL && run_time != NULL && priority != NULL)
 		{
@@ -190,6 +426,7 @@ int main(int argc, char **argv)
 				if (!jobs)
 				{
 					fprintf(stderr, "Out of memory.\n");
+					fclose(file);
 					return 2;
 				}
 			}
@@ -200,64 +437,212 @@ int main(int argc, char **argv)
 			jobs[job_id].priority = atoi(priority);
 			jobs[job_id].core_id = -1;
 			jobs[job_id].arrived = 0;
+			jobs[job_id].next_burst = 0;
+			jobs[job_id].io_remaining = -1;
+			jobs[job_id].io_ticket = 0;
+			jobs[job_id].credit = 0;
+
+			if (parse_bursts(bursts ? bursts : "", &jobs[job_id]) != 0)
+			{
+				fprintf(stderr, "Illegal burst list for job %d.\n", job_id);
+				free_trace(jobs, job_id);
+				fclose(file);
+				return 2;
+			}
 
 			job_id++;
 		}
 		else
 		{
 			fprintf(stderr, "Illegal file format.\n");
+			free_trace(jobs, job_id);
+			fclose(file);
 			return 2;
 		}
 	}
 
 	fclose(file);
 
+	*jobs_out = jobs;
+	*jobs_count_out = job_id;
+	return 0;
+}
 
-	/*
-	 * Run the simulation.
-	 */
 
-	printf("Loaded %d core(s) and %d job(s) using ", cores, job_id);
-	if (scheme == FCFS) { printf("First Come First Served (FCFS)"); }
-	else if (scheme == SJF) { printf("Non-preemptive Shortest Job First (SJF)"); }
-	else if (scheme == PSJF) { printf("Preemptive Shortest Job First (PSJF)"); }
-	else if (scheme == PRI) { printf("Non-preemptive Priority (PRI)"); }
-	else if (scheme == PPRI) { printf("Preemptive Priority (PPRI)"); }
-	else if (scheme == RR) { printf("Round Robin (RR) with a quantum of %d", quantum); }
-	printf(" scheduling...\n\n");
+/*
+ * Write the one or few characters the timing diagram uses for job_id
+ * into symbol, which holds JOB_SYMBOL_SIZE bytes.
+ */
+#define JOB_SYMBOL_SIZE 16
+
+void job_symbol(char *symbol, int job_id)
+{
+	if (job_id < 10)
+		snprintf(symbol, JOB_SYMBOL_SIZE, "%d", job_id);
+	else if (job_id < 10 + 26)
+		snprintf(symbol, JOB_SYMBOL_SIZE, "%c", job_id - 10 + 'a');
+	else if (job_id < 10 + 26 + 26)
+		snprintf(symbol, JOB_SYMBOL_SIZE, "%c", job_id - 10 - 26 + 'A');
+	else
+		snprintf(symbol, JOB_SYMBOL_SIZE, "(%d)", job_id);
+}
+
+void print_timing_diagram(char **diagram, int cores, int has_io)
+{
+	int i;
+	for (i = 0; i < cores; i++)
+		printf("  Core %2d: %s\n", i, diagram[i]);
+
+	if (has_io)
+		printf("  I/O    : %s\n", diagram[cores]);
+}
 
-	scheduler_start_up(cores, scheme);
 
+/*
+ * Record one scheduling decision. The log holds one "time event core
+ * job" line per decision, where event is
+ *   A - a job arrived; core is the core it was placed on (or -1)
+ *   F - the job on core finished; job is the one now running there
+ *   Q - the quantum on core expired; job is the one now running there
+ *   B - the job on core blocked for I/O; job is the one now running there
+ *   U - job finished its I/O; core is the core it was placed on (or -1)
+ * and, when the run completed, ends with a "# decisions <count> hash
+ * <hash>" trailer.
+ */
+void log_decision(const simulator_options_t *options, simulator_result_t *result, int time, char event, int core, int job)
+{
+	const int fields[3] = { time, core, job };
+	unsigned long long hash = result->decision_hash;
+	int i, b;
 
-	int time = 0, i, j;
-	int active_jobs = job_id, jobs_alive = 0;
+	hash = (hash ^ (unsigned char)event) * DECISION_HASH_PRIME;
+	for (i = 0; i < 3; i++)
+		for (b = 0; b < 32; b += 8)
+			hash = (hash ^ (((unsigned int)fields[i] >> b) & 0xff)) * DECISION_HASH_PRIME;
+
+	result->decision_hash = hash;
+	result->decisions++;
+
+	if (options->decision_out)
+		fprintf(options->decision_out, "%d %c %d %d\n", time, event, core, job);
+}
+
+
+/*
+ * Run the simulation of trace (which is left untouched) on the given
+ * machine. When verbose is set, every scheduling event, the timing
+ * diagram and the final averages are printed exactly as the reference
+ * outputs in examples/ expect; otherwise nothing is printed and only
+ * result is filled in.
+ *
+ * Jobs with I/O bursts block when a CPU burst ends and queue for a
+ * single FCFS I/O device; when their I/O completes they are handed back
+ * to the scheduler for their next CPU burst. The diagram gains an "I/O"
+ * row and the utilization figures are printed only for such traces, so
+ * CPU-only traces print exactly what they always have.
+ *
+ * Each call uses its own scheduler_t, so several simulations may run
+ * concurrently on different threads.
+ *
+ * Returns 0 on success and 3 if the scheduler made an invalid decision.
+ */
+int simulate(const simulator_job_list_t *trace, int jobs_count, const simulator_options_t *options, simulator_result_t *result)
+{
+	const int cores = options->cores, scheme = options->scheme, quantum = options->quantum;
+	const int verbose = options->verbose;
+	int time = 0, i, j, status = 0;
+	int active_jobs = jobs_count, jobs_alive = 0;
+	int has_io = 0, jobs_blocked = 0, io_tickets = 0;
+	long busy_core_time = 0, device_busy_time = 0, overlap_time = 0;
+
+	simulator_job_list_t *jobs = malloc((jobs_count > 0 ? jobs_count : 1) * sizeof(simulator_job_list_t));
+	memcpy(jobs, trace, jobs_count * sizeof(simulator_job_list_t));
+
+	for (i = 0; i < jobs_count; i++)
+		if (jobs[i].burst_count > 0)
+			has_io = 1;
+
+	result->decisions = 0;
+	result->decision_hash = DECISION_HASH_INIT;
+
+	const int *speed = options->topology ? options->topology->speed : NULL;
+	scheduler_t *scheduler = options->topology ? scheduler_create_topology(options->topology, scheme) : scheduler_create(cores, scheme);
+	if (scheduler == NULL)
+	{
+		free(jobs);
+		return 2;
+	}
 
+	// The I/O device, if any, gets the diagram row after the last core
+	const int diagram_rows = cores + has_io;
 	int *quantum_clock = malloc(cores * sizeof(int));
-	char **core_timing_diagram = malloc(cores * sizeof(char *));
+	char **core_timing_diagram = malloc(diagram_rows * sizeof(char *));
 	int core_timing_diagram_size = 1024;
 
-	for (i = 0; i < cores; i++)
+	for (i = 0; i < diagram_rows; i++)
 	{
-		quantum_clock[i] = -1;
-		core_timing_diagram[i] = malloc(core_timing_diagram_size + 1);
-		core_timing_diagram[i][0] = '\0';
+		if (i < cores)
+			quantum_clock[i] = -1;
+		core_timing_diagram[i] = NULL;
+
+		if (verbose)
+		{
+			core_timing_diagram[i] = malloc(core_timing_diagram_size + 1);
+			core_timing_diagram[i][0] = '\0';
+		}
 	}
 
 	while (active_jobs > 0)
 	{
-		printf("=== [TIME %d] ===\n", time);
+		if (verbose)
+			printf("=== [TIME %d] ===\n", time);
 
 		/*
 		 * 1. Check if any jobs finished in the last time unit.
 		 */
 		for (i = 0; i < active_jobs; i++)
 		{
-			if (jobs[i].run_time == 0)
+			if (jobs[i].run_time == 0 && jobs[i].next_burst < jobs[i].burst_count)
+			{
+				// The CPU burst is over but the job has I/O to do: block it
+				int job_id = jobs[i].job_id;
+				int core_id = jobs[i].core_id;
+				int new_job_id = scheduler_job_blocked_ctx(scheduler, core_id, job_id, time);
+				log_decision(options, result, time, 'B', core_id, new_job_id);
+
+				if (scheme == RR)
+					quantum_clock[core_id] = quantum;
+
+				jobs[i].core_id = -1;
+				jobs[i].run_time = -1;
+				jobs[i].io_remaining = jobs[i].bursts[jobs[i].next_burst++];
+				jobs[i].io_ticket = io_tickets++;
+				jobs_blocked++;
+
+				// Set the new job
+				if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, active_jobs) )
+				{
+					if (verbose)
+					{
+						printf("The scheduler_job_blocked() selected an invalid job (job_id == %d).\n", new_job_id);
+						print_available_jobs(jobs, active_jobs);
+					}
+					status = 3;
+					goto out;
+				}
+				else if (verbose)
+				{
+					printf("Job %d, running on core %d, blocked for I/O (%d). Core %d is now running job %d.\n", job_id, core_id, jobs[i].io_remaining, core_id, new_job_id);
+					printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+				}
+			}
+			else if (jobs[i].run_time == 0)
 			{
 				// Notify the scheduler has finished
 				int job_id = jobs[i].job_id;
 				int core_id = jobs[i].core_id;
-				int new_job_id = scheduler_job_finished(jobs[i].core_id, jobs[i].job_id, time);
+				int new_job_id = scheduler_job_finished_ctx(scheduler, jobs[i].core_id, jobs[i].job_id, time);
+				log_decision(options, result, time, 'F', core_id, new_job_id);
 
 				if (scheme == RR)
 					quantum_clock[jobs[i].core_id] = quantum;
@@ -272,14 +657,18 @@ int main(int argc, char **argv)
 				// Set the new job
 				if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, active_jobs) )
 				{
-					printf("The scheduler_job_finished() selected an invalid job (job_id == %d).\n", new_job_id);
-					print_available_jobs(jobs, active_jobs);
-					return 3;
+					if (verbose)
+					{
+						printf("The scheduler_job_finished() selected an invalid job (job_id == %d).\n", new_job_id);
+						print_available_jobs(jobs, active_jobs);
+					}
+					status = 3;
+					goto out;
 				}
-				else
+				else if (verbose)
 				{
 					printf("Job %d, running on core %d, finished. Core %d is now running job %d.\n", job_id, core_id, core_id, new_job_id);
-					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
+					printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
 				}
 			}
 		}
@@ -306,7 +695,8 @@ int main(int argc, char **argv)
 							// Notify the scheduler the quantum has expired
 							int core_id = jobs[j].core_id;
 							int old_job_id = jobs[j].job_id;
-							int new_job_id = scheduler_quantum_expired(jobs[j].core_id, time);
+							int new_job_id = scheduler_quantum_expired_ctx(scheduler, jobs[j].core_id, time);
+							log_decision(options, result, time, 'Q', core_id, new_job_id);
 
 							jobs[j].core_id = -1;
 
@@ -315,14 +705,18 @@ int main(int argc, char **argv)
 							// Set the new job
 							if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, active_jobs) )
 							{
-								printf("The scheduler_quantum_expired() selected an invalid job (job_id == %d).\n", new_job_id);
-								print_available_jobs(jobs, active_jobs);
-								return 3;
+								if (verbose)
+								{
+									printf("The scheduler_quantum_expired() selected an invalid job (job_id == %d).\n", new_job_id);
+									print_available_jobs(jobs, active_jobs);
+								}
+								status = 3;
+								goto out;
 							}
-							else
+							else if (verbose)
 							{
 								printf("Job %d, running on core %d, had its quantum expire. Core %d is now running job %d.\n", old_job_id, core_id, core_id, new_job_id);
-								printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
+								printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
 							}
 
 							break;
@@ -333,6 +727,62 @@ int main(int argc, char **argv)
 		}
 
 
+		/*
+		 * Check for any jobs whose I/O completed in the last time unit;
+		 * they are placed just like new arrivals.
+		 */
+		for (i = 0; i < active_jobs && jobs_blocked > 0; i++)
+		{
+			if (jobs[i].io_remaining == 0)
+			{
+				jobs[i].io_remaining = -1;
+				jobs[i].run_time = jobs[i].bursts[jobs[i].next_burst++];
+				jobs_blocked--;
+
+				int new_job_core_id = scheduler_job_unblocked_ctx(scheduler, jobs[i].job_id, time, jobs[i].run_time);
+				log_decision(options, result, time, 'U', new_job_core_id, jobs[i].job_id);
+
+				if (new_job_core_id >= 0 && new_job_core_id < cores)
+				{
+					if (verbose)
+					{
+						printf("Job %d (running time=%d) finished its I/O. Job %d is now running on core %d.\n",
+								jobs[i].job_id, jobs[i].run_time, jobs[i].job_id, new_job_core_id);
+						printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+					}
+
+					for (j = 0; j < active_jobs; j++)
+						if (jobs[j].core_id == new_job_core_id)
+							jobs[j].core_id = -1;
+
+					jobs[i].core_id = new_job_core_id;
+
+					if (scheme == RR)
+						quantum_clock[new_job_core_id] = quantum;
+				}
+				else if (new_job_core_id == -1)
+				{
+					if (verbose)
+					{
+						printf("Job %d (running time=%d) finished its I/O. Job %d is set to idle (-1).\n",
+								jobs[i].job_id, jobs[i].run_time, jobs[i].job_id);
+						printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+					}
+				}
+				else
+				{
+					if (verbose)
+					{
+						printf("The scheduler_job_unblocked() selected an invalid core (core_id == %d).\n", new_job_core_id);
+						print_available_cores(cores);
+					}
+					status = 3;
+					goto out;
+				}
+			}
+		}
+
+
 		/*
 		 * 3. Check for any new jobs that arrive in this time unit
 		 */
@@ -340,15 +790,19 @@ int main(int argc, char **argv)
 		{
 			if (jobs[i].arrival_time == time)
 			{
-				int new_job_core_id = scheduler_new_job(jobs[i].job_id, time, jobs[i].run_time, jobs[i].priority);
+				int new_job_core_id = scheduler_new_job_ctx(scheduler, jobs[i].job_id, time, jobs[i].run_time, jobs[i].priority);
+				log_decision(options, result, time, 'A', new_job_core_id, jobs[i].job_id);
 				jobs[i].arrived = 1;
 				jobs_alive++;
 
 				if (new_job_core_id >= 0 && new_job_core_id < cores)
 				{
-					printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is now running on core %d.\n",
-							jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id, new_job_core_id);
-					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
+					if (verbose)
+					{
+						printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is now running on core %d.\n",
+								jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id, new_job_core_id);
+						printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+					}
 
 					// Find if anyone is currently using the core.
 					for (j = 0; j < active_jobs; j++)
@@ -363,15 +817,22 @@ int main(int argc, char **argv)
 				}
 				else if (new_job_core_id == -1)
 				{
-					printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is set to idle (-1).\n",
-							jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id);
-					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
+					if (verbose)
+					{
+						printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is set to idle (-1).\n",
+								jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id);
+						printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+					}
 				}
 				else
 				{
-					printf("The scheduler_new_job() selected an invalid core (core_id == %d).\n", new_job_core_id);
-					print_available_cores(cores);
-					return 3;
+					if (verbose)
+					{
+						printf("The scheduler_new_job() selected an invalid core (core_id == %d).\n", new_job_core_id);
+						print_available_cores(cores);
+					}
+					status = 3;
+					goto out;
 				}
 			}
 		}
@@ -380,86 +841,120 @@ int main(int argc, char **argv)
 		/*
 		 * 4. Run the time unit.
 		 */
-		char time_string[cores][11];
-		int cores_working = 0;
+		char time_string[diagram_rows][JOB_SYMBOL_SIZE];
+		int cores_working = 0, device_job = -1;
 
-		for (i = 0; i < cores; i++)
+		for (i = 0; i < diagram_rows; i++)
 			time_string[i][0] = '\0';
 
+		// The device serves the blocked job that has waited the longest
+		for (i = 0; i < active_jobs; i++)
+			if (jobs[i].io_remaining > 0 && (device_job == -1 || jobs[i].io_ticket < jobs[device_job].io_ticket))
+				device_job = i;
+
+		if (device_job != -1)
+		{
+			jobs[device_job].io_remaining--;
+			device_busy_time++;
+
+			if (verbose)
+				job_symbol(time_string[cores], jobs[device_job].job_id);
+		}
+
 		for (i = 0; i < active_jobs; i++)
 		{
 			if (jobs[i].core_id != -1)
 			{
 				cores_working++;
-				jobs[i].run_time--;
 				quantum_clock[jobs[i].core_id]--;
 
+				if (speed == NULL)
+					jobs[i].run_time--;
+				else
+				{
+					// Faster and slower cores get through more or less than a time unit of work
+					jobs[i].credit += speed[jobs[i].core_id];
+					jobs[i].run_time -= jobs[i].credit / SPEED_SCALE;
+					jobs[i].credit %= SPEED_SCALE;
+
+					if (jobs[i].run_time < 0)
+						jobs[i].run_time = 0;
+				}
+
+				if (!verbose)
+					continue;
+
 				assert(time_string[jobs[i].core_id][0] == '\0');
 
-				if (jobs[i].job_id < 10)
-					sprintf(time_string[jobs[i].core_id], "%d", jobs[i].job_id);
-				else if (jobs[i].job_id < 10 + 26)
-					sprintf(time_string[jobs[i].core_id], "%c", jobs[i].job_id - 10 + 'a');
-				else if (jobs[i].job_id < 10 + 26 + 26)
-					sprintf(time_string[jobs[i].core_id], "%c", jobs[i].job_id - 10 - 26 + 'A');
-				else
-					snprintf(time_string[jobs[i].core_id], 10, "(%d)", jobs[i].job_id);
+				job_symbol(time_string[jobs[i].core_id], jobs[i].job_id);
 			}
 		}
 
-		for (i = 0; i < cores; i++)
-		{
-			// If the core is idle, print a '-'
-			if (time_string[i][0] == '\0')
-				strcpy(time_string[i], "-");
+		busy_core_time += cores_working;
+		if (device_job != -1 && cores_working > 0)
+			overlap_time++;
 
-			// Ensure we have enough memory
-			while (strlen(core_timing_diagram[i]) + strlen(time_string[i]) >= (unsigned int)core_timing_diagram_size)
+		if (verbose)
+		{
+			for (i = 0; i < diagram_rows; i++)
 			{
-				core_timing_diagram_size *= 2;
+				// If the core is idle, print a '-'
+				if (time_string[i][0] == '\0')
+					strcpy(time_string[i], "-");
 
-				for (j = 0; j < cores; j++)
+				// Ensure we have enough memory
+				while (strlen(core_timing_diagram[i]) + strlen(time_string[i]) >= (unsigned int)core_timing_diagram_size)
 				{
-					core_timing_diagram[j] = realloc(core_timing_diagram[j], core_timing_diagram_size + 1);
+					core_timing_diagram_size *= 2;
 
-					if (core_timing_diagram[j] == NULL)
+					for (j = 0; j < diagram_rows; j++)
 					{
-						fprintf(stderr, "Out of memory.\n");
-						return 3;
+						core_timing_diagram[j] = realloc(core_timing_diagram[j], core_timing_diagram_size + 1);
+
+						if (core_timing_diagram[j] == NULL)
+						{
+							fprintf(stderr, "Out of memory.\n");
+							status = 3;
+							goto out;
+						}
 					}
 				}
+
+				strcat( core_timing_diagram[i], time_string[i] );
 			}
 
-			strcat( core_timing_diagram[i], time_string[i] );
-		}
 
+			/*
+			 * 5. Print data!
+			 */
+			printf("At the end of time unit %d...\n", time);
 
-		/*
-		 * 5. Print data!
-		 */
-		printf("At the end of time unit %d...\n", time);
+			print_timing_diagram(core_timing_diagram, cores, has_io);
 
-		for (i = 0; i < cores; i++)
-			printf("  Core %2d: %s\n", i, core_timing_diagram[i]);
-
-		printf("\n");
+			printf("\n");
 
-		printf("  Queue: ");
-		scheduler_show_queue();
-		printf("\n");
-		printf("\n");
+			printf("  Queue: ");
+			scheduler_show_queue_ctx(scheduler);
+			printf("\n");
+			printf("\n");
+		}
 
 
 		/*
 		 * 6. Sanity Checking
 		 *
 		 * - If there's a job alive (needing to be ran) and all CPUs are idle, the scheduler failed to schedule properly.
+		 *   Jobs blocked for I/O do not need a CPU.
 		 */
-		if (jobs_alive > 0 && cores_working == 0)
+		if (jobs_alive - jobs_blocked > 0 && cores_working == 0)
 		{
-			printf("All cores are idle and at least one job remains unscheduled.\n");
-			print_available_jobs(jobs, active_jobs);
-			return 3;
+			if (verbose)
+			{
+				printf("All cores are idle and at least one job remains unscheduled.\n");
+				print_available_jobs(jobs, active_jobs);
+			}
+			status = 3;
+			goto out;
 		}
 
 
@@ -470,23 +965,497 @@ int main(int argc, char **argv)
 	}
 
 
-	printf("FINAL TIMING DIAGRAM:\n");
-	for (i = 0; i < cores; i++)
-		printf("  Core %2d: %s\n", i, core_timing_diagram[i]);
+	if (verbose)
+	{
+		printf("FINAL TIMING DIAGRAM:\n");
+		print_timing_diagram(core_timing_diagram, cores, has_io);
 
-	printf("\n");
-	printf("Average Waiting Time: %.2f\n", scheduler_average_waiting_time());
-	printf("Average Turnaround Time: %.2f\n", scheduler_average_turnaround_time());
-	printf("Average Response Time: %.2f\n", scheduler_average_response_time());
+		printf("\n");
+		printf("Average Waiting Time: %.2f\n", scheduler_average_waiting_time_ctx(scheduler));
+		printf("Average Turnaround Time: %.2f\n", scheduler_average_turnaround_time_ctx(scheduler));
+		printf("Average Response Time: %.2f\n", scheduler_average_response_time_ctx(scheduler));
+	}
 
-	scheduler_clean_up();
+	result->cpu_utilization = time > 0 ? (float)busy_core_time / ((float)time * cores) : 0;
+	result->io_utilization = time > 0 ? (float)device_busy_time / time : 0;
+	result->io_overlap = time > 0 ? (float)overlap_time / time : 0;
+
+	if (verbose && has_io)
+	{
+		printf("CPU Utilization: %.2f%%\n", 100 * result->cpu_utilization);
+		printf("I/O Device Utilization: %.2f%%\n", 100 * result->io_utilization);
+		printf("CPU and I/O Overlap: %.2f%%\n", 100 * result->io_overlap);
+	}
 
+	scheduler_migrations_ctx(scheduler, &result->migrations);
+
+	if (verbose && options->topology)
+		printf("Migrations: %d (%d across cache domains, %d across sockets, %d to faster cores)\n",
+				result->migrations.migrations, result->migrations.cross_domain,
+				result->migrations.cross_socket, result->migrations.upmigrations);
+
+	// Only prints anything in an instrumented build (make INSTRUMENT=1)
+	if (verbose)
+		scheduler_print_counters_ctx(scheduler, stderr);
+
+	result->jobs = jobs_count;
+	result->time = time;
+	result->waiting_time = scheduler_average_waiting_time_ctx(scheduler);
+	result->turnaround_time = scheduler_average_turnaround_time_ctx(scheduler);
+	result->response_time = scheduler_average_response_time_ctx(scheduler);
+
+	for (i = 0; i < LATENCY_METRICS; i++)
+	{
+		const histogram_t *h = scheduler_latency_histogram_ctx(scheduler, i);
+		const double scale = i == SLOWDOWN ? SLOWDOWN_SCALE : 1;
+
+		for (j = 0; j < REPORT_PERCENTILES; j++)
+			result->percentiles[i][j] = histogram_percentile(h, report_percentiles[j]) / scale;
+
+		if (options->histogram_out)
+			histogram_print_csv(h, latency_csv_names[i], scale, options->histogram_out);
+	}
+
+out:
+	/* No trailer after an error, so decisioncmp sees a truncated log */
+	if (options->decision_out && status == 0)
+		fprintf(options->decision_out, "# decisions %d hash %016llx\n", result->decisions, result->decision_hash);
+
+	scheduler_destroy(scheduler);
 
 	free(quantum_clock);
-	for (i=0; i < cores; i++)
+	for (i=0; i < diagram_rows; i++)
 		free(core_timing_diagram[i]);
 	free(core_timing_diagram);
 	free(jobs);
 
-	return 0;
+	return status;
+}
+
+
+/*
+ * Split a comma separated list in place. Returns the number of entries
+ * stored into items (at most max_items).
+ */
+int split_list(char *list, char **items, int max_items)
+{
+	int count = 0;
+	char *save = NULL;
+	char *token = strtok_r(list, ",", &save);
+
+	while (token != NULL && count < max_items)
+	{
+		items[count++] = token;
+		token = strtok_r(NULL, ",", &save);
+	}
+
+	return count;
+}
+
+
+void *sweep_worker(void *arg)
+{
+	simulator_sweep_t *sweep = (simulator_sweep_t *)arg;
+	int run;
+
+	while ((run = __atomic_fetch_add(&sweep->next_run, 1, __ATOMIC_RELAXED)) < sweep->runs_count)
+	{
+		simulator_run_t *r = &sweep->runs[run];
+
+		simulator_options_t options = { r->cores, r->scheme, r->quantum, 0, NULL, NULL, sweep->topology };
+
+		r->status = simulate(sweep->traces[r->trace], sweep->trace_counts[r->trace], &options, &r->result);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Run every (trace, cores, scheme) combination on a pool of worker
+ * threads and write one CSV row per combination to out, in the order
+ * the combinations were listed on the command line.
+ *
+ * Workers pull the next run index from a shared counter, so a slow
+ * combination does not hold up the rest of the sweep. Every run gets
+ * its own scheduler_t, so the runs need no further synchronization.
+ *
+ * Returns 0 if every run succeeded and 3, as simulate() does, if any
+ * run failed or never ran.
+ */
+int run_sweep(char **file_names, simulator_job_list_t **traces, int *trace_counts, simulator_run_t *runs, int runs_count,
+		const scheduler_topology_t *topology, int workers, FILE *out)
+{
+	int i, j, k, started = 0, status = 0;
+	simulator_sweep_t sweep = { traces, trace_counts, runs, runs_count, 0, topology };
+
+	if (workers > runs_count)
+		workers = runs_count;
+
+	pthread_t *threads = malloc(workers * sizeof(pthread_t));
+
+	for (i = 0; i < workers; i++)
+	{
+		if (pthread_create(&threads[i], NULL, sweep_worker, &sweep) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+		started++;
+	}
+
+	/* Finish the sweep on this thread if no worker could be started */
+	if (started == 0)
+		sweep_worker(&sweep);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	fprintf(out, "trace,cores,scheme,status,jobs,time,decisions,decision_hash,avg_waiting,avg_turnaround,avg_response,cpu_utilization,io_utilization,io_overlap,migrations,cross_domain,cross_socket,upmigrations");
+	for (j = 0; j < LATENCY_METRICS; j++)
+		for (k = 0; k < REPORT_PERCENTILES; k++)
+			fprintf(out, ",%s_%s", latency_csv_names[j], report_percentile_names[k]);
+	fprintf(out, "\n");
+
+	for (i = 0; i < runs_count; i++)
+	{
+		const simulator_run_t *r = &runs[i];
+		fprintf(out, "%s,%d,%s,%d,%d,%d,%d,%016llx,%.2f,%.2f,%.2f,%.4f,%.4f,%.4f,%d,%d,%d,%d",
+				file_names[r->trace], r->cores, r->scheme_name, r->status,
+				r->result.jobs, r->result.time, r->result.decisions, r->result.decision_hash,
+				r->result.waiting_time, r->result.turnaround_time, r->result.response_time,
+				r->result.cpu_utilization, r->result.io_utilization, r->result.io_overlap,
+				r->result.migrations.migrations, r->result.migrations.cross_domain,
+				r->result.migrations.cross_socket, r->result.migrations.upmigrations);
+
+		for (j = 0; j < LATENCY_METRICS; j++)
+			for (k = 0; k < REPORT_PERCENTILES; k++)
+				fprintf(out, ",%g", r->result.percentiles[j][k]);
+		fprintf(out, "\n");
+
+		if (r->status != 0)
+			status = 3;
+	}
+
+	return status;
+}
+
+
+int main(int argc, char **argv)
+{
+	int c, i, j, k;
+	int cores = 0, scheme = -1, quantum = 0;
+	char *cores_arg = NULL, *scheme_arg = NULL, *output_name = NULL, *histogram_name = NULL, *decision_name = NULL;
+	char topology_cores[16];
+	scheduler_topology_t topology, *topology_arg = NULL;
+	int workers = 0, sweep = 0, percentiles = 0;
+
+	/*
+	 * Parse command line options.
+	 */
+	while ((c = getopt(argc, argv, "c:s:j:o:PH:D:T:")) != -1)
+	{
+		switch (c)
+		{
+			case 'c':
+				cores_arg = optarg;
+				break;
+
+			case 's':
+				scheme_arg = optarg;
+				break;
+
+			case 'j':
+				workers = atoi(optarg);
+				sweep = 1;
+
+				if (workers <= 0)
+				{
+					fprintf(stderr, "Option -j <workers> require a positive number.\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'o':
+				output_name = optarg;
+				sweep = 1;
+				break;
+
+			case 'P':
+				percentiles = 1;
+				break;
+
+			case 'H':
+				histogram_name = optarg;
+				break;
+
+			case 'D':
+				decision_name = optarg;
+				break;
+
+			case 'T':
+				if (topology_arg != NULL || parse_topology(optarg, &topology) != 0)
+				{
+					fprintf(stderr, "Option -T <topology> is not a valid topology.\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				topology_arg = &topology;
+				break;
+
+			case '?':
+				print_usage(argv[0]);
+				return 1;
+
+			default:
+				printf("....\n");
+				break;
+		}
+	}
+
+	// The topology fixes the number of cores
+	if (cores_arg == NULL && topology_arg != NULL)
+	{
+		snprintf(topology_cores, sizeof(topology_cores), "%d", topology_arg->cores);
+		cores_arg = topology_cores;
+	}
+
+	if (cores_arg == NULL)
+	{
+		fprintf(stderr, "Required option -c <cores> is not present.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if (scheme_arg == NULL)
+	{
+		fprintf(stderr, "Required option -s <scheme> is not present.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if (strchr(cores_arg, ',') || strchr(scheme_arg, ',') || argc - optind > 1)
+		sweep = 1;
+
+	if (optind == argc || (!sweep && optind != argc - 1))
+	{
+		fprintf(stderr, "A single input file is required.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+
+	/*
+	 * Expand the option lists (a single value is a list of one).
+	 */
+	int cores_count = 1, schemes_count = 1;
+	for (i = 0; cores_arg[i]; i++)
+		if (cores_arg[i] == ',')
+			cores_count++;
+	for (i = 0; scheme_arg[i]; i++)
+		if (scheme_arg[i] == ',')
+			schemes_count++;
+
+	char **cores_list = malloc(cores_count * sizeof(char *));
+	char **schemes_list = malloc(schemes_count * sizeof(char *));
+	int *core_values = malloc(cores_count * sizeof(int));
+	int *scheme_values = malloc(schemes_count * sizeof(int));
+	int *quantum_values = malloc(schemes_count * sizeof(int));
+
+	cores_count = split_list(cores_arg, cores_list, cores_count);
+	schemes_count = split_list(scheme_arg, schemes_list, schemes_count);
+
+	for (i = 0; i < cores_count; i++)
+	{
+		core_values[i] = atoi(cores_list[i]);
+
+		if (core_values[i] <= 0)
+		{
+			fprintf(stderr, "Option -c <cores> require a positive number.\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (topology_arg != NULL && core_values[i] != topology_arg->cores)
+		{
+			fprintf(stderr, "Option -c <cores> must match the %d core(s) of the topology.\n", topology_arg->cores);
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < schemes_count; i++)
+	{
+		int err = parse_scheme(schemes_list[i], &scheme_values[i], &quantum_values[i]);
+
+		if (err == -2)
+		{
+			fprintf(stderr, "Option -s <scheme> requires a positive number for the quantum of RR. (Eg: -s RR2)\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		else if (err == -1)
+		{
+			fprintf(stderr, "Required option -s <scheme> is not present.\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (cores_count == 0 || schemes_count == 0)
+	{
+		fprintf(stderr, "Required options -c <cores> and -s <scheme> must not be empty.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+
+	/*
+	 * Load every trace once up front.
+	 */
+	int traces_count = argc - optind;
+	char **file_names = &argv[optind];
+	simulator_job_list_t **traces = malloc(traces_count * sizeof(simulator_job_list_t *));
+	int *trace_counts = malloc(traces_count * sizeof(int));
+
+	for (i = 0; i < traces_count; i++)
+	{
+		int err = load_trace(file_names[i], &traces[i], &trace_counts[i]);
+		if (err)
+			return err;
+	}
+
+
+	if (sweep)
+	{
+		int runs_count = traces_count * cores_count * schemes_count;
+		simulator_run_t *runs = calloc(runs_count, sizeof(simulator_run_t));
+		int run = 0;
+
+		for (i = 0; i < traces_count; i++)
+			for (j = 0; j < cores_count; j++)
+				for (k = 0; k < schemes_count; k++, run++)
+				{
+					runs[run].trace = i;
+					runs[run].cores = core_values[j];
+					runs[run].scheme = scheme_values[k];
+					runs[run].quantum = quantum_values[k];
+					runs[run].scheme_name = schemes_list[k];
+					runs[run].status = -1;
+				}
+
+		if (workers == 0)
+		{
+			long online = sysconf(_SC_NPROCESSORS_ONLN);
+			workers = online > 0 ? (int)online : 1;
+		}
+
+		FILE *out = stdout;
+		if (output_name != NULL && (out = fopen(output_name, "w")) == NULL)
+		{
+			fprintf(stderr, "Unable to open file \"%s\".\n", output_name);
+			return 2;
+		}
+
+		int status = run_sweep(file_names, traces, trace_counts, runs, runs_count, topology_arg, workers, out);
+
+		if (out != stdout)
+			fclose(out);
+
+		for (i = 0; i < traces_count; i++)
+			free_trace(traces[i], trace_counts[i]);
+		free(traces);
+		free(trace_counts);
+		free(runs);
+		free(cores_list);
+		free(schemes_list);
+		free(core_values);
+		free(scheme_values);
+		free(quantum_values);
+		if (topology_arg != NULL)
+			free_topology(topology_arg);
+
+		return status;
+	}
+
+
+	/*
+	 * Run the simulation.
+	 */
+	cores = core_values[0];
+	scheme = scheme_values[0];
+	quantum = quantum_values[0];
+
+	printf("Loaded %d core(s) and %d job(s) using ", cores, trace_counts[0]);
+	if (scheme == FCFS) { printf("First Come First Served (FCFS)"); }
+	else if (scheme == SJF) { printf("Non-preemptive Shortest Job First (SJF)"); }
+	else if (scheme == PSJF) { printf("Preemptive Shortest Job First (PSJF)"); }
+	else if (scheme == PRI) { printf("Non-preemptive Priority (PRI)"); }
+	else if (scheme == PPRI) { printf("Preemptive Priority (PPRI)"); }
+	else if (scheme == RR) { printf("Round Robin (RR) with a quantum of %d", quantum); }
+	printf(" scheduling...\n\n");
+
+	if (topology_arg != NULL)
+	{
+		printf("Topology:");
+		for (i = 0; i < cores; i++)
+			printf(" %d:%d/%d@%d", i, topology.socket[i], topology.cache_domain[i], topology.speed[i]);
+		printf(" (core:socket/cache domain@speed)\n\n");
+	}
+
+	simulator_options_t options = { cores, scheme, quantum, 1, NULL, NULL, topology_arg };
+	if (histogram_name != NULL)
+	{
+		if ((options.histogram_out = fopen(histogram_name, "w")) == NULL)
+		{
+			fprintf(stderr, "Unable to open file \"%s\".\n", histogram_name);
+			return 2;
+		}
+		fprintf(options.histogram_out, "metric,low,high,count,cumulative\n");
+	}
+
+	if (decision_name != NULL && (options.decision_out = fopen(decision_name, "w")) == NULL)
+	{
+		fprintf(stderr, "Unable to open file \"%s\".\n", decision_name);
+		return 2;
+	}
+
+	simulator_result_t result;
+	int status = simulate(traces[0], trace_counts[0], &options, &result);
+
+	if (status == 0 && percentiles)
+	{
+		printf("\n%-24s", "Latency Percentiles:");
+		for (j = 0; j < REPORT_PERCENTILES; j++)
+			printf(" %9s", report_percentile_names[j]);
+		printf("\n");
+
+		for (i = 0; i < LATENCY_METRICS; i++)
+		{
+			printf("  %-22s", latency_names[i]);
+			for (j = 0; j < REPORT_PERCENTILES; j++)
+				printf(" %9.2f", result.percentiles[i][j]);
+			printf("\n");
+		}
+	}
+
+	if (options.histogram_out != NULL)
+		fclose(options.histogram_out);
+	if (options.decision_out != NULL)
+		fclose(options.decision_out);
+
+	free_trace(traces[0], trace_counts[0]);
+	free(traces);
+	free(trace_counts);
+	free(cores_list);
+	free(schemes_list);
+	free(core_values);
+	free(scheme_values);
+	free(quantum_values);
+	if (topology_arg != NULL)
+		free_topology(topology_arg);
+
+	return status;
 }
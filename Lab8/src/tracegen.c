@@ -0,0 +1,554 @@
+/** @file tracegen.c
+ *
+ * Synthetic workload generator for the simulator. Writes traces in the
+ * same "Arrival time","Run time","Priority" CSV format as examples/,
+ * with a fourth "Bursts" column when I/O-bound jobs are requested.
+ *
+ * Every random draw comes from one seeded xoshiro256** stream, so the
+ * same options and seed always produce the same trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+
+#define MAX_PARAMS      4
+#define MAX_PRIORITIES 64
+#define MAX_IO_BURSTS  64
+#define OUT_BUFSIZE    (1 << 20)
+#define MAX_LINE       (4 * 12 + 2 * MAX_IO_BURSTS * 12)
+
+/*
+ * Arrival processes, run time distributions and a generic "name:a,b,c"
+ * specification as given on the command line.
+ */
+typedef enum {ARRIVAL_POISSON = 0, ARRIVAL_MMPP, ARRIVAL_DIURNAL} arrival_t;
+typedef enum {RUN_EXP = 0, RUN_PARETO, RUN_BIMODAL} runtime_t;
+
+typedef struct _tracegen_spec_t
+{
+	char name[16];
+	double params[MAX_PARAMS];
+	int count;
+} tracegen_spec_t;
+
+typedef struct _tracegen_rng_t
+{
+	uint64_t s[4];
+} tracegen_rng_t;
+
+/*
+ * State of the arrival process between two draws.
+ */
+typedef struct _tracegen_arrival_t
+{
+	arrival_t kind;
+	double now;
+
+	/* MMPP: current state and when it ends */
+	int state;
+	double rate[2], mean_sojourn[2], state_end;
+
+	/* Diurnal: base rate, relative amplitude and period */
+	double base, amplitude, period;
+} tracegen_arrival_t;
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s -n <jobs> [-a <arrival>] [-r <run time>] [-p <priorities>] [-I <I/O jobs>] [-S <seed>] [-U] [-o <file>]\n", program_name);
+	fprintf(stderr, "       %s -n 1000000 -a mmpp:0.05,0.5,2000,200 -r pareto:1.5,2,5000 -p 1:6,2:3,3:1 -S 7 -o big.csv\n", program_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Arrival processes (rates are jobs per time unit):\n");
+	fprintf(stderr, "  poisson:<rate>                                    (default poisson:0.1)\n");
+	fprintf(stderr, "  mmpp:<low rate>,<high rate>,<low mean>,<high mean> two-state bursty process\n");
+	fprintf(stderr, "  diurnal:<rate>,<amplitude 0..1>,<period>          sinusoidal rate\n");
+	fprintf(stderr, "Run time distributions:\n");
+	fprintf(stderr, "  exp:<mean>                                        (default exp:8)\n");
+	fprintf(stderr, "  pareto:<alpha>,<min>[,<max>]                      heavy tailed\n");
+	fprintf(stderr, "  bimodal:<short mean>,<long mean>,<long fraction>\n");
+	fprintf(stderr, "Priorities: <priority>:<weight>,...                 (default 1:1,2:1,3:1,4:1,5:1)\n");
+	fprintf(stderr, "I/O jobs: <fraction>,<bursts>,<I/O mean>              fraction of jobs that block <bursts> times\n");
+	fprintf(stderr, "          for exp(<I/O mean>), each followed by a CPU burst from the run time distribution\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Arrival times are made unique (as libscheduler assumes) unless -U is given.\n");
+}
+
+
+/*
+ * xoshiro256** seeded through splitmix64.
+ */
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(tracegen_rng_t *rng, uint64_t seed)
+{
+	int i;
+	for (i = 0; i < 4; i++)
+		rng->s[i] = splitmix64(&seed);
+}
+
+static inline uint64_t rng_next(tracegen_rng_t *rng)
+{
+	uint64_t *s = rng->s;
+	const uint64_t result = rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return result;
+}
+
+/* Uniform on (0, 1], never 0 so it is safe to take the log of */
+static inline double rng_uniform(tracegen_rng_t *rng)
+{
+	return ((rng_next(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static inline double rng_exp(tracegen_rng_t *rng, double mean)
+{
+	return -mean * log(rng_uniform(rng));
+}
+
+
+/*
+ * Parse "name" or "name:a,b,c" into spec. Returns 0 on success.
+ */
+int parse_spec(const char *arg, tracegen_spec_t *spec)
+{
+	const char *colon = strchr(arg, ':');
+	size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+
+	if (len == 0 || len >= sizeof(spec->name))
+		return -1;
+
+	memcpy(spec->name, arg, len);
+	spec->name[len] = '\0';
+	spec->count = 0;
+
+	if (!colon)
+		return 0;
+
+	const char *p = colon + 1;
+	while (*p && spec->count < MAX_PARAMS)
+	{
+		char *end;
+		spec->params[spec->count++] = strtod(p, &end);
+
+		if (end == p || (*end != ',' && *end != '\0'))
+			return -1;
+		p = *end ? end + 1 : end;
+	}
+
+	return *p ? -1 : 0;
+}
+
+int parse_arrival(const char *arg, tracegen_arrival_t *a)
+{
+	tracegen_spec_t spec;
+
+	memset(a, 0, sizeof(*a));
+	if (parse_spec(arg, &spec))
+		return -1;
+
+	if (strcmp(spec.name, "poisson") == 0 && spec.count == 1 && spec.params[0] > 0)
+	{
+		a->kind = ARRIVAL_POISSON;
+		a->rate[0] = spec.params[0];
+	}
+	else if (strcmp(spec.name, "mmpp") == 0 && spec.count == 4 &&
+			spec.params[0] > 0 && spec.params[1] > 0 && spec.params[2] > 0 && spec.params[3] > 0)
+	{
+		a->kind = ARRIVAL_MMPP;
+		a->rate[0] = spec.params[0];
+		a->rate[1] = spec.params[1];
+		a->mean_sojourn[0] = spec.params[2];
+		a->mean_sojourn[1] = spec.params[3];
+	}
+	else if (strcmp(spec.name, "diurnal") == 0 && spec.count == 3 &&
+			spec.params[0] > 0 && spec.params[1] >= 0 && spec.params[1] <= 1 && spec.params[2] > 0)
+	{
+		a->kind = ARRIVAL_DIURNAL;
+		a->base = spec.params[0];
+		a->amplitude = spec.params[1];
+		a->period = spec.params[2];
+	}
+	else
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Parse "prio:weight,prio:weight,..." into cumulative weights.
+ * Returns the number of priorities, or -1 on error.
+ */
+int parse_priorities(const char *arg, int *priorities, double *cumulative)
+{
+	int count = 0;
+	double total = 0;
+	const char *p = arg;
+
+	while (*p)
+	{
+		char *end;
+		long prio = strtol(p, &end, 10);
+		if (end == p || *end != ':' || count == MAX_PRIORITIES)
+			return -1;
+
+		p = end + 1;
+		double weight = strtod(p, &end);
+		if (end == p || weight < 0 || (*end != ',' && *end != '\0'))
+			return -1;
+
+		total += weight;
+		priorities[count] = (int)prio;
+		cumulative[count] = total;
+		count++;
+		p = *end ? end + 1 : end;
+	}
+
+	if (count == 0 || total <= 0)
+		return -1;
+
+	for (int i = 0; i < count; i++)
+		cumulative[i] /= total;
+	cumulative[count - 1] = 1.0;
+
+	return count;
+}
+
+
+/*
+ * Advance the arrival process and return the (real valued) time of the
+ * next arrival.
+ */
+double next_arrival(tracegen_arrival_t *a, tracegen_rng_t *rng)
+{
+	switch (a->kind)
+	{
+		case ARRIVAL_POISSON:
+			a->now += rng_exp(rng, 1.0 / a->rate[0]);
+			break;
+
+		case ARRIVAL_MMPP:
+			/*
+			 * Both the arrivals and the state changes are memoryless, so
+			 * when the candidate arrival falls past the end of the current
+			 * state we can jump to the switch and draw again.
+			 */
+			for (;;)
+			{
+				double t = a->now + rng_exp(rng, 1.0 / a->rate[a->state]);
+				if (t < a->state_end)
+				{
+					a->now = t;
+					break;
+				}
+
+				a->now = a->state_end;
+				a->state ^= 1;
+				a->state_end = a->now + rng_exp(rng, a->mean_sojourn[a->state]);
+			}
+			break;
+
+		case ARRIVAL_DIURNAL:
+			/* Thinning of a Poisson process at the peak rate */
+			for (;;)
+			{
+				double peak = a->base * (1.0 + a->amplitude);
+				a->now += rng_exp(rng, 1.0 / peak);
+
+				double rate = a->base * (1.0 + a->amplitude * sin(2.0 * M_PI * a->now / a->period));
+				if (rng_uniform(rng) * peak <= rate)
+					break;
+			}
+			break;
+	}
+
+	return a->now;
+}
+
+int next_run_time(runtime_t kind, const double *params, tracegen_rng_t *rng)
+{
+	double t = 1;
+
+	switch (kind)
+	{
+		case RUN_EXP:
+			t = rng_exp(rng, params[0]);
+			break;
+
+		case RUN_PARETO:
+			t = params[1] / pow(rng_uniform(rng), 1.0 / params[0]);
+			if (params[2] > 0 && t > params[2])
+				t = params[2];
+			break;
+
+		case RUN_BIMODAL:
+			t = rng_uniform(rng) <= params[2] ? rng_exp(rng, params[1]) : rng_exp(rng, params[0]);
+			break;
+	}
+
+	/* libscheduler rejects jobs that do not need the CPU at all */
+	if (t < 1)
+		return 1;
+	if (t > INT_MAX)
+		return INT_MAX;
+	return (int)(t + 0.5);
+}
+
+
+/*
+ * Append the decimal representation of v followed by c and return the
+ * new end of the buffer. Much cheaper than fprintf() per field.
+ */
+static inline char *append_int(char *p, int v, char c)
+{
+	char tmp[12];
+	int n = 0;
+	unsigned int u = v < 0 ? -(unsigned int)v : (unsigned int)v;
+
+	do
+	{
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+
+	if (v < 0)
+		*p++ = '-';
+	while (n)
+		*p++ = tmp[--n];
+	*p++ = c;
+
+	return p;
+}
+
+
+int main(int argc, char **argv)
+{
+	int c;
+	long long jobs = -1;
+	uint64_t seed = 678;
+	int unique = 1;
+	char *output_name = NULL;
+
+	tracegen_arrival_t arrival;
+	tracegen_spec_t run_spec;
+	runtime_t run_kind = RUN_EXP;
+	double run_params[MAX_PARAMS] = {8, 0, 0, 0};
+
+	int priorities[MAX_PRIORITIES], priorities_count;
+	double cumulative[MAX_PRIORITIES];
+
+	tracegen_spec_t io_spec;
+	char io_arg[128];
+	double io_fraction = 0, io_mean = 0;
+	int io_bursts = 0;
+
+	parse_arrival("poisson:0.1", &arrival);
+	priorities_count = parse_priorities("1:1,2:1,3:1,4:1,5:1", priorities, cumulative);
+
+	/*
+	 * Parse command line options.
+	 */
+	while ((c = getopt(argc, argv, "n:a:r:p:I:S:Uo:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				jobs = atoll(optarg);
+				break;
+
+			case 'a':
+				if (parse_arrival(optarg, &arrival))
+				{
+					fprintf(stderr, "Invalid arrival process \"%s\".\n", optarg);
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'r':
+				memset(run_params, 0, sizeof(run_params));
+				if (parse_spec(optarg, &run_spec) == 0)
+					memcpy(run_params, run_spec.params, sizeof(double) * run_spec.count);
+				else
+					run_spec.name[0] = '\0';
+
+				if (strcmp(run_spec.name, "exp") == 0 && run_spec.count == 1 && run_params[0] > 0)
+					run_kind = RUN_EXP;
+				else if (strcmp(run_spec.name, "pareto") == 0 && (run_spec.count == 2 || run_spec.count == 3) &&
+						run_params[0] > 0 && run_params[1] > 0)
+					run_kind = RUN_PARETO;
+				else if (strcmp(run_spec.name, "bimodal") == 0 && run_spec.count == 3 &&
+						run_params[0] > 0 && run_params[1] > 0 && run_params[2] >= 0 && run_params[2] <= 1)
+					run_kind = RUN_BIMODAL;
+				else
+				{
+					fprintf(stderr, "Invalid run time distribution \"%s\".\n", optarg);
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'p':
+				priorities_count = parse_priorities(optarg, priorities, cumulative);
+				if (priorities_count < 0)
+				{
+					fprintf(stderr, "Invalid priority mix \"%s\".\n", optarg);
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'I':
+				/* The mix is a bare parameter list, so give it a name to parse */
+				snprintf(io_arg, sizeof(io_arg), "io:%s", optarg);
+
+				if (parse_spec(io_arg, &io_spec) || io_spec.count != 3 || io_spec.params[0] < 0 || io_spec.params[0] > 1 ||
+						io_spec.params[1] < 1 || io_spec.params[1] > MAX_IO_BURSTS || io_spec.params[2] <= 0)
+				{
+					fprintf(stderr, "Invalid I/O job mix \"%s\".\n", optarg);
+					print_usage(argv[0]);
+					return 1;
+				}
+
+				io_fraction = io_spec.params[0];
+				io_bursts = (int)io_spec.params[1];
+				io_mean = io_spec.params[2];
+				break;
+
+			case 'S':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'U':
+				unique = 0;
+				break;
+
+			case 'o':
+				output_name = optarg;
+				break;
+
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (jobs < 0 || optind != argc)
+	{
+		fprintf(stderr, "Required option -n <jobs> is not present.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if (output_name != NULL && (out = fopen(output_name, "w")) == NULL)
+	{
+		fprintf(stderr, "Unable to open file \"%s\".\n", output_name);
+		return 2;
+	}
+
+
+	/*
+	 * Generate the trace.
+	 */
+	tracegen_rng_t rng;
+	rng_seed(&rng, seed);
+
+	if (arrival.kind == ARRIVAL_MMPP)
+		arrival.state_end = rng_exp(&rng, arrival.mean_sojourn[0]);
+
+	char *buf = malloc(OUT_BUFSIZE);
+	char *p = buf;
+	long long last_arrival = -1;
+	long long i;
+
+	if (io_bursts > 0)
+		fputs("\"Arrival time\",\"Run time\",\"Priority\",\"Bursts\"\n", out);
+	else
+		fputs("\"Arrival time\",\"Run time\",\"Priority\"\n", out);
+
+	for (i = 0; i < jobs; i++)
+	{
+		long long t = (long long)next_arrival(&arrival, &rng);
+		if (i == 0)
+			t = 0;  // Start the trace at time 0 like the examples do
+		if (unique && t <= last_arrival)
+			t = last_arrival + 1;
+		if (t > INT_MAX)
+		{
+			fprintf(stderr, "Arrival time overflowed after %lld job(s); use a higher arrival rate.\n", i);
+			break;
+		}
+		last_arrival = t;
+
+		int run_time = next_run_time(run_kind, run_params, &rng);
+
+		double u = rng_uniform(&rng);
+		int k = 0;
+		while (cumulative[k] < u)
+			k++;
+
+		p = append_int(p, (int)t, ',');
+		p = append_int(p, run_time, ',');
+
+		if (io_bursts == 0)
+			p = append_int(p, priorities[k], '\n');
+		else
+		{
+			/*
+			 * Only traces with I/O draw these extra numbers, so CPU-only
+			 * traces stay the same for a given seed.
+			 */
+			p = append_int(p, priorities[k], ',');
+
+			if (rng_uniform(&rng) <= io_fraction)
+			{
+				int b;
+				for (b = 0; b < io_bursts; b++)
+				{
+					int io_time = (int)(rng_exp(&rng, io_mean) + 0.5);
+					p = append_int(p, io_time < 1 ? 1 : io_time, ';');
+					p = append_int(p, next_run_time(run_kind, run_params, &rng), b == io_bursts - 1 ? '\n' : ';');
+				}
+			}
+			else
+				*p++ = '\n';
+		}
+
+		if (p - buf > OUT_BUFSIZE - MAX_LINE)
+		{
+			fwrite(buf, 1, p - buf, out);
+			p = buf;
+		}
+	}
+
+	fwrite(buf, 1, p - buf, out);
+	free(buf);
+
+	if (out != stdout)
+		fclose(out);
+
+	return i == jobs ? 0 : 2;
+}
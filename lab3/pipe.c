@@ -1,73 +1,367 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/wait.h>
+#include <sys/sendfile.h>
 
 #define R_FILE "/proc/meminfo"
-#define BSIZE 256 
+#define BSIZE 256
 
-int main()
+/*
+ * How process a gets the file into the pipe and process b gets the
+ * pipe out to stdout:
+ *
+ *   copy      read() into a buffer, write() it out: two copies through
+ *             user space and two system calls per buffer, at both ends
+ *   splice    splice() file -> pipe and pipe -> stdout: the kernel moves
+ *             page references, and nothing passes through user space
+ *   sendfile  sendfile() file -> pipe in process a, splice() in b
+ *
+ * The zero-copy modes move SPLICE_CHUNK bytes per call and grow the
+ * pipe to PIPE_SIZE with F_SETPIPE_SZ, so a call can move far more than
+ * the default 64KB pipe holds. Where the kernel cannot splice a file
+ * (some /proc files, a terminal on stdout), they fall back to copying.
+ */
+#define SPLICE_CHUNK  (1 << 20)
+#define PIPE_SIZE     (1 << 20)
+
+enum { MODE_COPY, MODE_SPLICE, MODE_SENDFILE };
+static const char *mode_names[] = { "copy", "splice", "sendfile" };
+
+static int mode = MODE_COPY;
+static size_t bsize = BSIZE;
+static int pipe_size = 0;
+static const char *tee_file = NULL;
+static int stats = 0;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Write all len bytes of buf to fd. Returns 0, or -1 with errno set.
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+  ssize_t wsize;
+
+  while (len > 0) {
+    if ((wsize = write(fd, buf, len)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += wsize;
+    len -= wsize;
+  }
+  return 0;
+}
+
+/*
+ * Copy from in to out through buf until end of file, or for len bytes
+ * if len is not 0. Returns the number of bytes copied, or -1.
+ */
+static long long copy_fd(int in, int out, char *buf, size_t len)
+{
+  long long total = 0;
+  ssize_t rsize;
+  size_t want;
+
+  for (;;) {
+    want = bsize;
+    if (len != 0 && len - total < want)
+      want = len - total;
+    if (want == 0)
+      break;
+    if ((rsize = read(in, buf, want)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (rsize == 0)
+      break;
+    if (write_all(out, buf, rsize) < 0)
+      return -1;
+    total += rsize;
+  }
+  return total;
+}
+
+/*
+ * Splice from in to out until end of file, or for len bytes if len is
+ * not 0. Returns the number of bytes moved, or -1; errno is EINVAL when
+ * one of the two cannot be spliced, which the callers check only
+ * before anything was moved.
+ */
+static long long splice_fd(int in, int out, size_t len)
 {
-  int status;
+  long long total = 0;
+  ssize_t n;
+  size_t want;
+
+  for (;;) {
+    want = SPLICE_CHUNK;
+    if (len != 0 && len - total < want)
+      want = len - total;
+    if (want == 0)
+      break;
+    n = splice(in, NULL, out, NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (total > 0 && errno == EINVAL)
+        errno = EIO;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    total += n;
+  }
+  return total;
+}
+
+/*
+ * Process a: the file into the pipe
+ */
+static int pump_in(int rfd, int wfd, char *buf)
+{
+  long long moved = -1;
+  ssize_t n;
+
+  if (mode == MODE_SPLICE) {
+    moved = splice_fd(rfd, wfd, 0);
+  } else if (mode == MODE_SENDFILE) {
+    moved = 0;
+    while ((n = sendfile(wfd, rfd, NULL, SPLICE_CHUNK)) > 0)
+      moved += n;
+    if (n < 0) {
+      if (moved > 0 && errno == EINVAL)
+        errno = EIO;
+      moved = -1;
+    }
+  }
+
+  if (mode == MODE_COPY || (moved < 0 && errno == EINVAL))
+    moved = copy_fd(rfd, wfd, buf, 0);
+
+  if (moved < 0) {
+    fprintf(stderr, "\nError writing to pipe. ERROR#%d\n", errno);
+    return EXIT_FAILURE;
+  }
+  return 0;
+}
+
+/*
+ * Process b: the pipe out to stdout, and with -T also into tee_file,
+ * duplicating the pipe's pages into a second pipe with tee()
+ */
+static long long pump_out(int rfd, char *buf)
+{
+  long long total = 0, moved;
+  int tfd, tpipe[2] = { -1, -1 };
+  ssize_t n;
+
+  if (mode == MODE_COPY)
+    return copy_fd(rfd, STDOUT_FILENO, buf, 0);
+
+  if (tee_file == NULL) {
+    moved = splice_fd(rfd, STDOUT_FILENO, 0);
+    if (moved < 0 && errno == EINVAL)
+      moved = copy_fd(rfd, STDOUT_FILENO, buf, 0);
+    return moved;
+  }
+
+  if ((tfd = open(tee_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf(stderr, "\nError opening file: %s. ERROR#%d\n", tee_file, errno);
+    total = -1;
+    goto out;
+  }
+  if (pipe(tpipe) < 0) {
+    fprintf(stderr, "\nError creating pipe. ERROR#%d\n", errno);
+    total = -1;
+    goto out;
+  }
+  if (pipe_size > 0)
+    fcntl(tpipe[1], F_SETPIPE_SZ, pipe_size);
+
+  /*
+   * tee() leaves the data in the pipe, so each round first copies what
+   * is there to the file, then consumes it to stdout
+   */
+  while ((n = tee(rfd, tpipe[1], SPLICE_CHUNK, 0)) > 0) {
+    if (splice_fd(tpipe[0], tfd, n) != n) {
+      total = -1;
+      goto out;
+    }
+    moved = splice_fd(rfd, STDOUT_FILENO, n);
+    if (moved < 0 && errno == EINVAL)
+      moved = copy_fd(rfd, STDOUT_FILENO, buf, n);
+    if (moved != n) {
+      total = -1;
+      goto out;
+    }
+    total += n;
+  }
+  if (n < 0)
+    total = -1;
+
+out:
+  if (tpipe[0] >= 0) {
+    close(tpipe[0]);
+    close(tpipe[1]);
+  }
+  if (tfd >= 0)
+    close(tfd);
+  return total;
+}
+
+static void usage(void)
+{
+  printf("Usage: ./pipe [-m copy|splice|sendfile] [-b BUFSIZE] [-p PIPESIZE] [-f FILE] [-T TEEFILE] [-s]\n");
+  printf("  -m  how data moves into and out of the pipe (default copy)\n");
+  printf("  -b  copy buffer size in bytes (default %d)\n", BSIZE);
+  printf("  -p  pipe size set with F_SETPIPE_SZ (default: %d for splice and sendfile)\n", PIPE_SIZE);
+  printf("  -f  file to send through the pipe (default %s)\n", R_FILE);
+  printf("  -T  in splice and sendfile modes, also tee the stream into this file\n");
+  printf("  -s  print bytes moved and throughput to stderr\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int status, failed;
   pid_t pid_1, pid_2;
+  int pfd[2];
+  int c, i;
+  const char *r_file = R_FILE;
+  double start;
+
+  while ((c = getopt(argc, argv, "m:b:p:f:T:s")) != -1) {
+    switch (c) {
+    case 'm':
+      for (i = 0; i < 3; i++)
+        if (strcmp(optarg, mode_names[i]) == 0)
+          mode = i;
+      if (strcmp(optarg, mode_names[mode]) != 0)
+        usage();
+      break;
+    case 'b':
+      bsize = strtoul(optarg, NULL, 0);
+      break;
+    case 'p':
+      pipe_size = atoi(optarg);
+      break;
+    case 'f':
+      r_file = optarg;
+      break;
+    case 'T':
+      tee_file = optarg;
+      break;
+    case 's':
+      stats = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || bsize == 0)
+    usage();
+  if (pipe_size == 0 && mode != MODE_COPY)
+    pipe_size = PIPE_SIZE;
 
-  /* XXX - need to declare pipes and make the pipe() system call before
-   * forking any children
+  /*
+   * The pipe from process a to process b, made before forking so both
+   * children inherit it. A bigger pipe lets a splice move more per
+   * call; pipe-max-size can refuse it, which only costs speed.
    */
+  if (pipe(pfd) < 0) {
+    fprintf(stderr, "\nError creating pipe. ERROR#%d\n", errno);
+    return EXIT_FAILURE;
+  }
+  if (pipe_size > 0 && fcntl(pfd[1], F_SETPIPE_SZ, pipe_size) < 0)
+    fprintf(stderr, "Could not set pipe size to %d. ERROR#%d\n", pipe_size, errno);
+
+  start = now();
 
   pid_1 = fork();
-  if (pid_1 == 0) { 
-    /* process a */ 
+  if (pid_1 == 0) {
+    /* process a */
 
     int rfd;
-    size_t rsize;
-    char buf[BSIZE];
+    char *buf;
 
-    if ((rfd = open(R_FILE, O_RDONLY)) < 0) {
-      fprintf(stderr, "\nError opening file: %s. ERROR#%d\n", R_FILE, errno);
+    close(pfd[0]);
+    if ((rfd = open(r_file, O_RDONLY)) < 0) {
+      fprintf(stderr, "\nError opening file: %s. ERROR#%d\n", r_file, errno);
       return EXIT_FAILURE;
     }
+    if ((buf = malloc(bsize)) == NULL)
+      return EXIT_FAILURE;
 
     /* read contents of file and write it out to a pipe */
-    while ((rsize = read(rfd, buf, BSIZE)) > 0) {
-      /* XXX - this should write to a pipe - not to stdout */
-      write(STDOUT_FILENO, buf, rsize);
-    }
+    status = pump_in(rfd, pfd[1], buf);
 
     close(rfd);
-    return 0; 
-  } 
+    close(pfd[1]);
+    free(buf);
+    return status;
+  }
 
   pid_2 = fork();
   if (pid_2 == 0) {
     /* process b */
-#if 0
-    size_t rsize;
-    char buf[BSIZE];
+    long long total;
+    double elapsed;
+    char *buf;
+    int size = fcntl(pfd[0], F_GETPIPE_SZ);
+
+    close(pfd[1]);
+    if ((buf = malloc(bsize)) == NULL)
+      return EXIT_FAILURE;
 
     /* read from pipe and write out contents to the terminal */
+    total = pump_out(pfd[0], buf);
+    elapsed = now() - start;
+    close(pfd[0]);
+    free(buf);
 
-    /* XXX - this should read from a pipe - not from stdin */
-    while ((rsize = read(STDIN_FILENO, buf, BSIZE)) > 0) {
-      write(STDOUT_FILENO, buf, rsize);
+    if (total < 0) {
+      fprintf(stderr, "\nError reading from pipe. ERROR#%d\n", errno);
+      return EXIT_FAILURE;
     }
-#endif
+    if (stats)
+      fprintf(stderr, "pipe: %s, %zu-byte %s, %d-byte pipe: %lld bytes in %.3f s, %.2f GB/s\n",
+              mode_names[mode], mode == MODE_COPY ? bsize : (size_t) SPLICE_CHUNK,
+              mode == MODE_COPY ? "buffer" : "calls", size, total, elapsed, total / elapsed / 1e9);
 
     return 0;
   }
 
   /* shell process */
+  close(pfd[0]);
+  close(pfd[1]);
+
   if ((waitpid(pid_1, &status, 0)) == -1) {
     fprintf(stderr, "Process 1 encountered an error. ERROR%d", errno);
     return EXIT_FAILURE;
-  }        
+  }
+  failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
 
   if ((waitpid(pid_2, &status, 0)) == -1) {
     fprintf(stderr, "Process 2 encountered an error. ERROR%d", errno);
     return EXIT_FAILURE;
   }
+  failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
 
-  return 0;
+  /* A child that failed makes the whole pump fail, so callers can tell */
+  return failed ? EXIT_FAILURE : 0;
 }